@@ -0,0 +1,135 @@
+// im3bench.cpp : Encoder and decoder benchmarks over a synthetic image
+// corpus, reported as JSON for tracking regressions
+#include "stdafx.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Benchmark.h"
+#include "Codec.h"
+
+static void printUsage()
+{
+	std::cerr <<
+		"usage: im3bench [options]\n"
+		"options:\n"
+		"  -t, --threads N      threads to work with, 0 for one per core (default 1)\n"
+		"  -q, --quality N      quality from 1 to 100, 0 for the fixed table\n"
+		"  -s, --sampling S     chroma sampling 444, 422 or 420\n"
+		"  -r, --restart N      blocks per restart segment, 0 for none\n"
+		"  -e, --entropy C      entropy coding huffman or arithmetic, or compare to\n"
+		"                       time the coders against each other\n"
+		"  --tables T           Huffman tables default or optimized for each image,\n"
+		"                       or train to write default tables trained on the corpus\n"
+		"  -n, --iterations N   runs to take the best of (default 3)\n"
+		"  --sizes WxH,...      image sizes (default 256x256,640x480,1280x720)\n"
+		"  -o, --output FILE    write the JSON to a file instead of the console\n";
+}
+
+// Sizes such as 640x480,1280x720, false when malformed
+static bool parseSizes(const std::string& list, std::vector<std::pair<INT32, INT32>>& sizes)
+{
+	sizes.clear();
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		INT32 width = 0;
+		INT32 height = 0;
+		char rest = 0;
+		if (sscanf(list.substr(start, end - start).c_str(), "%dx%d%c", &width, &height, &rest) != 2 ||
+			width <= 0 || height <= 0) {
+			return false;
+		}
+		sizes.push_back(std::make_pair(width, height));
+		start = end + 1;
+	}
+	return !sizes.empty();
+}
+
+int main(int argc, char** argv)
+{
+	UINT32 threads = 1;
+	UINT8 quality = 0;
+	Sampling sampling = SAMPLING_444;
+	UINT16 restartInterval = 0;
+	EntropyCoding coding = ENTROPY_HUFFMAN;
+	bool compareCoders = false;
+	bool optimizeTables = false;
+	bool trainTables = false;
+	UINT32 iterations = 3;
+	std::vector<std::pair<INT32, INT32>> sizes = { { 256, 256 }, { 640, 480 }, { 1280, 720 } };
+	std::string outputName;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+		std::string value = argv[++i];
+		if (arg == "-t" || arg == "--threads") {
+			threads = static_cast<UINT32>(strtoul(value.c_str(), NULL, 10));
+		}
+		else if (arg == "-q" || arg == "--quality") {
+			quality = static_cast<UINT8>(std::min(strtoul(value.c_str(), NULL, 10), 100ul));
+		}
+		else if ((arg == "-s" || arg == "--sampling") && (value == "444" || value == "422" || value == "420")) {
+			sampling = value == "444" ? SAMPLING_444 : value == "422" ? SAMPLING_422 : SAMPLING_420;
+		}
+		else if (arg == "-r" || arg == "--restart") {
+			restartInterval = static_cast<UINT16>(std::min(strtoul(value.c_str(), NULL, 10), 65535ul));
+		}
+		else if ((arg == "-e" || arg == "--entropy") &&
+			(value == "huffman" || value == "arithmetic" || value == "compare")) {
+			coding = value == "arithmetic" ? ENTROPY_ARITHMETIC : ENTROPY_HUFFMAN;
+			compareCoders = value == "compare";
+		}
+		else if (arg == "--tables" && (value == "default" || value == "optimized" || value == "train")) {
+			optimizeTables = value == "optimized";
+			trainTables = value == "train";
+		}
+		else if (arg == "-n" || arg == "--iterations") {
+			iterations = std::max(static_cast<UINT32>(strtoul(value.c_str(), NULL, 10)), 1u);
+		}
+		else if (arg == "--sizes" && parseSizes(value, sizes)) {
+		}
+		else if (arg == "-o" || arg == "--output") {
+			outputName = value;
+		}
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	Codec codec;
+	codec.setThreadCount(threads);
+	codec.setQuality(quality);
+	codec.setSampling(sampling);
+	codec.setRestartInterval(restartInterval);
+	codec.setEntropyCoding(coding);
+	codec.setOptimizeTables(optimizeTables);
+	std::ofstream file;
+	if (!outputName.empty()) {
+		file.open(outputName);
+		if (!file) {
+			fprintf(stderr, "%s: cannot create\n", outputName.c_str());
+			return 2;
+		}
+	}
+	std::ostream& output = outputName.empty() ? std::cout : file;
+	if (trainTables) {
+		Benchmark::trainTables(output, codec, sizes);
+	}
+	else if (compareCoders) {
+		Benchmark::entropyCoders(output, codec, sizes, iterations);
+	}
+	else {
+		Benchmark::codecStages(output, codec, sizes, iterations);
+	}
+	return output ? 0 : 2;
+}
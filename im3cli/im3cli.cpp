@@ -0,0 +1,741 @@
+// im3cli.cpp : Command-line encoder and decoder, without any window system
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#include "Benchmark.h"
+#include "BitmapFile.h"
+#include "BitmapReader.h"
+#include "Codec.h"
+#include "IM3File.h"
+#include "Stream.h"
+
+// Exit codes
+static const int EXIT_USAGE = 1;
+static const int EXIT_IO = 2;
+
+// Settings of a run, from the command line
+struct Options {
+	UINT32 Threads = 1;
+	bool Timing = false;
+	UINT8 Quality = 0;
+	Sampling ChromaSampling = SAMPLING_444;
+	UINT16 RestartInterval = 0;
+	EntropyCoding Coding = ENTROPY_HUFFMAN;
+	bool OptimizeTables = false;
+	bool Streamed = false;
+	INT32 Region[4] = { 0, 0, std::numeric_limits<INT32>::max(), std::numeric_limits<INT32>::max() };
+	UINT8 Scale = 1;
+	UINT32 Iterations = 5;
+	UINT32 Jobs = 0;
+	UINT64 MemoryBudget = 1024;
+	std::string ListFile;
+	std::vector<std::string> Files;
+};
+
+static void printUsage()
+{
+	std::cerr <<
+		"usage: im3cli encode [options] input.bmp output.im3\n"
+		"       im3cli decode [options] input.im3 output.bmp\n"
+		"       im3cli bench [options] [input.bmp]\n"
+		"       im3cli batch [options] input-directory output-directory\n"
+		"       im3cli batch [options] --list files.txt output-directory\n"
+		"options:\n"
+		"  -t, --threads N      threads to work with, 0 for one per core (default 1)\n"
+		"  --time               print how long each step takes\n"
+		"  -q, --quality N      quality from 1 to 100, 0 for the fixed table (encode)\n"
+		"  -s, --sampling S     chroma sampling 444, 422 or 420 (encode)\n"
+		"  -r, --restart N      blocks per restart segment, 0 for none (encode)\n"
+		"  -e, --entropy C      entropy coding huffman or arithmetic (encode)\n"
+		"  --optimize           build Huffman tables for each image (encode)\n"
+		"  --stream             encode a few strips at a time from the file (encode)\n"
+		"  --region X,Y,W,H     decode a rectangle of the image only (decode)\n"
+		"  --scale N            decode scaled down by 1, 2, 4 or 8 (decode)\n"
+		"  -n, --iterations N   runs to average over (bench)\n"
+		"  -j, --jobs N         files encoded at once, 0 for one per core (batch)\n"
+		"  --memory MB          memory the files in flight may take (batch, default 1024)\n"
+		"  --list FILE          encode the files listed one per line (batch)\n";
+}
+
+// Parse the options following the subcommand, false on a bad one
+static bool parseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		const char* value = hasValue ? argv[i + 1] : "";
+		if (arg == "--time") {
+			options.Timing = true;
+		}
+		else if (arg == "--stream") {
+			options.Streamed = true;
+		}
+		else if (arg == "--optimize") {
+			options.OptimizeTables = true;
+		}
+		else if ((arg == "-t" || arg == "--threads") && hasValue) {
+			options.Threads = static_cast<UINT32>(strtoul(value, NULL, 10));
+			i++;
+		}
+		else if ((arg == "-q" || arg == "--quality") && hasValue) {
+			options.Quality = static_cast<UINT8>(std::min(strtoul(value, NULL, 10), 100ul));
+			i++;
+		}
+		else if ((arg == "-s" || arg == "--sampling") && hasValue) {
+			std::string sampling = value;
+			if (sampling == "444") {
+				options.ChromaSampling = SAMPLING_444;
+			}
+			else if (sampling == "422") {
+				options.ChromaSampling = SAMPLING_422;
+			}
+			else if (sampling == "420") {
+				options.ChromaSampling = SAMPLING_420;
+			}
+			else {
+				return false;
+			}
+			i++;
+		}
+		else if ((arg == "-r" || arg == "--restart") && hasValue) {
+			options.RestartInterval = static_cast<UINT16>(std::min(strtoul(value, NULL, 10), 65535ul));
+			i++;
+		}
+		else if ((arg == "-e" || arg == "--entropy") && hasValue) {
+			std::string coding = value;
+			if (coding == "huffman") {
+				options.Coding = ENTROPY_HUFFMAN;
+			}
+			else if (coding == "arithmetic") {
+				options.Coding = ENTROPY_ARITHMETIC;
+			}
+			else {
+				return false;
+			}
+			i++;
+		}
+		else if (arg == "--region" && hasValue) {
+			if (sscanf(value, "%d,%d,%d,%d",
+				&options.Region[0], &options.Region[1], &options.Region[2], &options.Region[3]) != 4) {
+				return false;
+			}
+			i++;
+		}
+		else if (arg == "--scale" && hasValue) {
+			options.Scale = static_cast<UINT8>(strtoul(value, NULL, 10));
+			if (options.Scale != 1 && options.Scale != 2 && options.Scale != 4 && options.Scale != 8) {
+				return false;
+			}
+			i++;
+		}
+		else if ((arg == "-n" || arg == "--iterations") && hasValue) {
+			options.Iterations = std::max(static_cast<UINT32>(strtoul(value, NULL, 10)), 1u);
+			i++;
+		}
+		else if ((arg == "-j" || arg == "--jobs") && hasValue) {
+			options.Jobs = static_cast<UINT32>(strtoul(value, NULL, 10));
+			i++;
+		}
+		else if (arg == "--memory" && hasValue) {
+			options.MemoryBudget = std::max(static_cast<UINT64>(strtoull(value, NULL, 10)), static_cast<UINT64>(1));
+			i++;
+		}
+		else if (arg == "--list" && hasValue) {
+			options.ListFile = value;
+			i++;
+		}
+		else if (arg.size() > 1 && arg[0] == '-') {
+			return false;
+		}
+		else {
+			options.Files.push_back(arg);
+		}
+	}
+	return true;
+}
+
+// Codec with the settings of the options
+static void configure(Codec& codec, const Options& options)
+{
+	codec.setThreadCount(options.Threads);
+	codec.setQuality(options.Quality);
+	codec.setSampling(options.ChromaSampling);
+	codec.setRestartInterval(options.RestartInterval);
+	codec.setEntropyCoding(options.Coding);
+	codec.setOptimizeTables(options.OptimizeTables);
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void printTime(const Options& options, const char* step, double milliseconds)
+{
+	if (options.Timing) {
+		fprintf(stderr, "%-10s %10.2f ms\n", step, milliseconds);
+	}
+}
+
+static const char* createResultMessage(BitmapFile::CreateResult result)
+{
+	switch (result) {
+	case BitmapFile::ERROR_NOT_BMP:
+		return "Not a valid BMP file";
+	case BitmapFile::ERROR_NOT_UNCOMPRESSED:
+		return "Not uncompressed";
+	case BitmapFile::ERROR_NOT_24BIT:
+		return "Not a 24-bit image";
+	case BitmapFile::ERROR_READ_FAILED:
+		return "Read failed";
+	default:
+		return "OK";
+	}
+}
+
+// Read a bitmap file, NULL with a message on failure
+static BitmapFile* readBitmap(const std::string& fileName)
+{
+	FileStream input(fileName.c_str(), false);
+	if (!input.isOpen()) {
+		fprintf(stderr, "%s: cannot open\n", fileName.c_str());
+		return NULL;
+	}
+	BitmapFile::CreateResult result;
+	BitmapFile* bitmapFile = new BitmapFile(input, &result);
+	if (result != BitmapFile::OK) {
+		fprintf(stderr, "%s: %s\n", fileName.c_str(), createResultMessage(result));
+		delete bitmapFile;
+		return NULL;
+	}
+	return bitmapFile;
+}
+
+static int encode(const Options& options)
+{
+	if (options.Files.size() != 2) {
+		printUsage();
+		return EXIT_USAGE;
+	}
+	Codec codec;
+	configure(codec, options);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (options.Streamed) {
+		FileStream input(options.Files[0].c_str(), false);
+		FileStream output(options.Files[1].c_str(), true);
+		if (!input.isOpen() || !output.isOpen()) {
+			fprintf(stderr, "%s: cannot open\n", (input.isOpen() ? options.Files[1] : options.Files[0]).c_str());
+			return EXIT_IO;
+		}
+		BitmapFile::CreateResult result = BitmapFile::OK;
+		if (!codec.compressStream(input, output, &result)) {
+			fprintf(stderr, "%s: %s\n", options.Files[0].c_str(),
+				result != BitmapFile::OK ? createResultMessage(result) : "Write failed");
+			return EXIT_IO;
+		}
+		printTime(options, "encode", millisecondsSince(start));
+		return EXIT_SUCCESS;
+	}
+	std::unique_ptr<BitmapFile> bitmapFile(readBitmap(options.Files[0]));
+	if (!bitmapFile) {
+		return EXIT_IO;
+	}
+	printTime(options, "read", millisecondsSince(start));
+	start = std::chrono::steady_clock::now();
+	std::unique_ptr<IM3File> im3File(codec.compress(bitmapFile.get()));
+	printTime(options, "compress", millisecondsSince(start));
+	start = std::chrono::steady_clock::now();
+	FileStream output(options.Files[1].c_str(), true);
+	if (!output.isOpen() || !im3File->Save(output)) {
+		fprintf(stderr, "%s: write failed\n", options.Files[1].c_str());
+		return EXIT_IO;
+	}
+	printTime(options, "write", millisecondsSince(start));
+	return EXIT_SUCCESS;
+}
+
+static int decode(const Options& options)
+{
+	if (options.Files.size() != 2) {
+		printUsage();
+		return EXIT_USAGE;
+	}
+	Codec codec;
+	configure(codec, options);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_ptr<FileStream> input(new FileStream(options.Files[0].c_str(), false));
+	if (!input->isOpen()) {
+		fprintf(stderr, "%s: cannot open\n", options.Files[0].c_str());
+		return EXIT_IO;
+	}
+	IM3File im3File(std::move(input));
+	if (!im3File.getPayload()) {
+		fprintf(stderr, "%s: Not a valid IM3 file\n", options.Files[0].c_str());
+		return EXIT_IO;
+	}
+	printTime(options, "read", millisecondsSince(start));
+	start = std::chrono::steady_clock::now();
+	bool whole = options.Scale == 1 && options.Region[0] == 0 && options.Region[1] == 0 &&
+		options.Region[2] == std::numeric_limits<INT32>::max() &&
+		options.Region[3] == std::numeric_limits<INT32>::max();
+	std::unique_ptr<BitmapFile> bitmapFile(whole ?
+		codec.decompress(&im3File) :
+		codec.decompressRegion(
+			&im3File,
+			options.Region[0],
+			options.Region[1],
+			options.Region[2],
+			options.Region[3],
+			options.Scale));
+	printTime(options, "decompress", millisecondsSince(start));
+	start = std::chrono::steady_clock::now();
+	FileStream output(options.Files[1].c_str(), true);
+	if (!output.isOpen() || !bitmapFile->Save(output)) {
+		fprintf(stderr, "%s: write failed\n", options.Files[1].c_str());
+		return EXIT_IO;
+	}
+	printTime(options, "write", millisecondsSince(start));
+	return EXIT_SUCCESS;
+}
+
+// Micro-benchmarks of the building blocks, or the average time to
+// compress and decompress a given bitmap
+static int bench(const Options& options)
+{
+	if (options.Files.empty()) {
+		Benchmark::dctEngines(std::cout);
+		Benchmark::inverseDCTEngines(std::cout);
+		Benchmark::inverseDCTAccuracy(std::cout);
+		Benchmark::colorConversion(std::cout);
+		return EXIT_SUCCESS;
+	}
+	if (options.Files.size() != 1) {
+		printUsage();
+		return EXIT_USAGE;
+	}
+	std::unique_ptr<BitmapFile> bitmapFile(readBitmap(options.Files[0]));
+	if (!bitmapFile) {
+		return EXIT_IO;
+	}
+	Codec codec;
+	configure(codec, options);
+	double compressTime = 0.0;
+	double decompressTime = 0.0;
+	for (UINT32 i = 0; i < options.Iterations; i++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::unique_ptr<IM3File> im3File(codec.compress(bitmapFile.get()));
+		compressTime += millisecondsSince(start);
+		start = std::chrono::steady_clock::now();
+		std::unique_ptr<BitmapFile> decoded(codec.decompress(im3File.get()));
+		decompressTime += millisecondsSince(start);
+	}
+	double megapixels = static_cast<double>(bitmapFile->getWidth()) * bitmapFile->getHeight() / 1e6;
+	double compressMs = compressTime / options.Iterations;
+	double decompressMs = decompressTime / options.Iterations;
+	printf("%s: %dx%d, %u threads\n", options.Files[0].c_str(),
+		bitmapFile->getWidth(), bitmapFile->getHeight(), options.Threads);
+	printf("compress   %10.2f ms %8.2f MP/s\n", compressMs, megapixels * 1000.0 / compressMs);
+	printf("decompress %10.2f ms %8.2f MP/s\n", decompressMs, megapixels * 1000.0 / decompressMs);
+	return EXIT_SUCCESS;
+}
+
+// Memory a file in flight is reckoned to take per byte of bitmap: the
+// bitmap itself, its run-length symbols and the entropy-coded streams
+static const UINT64 BATCH_BYTES_PER_BITMAP_BYTE = 3;
+
+// One file of a batch
+struct BatchJob {
+	std::string Input;
+	std::string Output;
+	UINT64 Bytes; // Size of the bitmap file
+	UINT64 Cost; // Memory reckoned for it while in flight
+	bool Streamed; // Encoded a few strips at a time, being too large to hold
+	bool Renamed; // Numbered apart from an output of the same name
+};
+
+// Hands out the jobs of a batch within a memory budget. Of the jobs that
+// fit into what the running ones leave, the largest goes first, so that
+// large files start early and small ones fill in around them. A job that
+// fits nowhere waits until nothing else runs, so none is starved.
+class BatchScheduler
+{
+private:
+	std::mutex mutex;
+	std::condition_variable released;
+	// Jobs still to run by their cost
+	std::multimap<UINT64, size_t> pending;
+	UINT64 budget;
+	UINT64 inFlight;
+	UINT32 running;
+public:
+	BatchScheduler(const std::vector<BatchJob>& jobs, UINT64 budget) :
+		budget(budget), inFlight(0), running(0)
+	{
+		for (size_t i = 0; i < jobs.size(); i++) {
+			pending.insert(std::make_pair(jobs[i].Cost, i));
+		}
+	}
+	// Wait for the next job to run, false when none are left
+	bool take(size_t& job, UINT64& cost)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		std::multimap<UINT64, size_t>::iterator next;
+		for (;;) {
+			if (pending.empty()) {
+				return false;
+			}
+			std::multimap<UINT64, size_t>::iterator fitting = pending.upper_bound(budget - std::min(inFlight, budget));
+			if (fitting != pending.begin()) {
+				next = std::prev(fitting);
+				break;
+			}
+			if (running == 0) {
+				next = std::prev(pending.end());
+				break;
+			}
+			released.wait(lock);
+		}
+		job = next->second;
+		cost = next->first;
+		pending.erase(next);
+		inFlight += cost;
+		running++;
+		return true;
+	}
+	// Give back the memory of a job done
+	void release(UINT64 cost)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		inFlight -= cost;
+		running--;
+		released.notify_all();
+	}
+};
+
+static bool endsWithBmp(const std::string& fileName)
+{
+	if (fileName.size() < 4) {
+		return false;
+	}
+	std::string extension = fileName.substr(fileName.size() - 4);
+	for (char& c : extension) {
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	}
+	return extension == ".bmp";
+}
+
+// Bitmap files of a directory, false when it cannot be read
+static bool listBitmaps(const std::string& directory, std::vector<std::string>& fileNames)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA((directory + "\\*.bmp").c_str(), &found);
+	if (search == INVALID_HANDLE_VALUE) {
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+	}
+	do {
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && endsWithBmp(found.cFileName)) {
+			fileNames.push_back(directory + "\\" + found.cFileName);
+		}
+	} while (FindNextFileA(search, &found));
+	FindClose(search);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir == NULL) {
+		return false;
+	}
+	while (struct dirent* entry = readdir(dir)) {
+		std::string fileName = directory + "/" + entry->d_name;
+		struct stat status;
+		if (endsWithBmp(entry->d_name) && stat(fileName.c_str(), &status) == 0 && S_ISREG(status.st_mode)) {
+			fileNames.push_back(fileName);
+		}
+	}
+	closedir(dir);
+#endif
+	std::sort(fileNames.begin(), fileNames.end());
+	return true;
+}
+
+// File names listed one per line, false when the list cannot be read
+static bool readFileList(const std::string& listName, std::vector<std::string>& fileNames)
+{
+	FILE* list = fopen(listName.c_str(), "r");
+	if (list == NULL) {
+		return false;
+	}
+	char line[4096];
+	while (fgets(line, sizeof(line), list)) {
+		std::string fileName = line;
+		while (!fileName.empty() && (fileName.back() == '\n' || fileName.back() == '\r')) {
+			fileName.pop_back();
+		}
+		if (!fileName.empty()) {
+			fileNames.push_back(fileName);
+		}
+	}
+	fclose(list);
+	return true;
+}
+
+static bool makeDirectory(const std::string& directory)
+{
+#ifdef _WIN32
+	return CreateDirectoryA(directory.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	struct stat status;
+	return mkdir(directory.c_str(), 0777) == 0 || (stat(directory.c_str(), &status) == 0 && S_ISDIR(status.st_mode));
+#endif
+}
+
+// Base name of a bitmap file without its directory or .bmp extension
+static std::string outputBaseName(const std::string& input)
+{
+	size_t slash = input.find_last_of("/\\");
+	std::string baseName = slash == std::string::npos ? input : input.substr(slash + 1);
+	if (endsWithBmp(baseName)) {
+		baseName.resize(baseName.size() - 4);
+	}
+	return baseName;
+}
+
+// Name of an IM3 file as compared without case, as some file systems do
+static std::string outputKey(const std::string& name)
+{
+	std::string key = name;
+	for (char& c : key) {
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	}
+	return key;
+}
+
+// Name of the IM3 file in the output directory for a bitmap file. Every
+// input keeps its own name unless an earlier one of the same base name has
+// it, the later ones numbered x-2.im3, x-3.im3 and on, passing over the
+// names reserved as inputs' own so that no two files of a batch write the
+// same one.
+static std::string outputName(
+	const std::string& outputDirectory,
+	const std::string& input,
+	const std::set<std::string>& reserved,
+	std::set<std::string>& taken,
+	bool& renamed)
+{
+	std::string baseName = outputBaseName(input);
+	std::string name = baseName + ".im3";
+	renamed = !taken.insert(outputKey(name)).second;
+	for (UINT32 n = 2; renamed; n++) {
+		name = baseName + "-" + std::to_string(n) + ".im3";
+		std::string key = outputKey(name);
+		if (reserved.count(key) == 0 && taken.insert(key).second) {
+			break;
+		}
+	}
+	return outputDirectory + "/" + name;
+}
+
+// Totals of the files of a batch done so far
+struct BatchTotals {
+	UINT32 Files = 0;
+	UINT32 Failed = 0;
+	double Megapixels = 0.0;
+	UINT64 InputBytes = 0;
+	UINT64 OutputBytes = 0;
+};
+
+// Read, encode and write one file of a batch, reporting it on a line of
+// its own. Returns the size of the IM3 file, 0 on failure.
+static UINT64 transcode(Codec& codec, const BatchJob& job, double& megapixels, std::string& error)
+{
+	FileStream input(job.Input.c_str(), false);
+	if (!input.isOpen()) {
+		error = "cannot open";
+		return 0;
+	}
+	BitmapFile::CreateResult result = BitmapFile::OK;
+	if (job.Streamed) {
+		{
+			BitmapReader reader(input, &result);
+			if (result != BitmapFile::OK) {
+				error = createResultMessage(result);
+				return 0;
+			}
+			megapixels = static_cast<double>(reader.getWidth()) * reader.getHeight() / 1e6;
+		}
+		FileStream output(job.Output.c_str(), true);
+		if (!output.isOpen()) {
+			error = "cannot create " + job.Output;
+			return 0;
+		}
+		if (!codec.compressStream(input, output, &result)) {
+			error = result != BitmapFile::OK ? createResultMessage(result) : "write failed";
+			return 0;
+		}
+		return output.size();
+	}
+	std::unique_ptr<BitmapFile> bitmapFile(new BitmapFile(input, &result));
+	if (result != BitmapFile::OK) {
+		error = createResultMessage(result);
+		return 0;
+	}
+	megapixels = static_cast<double>(bitmapFile->getWidth()) * bitmapFile->getHeight() / 1e6;
+	std::unique_ptr<IM3File> im3File(codec.compress(bitmapFile.get()));
+	bitmapFile.reset();
+	FileStream output(job.Output.c_str(), true);
+	if (!output.isOpen() || !im3File->Save(output)) {
+		error = "write failed";
+		return 0;
+	}
+	return output.size();
+}
+
+// Encode every bitmap of a directory or list into an output directory, a
+// few files at a time. Each worker reads, encodes and writes a file of its
+// own, so that the reading and writing of some files overlaps the
+// encoding of others.
+static int batch(const Options& options)
+{
+	std::vector<std::string> inputs;
+	std::string outputDirectory;
+	if (!options.ListFile.empty() && options.Files.size() == 1) {
+		if (!readFileList(options.ListFile, inputs)) {
+			fprintf(stderr, "%s: cannot read\n", options.ListFile.c_str());
+			return EXIT_IO;
+		}
+		outputDirectory = options.Files[0];
+	}
+	else if (options.ListFile.empty() && options.Files.size() == 2) {
+		if (!listBitmaps(options.Files[0], inputs)) {
+			fprintf(stderr, "%s: cannot read directory\n", options.Files[0].c_str());
+			return EXIT_IO;
+		}
+		outputDirectory = options.Files[1];
+	}
+	else {
+		printUsage();
+		return EXIT_USAGE;
+	}
+	if (!makeDirectory(outputDirectory)) {
+		fprintf(stderr, "%s: cannot create directory\n", outputDirectory.c_str());
+		return EXIT_IO;
+	}
+	UINT64 budget = options.MemoryBudget << 20;
+	UINT32 workers = options.Jobs != 0 ? options.Jobs : std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<BatchJob> jobs(inputs.size());
+	// Each input's own name is reserved before any is numbered
+	std::set<std::string> reservedNames;
+	for (const std::string& input : inputs) {
+		reservedNames.insert(outputKey(outputBaseName(input) + ".im3"));
+	}
+	std::set<std::string> outputNames;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		FileStream input(inputs[i].c_str(), false);
+		jobs[i].Bytes = input.isOpen() ? input.size() : 0;
+		UINT64 cost = jobs[i].Bytes * BATCH_BYTES_PER_BITMAP_BYTE;
+		jobs[i].Input = inputs[i];
+		jobs[i].Output = outputName(outputDirectory, inputs[i], reservedNames, outputNames, jobs[i].Renamed);
+		// Files too large for the budget are encoded a few strips at a time,
+		// taking a worker's share of it
+		jobs[i].Streamed = cost > budget;
+		jobs[i].Cost = jobs[i].Streamed ? budget / workers : cost;
+	}
+	BatchScheduler scheduler(jobs, budget);
+	std::mutex reportMutex;
+	BatchTotals totals;
+	std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	size_t threadCount = std::min(static_cast<size_t>(workers), jobs.size());
+	for (size_t t = 0; t < threadCount; t++) {
+		threads.emplace_back([&]() {
+			Codec codec;
+			configure(codec, options);
+			size_t job;
+			UINT64 cost;
+			while (scheduler.take(job, cost)) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				double megapixels = 0.0;
+				std::string error;
+				UINT64 outputBytes = transcode(codec, jobs[job], megapixels, error);
+				double milliseconds = millisecondsSince(start);
+				scheduler.release(cost);
+				std::lock_guard<std::mutex> lock(reportMutex);
+				totals.Files++;
+				if (outputBytes == 0) {
+					totals.Failed++;
+					fprintf(stderr, "%s: %s\n", jobs[job].Input.c_str(), error.c_str());
+					continue;
+				}
+				totals.Megapixels += megapixels;
+				totals.InputBytes += jobs[job].Bytes;
+				totals.OutputBytes += outputBytes;
+				printf("%s: %.2f MP, %llu -> %llu bytes, %.2f ms, %.2f MP/s%s%s%s\n",
+					jobs[job].Input.c_str(),
+					megapixels,
+					static_cast<unsigned long long>(jobs[job].Bytes),
+					static_cast<unsigned long long>(outputBytes),
+					milliseconds,
+					megapixels * 1000.0 / std::max(milliseconds, 1e-3),
+					jobs[job].Streamed ? " (streamed)" : "",
+					jobs[job].Renamed ? ", as " : "",
+					jobs[job].Renamed ? jobs[job].Output.c_str() : "");
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double seconds = millisecondsSince(batchStart) / 1000.0;
+	printf("%u files, %u failed, %u jobs, %.2f s: %.2f MP/s, %.2f MB/s in, %.2f MB/s out\n",
+		totals.Files,
+		totals.Failed,
+		workers,
+		seconds,
+		totals.Megapixels / std::max(seconds, 1e-6),
+		totals.InputBytes / 1e6 / std::max(seconds, 1e-6),
+		totals.OutputBytes / 1e6 / std::max(seconds, 1e-6));
+	return totals.Failed != 0 ? EXIT_IO : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (argc < 2 || !parseOptions(argc, argv, options)) {
+		printUsage();
+		return EXIT_USAGE;
+	}
+	std::string command = argv[1];
+	if (command == "encode") {
+		return encode(options);
+	}
+	if (command == "decode") {
+		return decode(options);
+	}
+	if (command == "bench") {
+		return bench(options);
+	}
+	if (command == "batch") {
+		return batch(options);
+	}
+	printUsage();
+	return EXIT_USAGE;
+}
@@ -0,0 +1,30 @@
+# Batches files of the same base names from two directories, one of them
+# named as another's numbered duplicate would be, and checks that every
+# input keeps its own name where it can and that none is overwritten.
+# Takes IM3CLI, SOURCE (a bitmap) and WORK (a scratch directory).
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK}/a ${WORK}/b)
+set(INPUTS a/x.bmp b/x.bmp a/X-2.bmp b/x-2.bmp)
+set(EXPECTED x.im3 x-3.im3 X-2.im3 x-2-2.im3)
+set(LIST "")
+foreach(input ${INPUTS})
+  configure_file(${SOURCE} ${WORK}/${input} COPYONLY)
+  set(LIST "${LIST}${WORK}/${input}\n")
+endforeach()
+file(WRITE ${WORK}/list.txt "${LIST}")
+execute_process(
+  COMMAND ${IM3CLI} batch --jobs 1 --list ${WORK}/list.txt ${WORK}/out
+  RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "batch failed with ${result}")
+endif()
+foreach(name ${EXPECTED})
+  if(NOT EXISTS ${WORK}/out/${name})
+    message(FATAL_ERROR "batch did not write ${name}")
+  endif()
+endforeach()
+file(GLOB outputs ${WORK}/out/*.im3)
+list(LENGTH outputs count)
+if(NOT count EQUAL 4)
+  message(FATAL_ERROR "batch wrote ${count} files, not 4")
+endif()
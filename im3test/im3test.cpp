@@ -0,0 +1,190 @@
+// im3test.cpp : Decodes checked-in files of every format version and round
+// trips a bitmap through the encoder settings, run by CTest
+#include "stdafx.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "BitmapFile.h"
+#include "Codec.h"
+#include "IM3File.h"
+#include "Stream.h"
+
+// Exit codes
+static const int EXIT_USAGE = 1;
+static const int EXIT_FAILED = 2;
+
+// Rectangle of a file decoded on its own and compared with the whole
+static const INT32 REGION[4] = { 3, 2, 9, 7 };
+
+// Encoder settings of a round trip, and the PSNR its decoded image must
+// reach
+struct RoundTrip {
+	const char* Name;
+	UINT8 Quality;
+	Sampling ChromaSampling;
+	UINT16 RestartInterval;
+	EntropyCoding Coding;
+	bool OptimizeTables;
+	DOUBLE MinimumPSNR;
+};
+
+static const RoundTrip ROUND_TRIPS[] = {
+	{ "default tables", 0, SAMPLING_444, 0, ENTROPY_HUFFMAN, false, 25.0 },
+	{ "default tables, high quality", 90, SAMPLING_444, 3, ENTROPY_HUFFMAN, false, 30.0 },
+	{ "optimized tables", 75, SAMPLING_422, 0, ENTROPY_HUFFMAN, true, 22.0 },
+	{ "optimized tables, restarts", 50, SAMPLING_420, 2, ENTROPY_HUFFMAN, true, 20.0 },
+	{ "arithmetic", 0, SAMPLING_444, 0, ENTROPY_ARITHMETIC, false, 25.0 },
+	{ "arithmetic, restarts", 100, SAMPLING_420, 1, ENTROPY_ARITHMETIC, false, 22.0 },
+};
+
+static void printUsage()
+{
+	fprintf(stderr,
+		"usage: im3test decode source.bmp input.im3 width height min-psnr\n"
+		"       im3test roundtrip source.bmp\n");
+}
+
+// Read a bitmap file, NULL with a message on failure
+static BitmapFile* readBitmap(const std::string& fileName)
+{
+	FileStream input(fileName.c_str(), false);
+	BitmapFile::CreateResult result = BitmapFile::OK;
+	BitmapFile* bitmapFile = input.isOpen() ? new BitmapFile(input, &result) : NULL;
+	if (!bitmapFile || result != BitmapFile::OK) {
+		fprintf(stderr, "%s: cannot read\n", fileName.c_str());
+		delete bitmapFile;
+		return NULL;
+	}
+	return bitmapFile;
+}
+
+// Peak signal to noise ratio of a decoded bitmap against the same pixels
+// of the source, which may be larger
+static DOUBLE psnr(BitmapFile* source, BitmapFile* decoded)
+{
+	DOUBLE squareErrorSum = 0.0;
+	for (INT32 y = 0; y < decoded->getHeight(); y++) {
+		const BitmapFile::Pixel* a = source->getPixelRow(y);
+		const BitmapFile::Pixel* b = decoded->getPixelRow(y);
+		for (INT32 x = 0; x < decoded->getWidth(); x++) {
+			DOUBLE red = a[x].Red - b[x].Red;
+			DOUBLE green = a[x].Green - b[x].Green;
+			DOUBLE blue = a[x].Blue - b[x].Blue;
+			squareErrorSum += red * red + green * green + blue * blue;
+		}
+	}
+	if (squareErrorSum == 0.0) {
+		return 100.0;
+	}
+	DOUBLE meanSquareError = squareErrorSum / (3.0 * decoded->getWidth() * decoded->getHeight());
+	return 10.0 * std::log10(255.0 * 255.0 / meanSquareError);
+}
+
+// Decode a file whole and in part, checking its size, its likeness to the
+// source and that the part matches the whole
+static bool checkDecode(
+	const char* name,
+	BitmapFile* source,
+	IM3File* im3File,
+	INT32 width,
+	INT32 height,
+	DOUBLE minimumPSNR)
+{
+	if (!im3File->getPayload()) {
+		fprintf(stderr, "%s: not a valid IM3 file\n", name);
+		return false;
+	}
+	Codec codec;
+	std::unique_ptr<BitmapFile> decoded(codec.decompress(im3File));
+	if (decoded->getWidth() != width || decoded->getHeight() != height) {
+		fprintf(stderr, "%s: decoded %dx%d, not %dx%d\n",
+			name, decoded->getWidth(), decoded->getHeight(), width, height);
+		return false;
+	}
+	DOUBLE peakSNR = psnr(source, decoded.get());
+	if (peakSNR < minimumPSNR) {
+		fprintf(stderr, "%s: PSNR %.2f below %.2f\n", name, peakSNR, minimumPSNR);
+		return false;
+	}
+	std::unique_ptr<BitmapFile> region(codec.decompressRegion(
+		im3File, REGION[0], REGION[1], REGION[2], REGION[3], 1));
+	for (INT32 y = 0; y < REGION[3]; y++) {
+		const BitmapFile::Pixel* a = decoded->getPixelRow(REGION[1] + y) + REGION[0];
+		const BitmapFile::Pixel* b = region->getPixelRow(y);
+		if (std::memcmp(a, b, REGION[2] * sizeof(BitmapFile::Pixel)) != 0) {
+			fprintf(stderr, "%s: region decodes unlike the whole image\n", name);
+			return false;
+		}
+	}
+	printf("%s: %dx%d, PSNR %.2f\n", name, width, height, peakSNR);
+	return true;
+}
+
+static int decode(char** argv)
+{
+	std::unique_ptr<BitmapFile> source(readBitmap(argv[0]));
+	std::unique_ptr<FileStream> input(new FileStream(argv[1], false));
+	if (!source || !input->isOpen()) {
+		fprintf(stderr, "%s: cannot open\n", argv[1]);
+		return EXIT_FAILED;
+	}
+	IM3File im3File(std::move(input));
+	bool passed = checkDecode(argv[1], source.get(), &im3File,
+		atoi(argv[2]), atoi(argv[3]), atof(argv[4]));
+	return passed ? EXIT_SUCCESS : EXIT_FAILED;
+}
+
+// Encode the source with each setting, whole and streamed, which must
+// write the same bytes, and decode the file back
+static int roundTrip(char** argv)
+{
+	std::unique_ptr<BitmapFile> source(readBitmap(argv[0]));
+	if (!source) {
+		return EXIT_FAILED;
+	}
+	MemoryStream bitmapStream;
+	source->Save(bitmapStream);
+	bool passed = true;
+	for (const RoundTrip& roundTrip : ROUND_TRIPS) {
+		Codec codec;
+		codec.setQuality(roundTrip.Quality);
+		codec.setSampling(roundTrip.ChromaSampling);
+		codec.setRestartInterval(roundTrip.RestartInterval);
+		codec.setEntropyCoding(roundTrip.Coding);
+		codec.setOptimizeTables(roundTrip.OptimizeTables);
+		std::unique_ptr<IM3File> compressed(codec.compress(source.get()));
+		MemoryStream* saved = new MemoryStream();
+		std::unique_ptr<Stream> stream(saved);
+		compressed->Save(*saved);
+		MemoryStream streamed;
+		BitmapFile::CreateResult result = BitmapFile::OK;
+		bitmapStream.seek(0);
+		if (!codec.compressStream(bitmapStream, streamed, &result) ||
+			streamed.size() != saved->size() ||
+			std::memcmp(streamed.map(), saved->map(), static_cast<size_t>(saved->size())) != 0) {
+			fprintf(stderr, "%s: streamed encoding differs\n", roundTrip.Name);
+			passed = false;
+			continue;
+		}
+		IM3File im3File(std::move(stream));
+		passed = checkDecode(roundTrip.Name, source.get(), &im3File,
+			source->getWidth(), source->getHeight(), roundTrip.MinimumPSNR) && passed;
+	}
+	return passed ? EXIT_SUCCESS : EXIT_FAILED;
+}
+
+int main(int argc, char** argv)
+{
+	std::string command = argc > 1 ? argv[1] : "";
+	if (command == "decode" && argc == 7) {
+		return decode(argv + 2);
+	}
+	if (command == "roundtrip" && argc == 3) {
+		return roundTrip(argv + 2);
+	}
+	printUsage();
+	return EXIT_USAGE;
+}
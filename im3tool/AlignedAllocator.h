@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+// Allocator for standard containers whose storage starts on an Alignment
+// byte boundary, Alignment being a power of two
+template <typename T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+	template <typename U>
+	struct rebind {
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+	// Allocate room for n objects
+	T* allocate(size_t n);
+	// Release storage returned by allocate
+	void deallocate(T* pointer, size_t n);
+	AlignedAllocator();
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>& other);
+};
+
+template<typename T, size_t Alignment>
+inline T* AlignedAllocator<T, Alignment>::allocate(size_t n)
+{
+	static const size_t OVERHEAD = Alignment + sizeof(void*);
+	if (n > (std::numeric_limits<size_t>::max() - OVERHEAD) / sizeof(T)) {
+		throw std::bad_alloc();
+	}
+	// Over-allocate and keep the original pointer just below the aligned one
+	void* raw = ::operator new(n * sizeof(T) + OVERHEAD);
+	uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + OVERHEAD) & ~static_cast<uintptr_t>(Alignment - 1);
+	reinterpret_cast<void**>(aligned)[-1] = raw;
+	return reinterpret_cast<T*>(aligned);
+}
+
+template<typename T, size_t Alignment>
+inline void AlignedAllocator<T, Alignment>::deallocate(T* pointer, size_t)
+{
+	if (pointer) {
+		::operator delete(reinterpret_cast<void**>(pointer)[-1]);
+	}
+}
+
+template<typename T, size_t Alignment>
+inline AlignedAllocator<T, Alignment>::AlignedAllocator()
+{
+}
+
+template<typename T, size_t Alignment>
+template<typename U>
+inline AlignedAllocator<T, Alignment>::AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+{
+}
+
+template<typename T, typename U, size_t Alignment>
+inline bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+	return true;
+}
+
+template<typename T, typename U, size_t Alignment>
+inline bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+	return false;
+}
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "Arithmetic.h"
+
+void ArithmeticEncoder::shiftLow()
+{
+	// Unless the top byte is 0xFF and a carry could still ripple through
+	// it, the bytes held back are settled
+	if (static_cast<UINT32>(low) < 0xFF000000 || (low >> 32) != 0) {
+		BYTE carry = static_cast<BYTE>(low >> 32);
+		if (!leadingByte) {
+			bytes.push_back(static_cast<BYTE>(cache + carry));
+		}
+		leadingByte = false;
+		for (; pendingBytes > 1; pendingBytes--) {
+			bytes.push_back(static_cast<BYTE>(0xFF + carry));
+		}
+		pendingBytes = 0;
+		cache = static_cast<BYTE>(low >> 24);
+	}
+	pendingBytes += 1;
+	low = (low & 0x00FFFFFF) << 8;
+}
+
+void ArithmeticEncoder::flush()
+{
+	// Four bytes of low and one more to push out the last held back
+	for (UINT32 i = 0; i < 5; i++) {
+		shiftLow();
+	}
+	// Back where a stream starts, the cache holding its leading zero
+	range = 0xFFFFFFFF;
+	leadingByte = true;
+}
+
+std::vector<BYTE> ArithmeticEncoder::drain()
+{
+	std::vector<BYTE> drained;
+	drained.swap(bytes);
+	return drained;
+}
+
+void ArithmeticEncoder::reserve(size_t numBytes)
+{
+	bytes.reserve(numBytes);
+}
+
+ArithmeticEncoder::ArithmeticEncoder()
+	: low(0), range(0xFFFFFFFF), cache(0), pendingBytes(1), leadingByte(true)
+{
+}
+
+ArithmeticDecoder::ArithmeticDecoder(const BYTE* data, size_t size)
+	: data(data), end(data + size), range(0xFFFFFFFF), code(0), overrun(false)
+{
+	// The encoder leaves out the leading zero, so the code starts with the
+	// first four bytes
+	for (UINT32 i = 0; i < 4; i++) {
+		code = (code << 8) | nextByte();
+	}
+}
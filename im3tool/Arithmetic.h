@@ -0,0 +1,195 @@
+#pragma once
+#include <vector>
+#include "commontypes.h"
+
+// Precision of the probabilities of the arithmetic coder in bits
+static const UINT32 ARITHMETIC_PROBABILITY_BITS = 12;
+
+// Adaptation rate once a model has settled, each decision moving its
+// probability 1/32 of the way towards it. A new model moves half way, then
+// a quarter and so on, so that it learns about as fast as counting would.
+static const UINT32 ARITHMETIC_ADAPTATION_SHIFT = 5;
+
+// Categories of the magnitudes from 1 to 2048 the magnitude coders take,
+// the bit length of one less. No DCT component or difference of two DC
+// components is larger.
+static const UINT32 ARITHMETIC_MAGNITUDE_CATEGORIES = 12;
+
+// Adaptive probability of a binary decision being 0, starting out even
+struct BitModel {
+	UINT16 Probability = 1 << (ARITHMETIC_PROBABILITY_BITS - 1);
+	UINT16 Shift = 1; // Adaptation rate of the next decision
+	// Move the probability towards a decision
+	void adapt(UINT32 bit);
+};
+
+// Binary arithmetic coder after the range coder of LZMA, writing a byte
+// at a time with carries propagated into the bytes held back. A stream
+// takes exactly the bytes its decoder reads, so streams can follow one
+// another without their sizes.
+class ArithmeticEncoder
+{
+private:
+	std::vector<BYTE> bytes; // Finished bytes
+	UINT64 low; // Low end of the range, a carry reaching bit 32
+	UINT32 range; // Width of the range
+	BYTE cache; // Last byte held back, a carry still able to reach it
+	UINT64 pendingBytes; // Bytes held back, the cache and the 0xFF bytes after it
+	bool leadingByte; // Whether the cache is the leading zero of the stream, never written
+	// Move the top byte of low into the bytes held back, writing them out
+	// once no carry can reach them
+	void shiftLow();
+public:
+	// Below this the range is widened by a byte
+	static const UINT32 TOP = 1 << 24;
+
+	// Code a decision with its model, adapting the model to it
+	void encode(BitModel& model, UINT32 bit);
+	// Write out the bytes held back, ending the stream. Coding may go on
+	// with a new stream.
+	void flush();
+	// Move out the bytes finished so far, so a long stream can be written
+	// out piece by piece
+	std::vector<BYTE> drain();
+	// Number of bytes finished since the last drain
+	UINT64 byteCount() const;
+	// Reserve space for an expected number of bytes
+	void reserve(size_t numBytes);
+	ArithmeticEncoder();
+};
+
+// Decoder of the streams of ArithmeticEncoder
+class ArithmeticDecoder
+{
+private:
+	const BYTE* data; // Next byte to read
+	const BYTE* end; // One past the last byte of the stream
+	UINT32 range; // Width of the range
+	UINT32 code; // Position of the coded value within the range
+	bool overrun; // Whether more bytes were read than the stream holds
+	// Next byte of the stream, zero past its end
+	BYTE nextByte();
+public:
+	// Decode a decision with its model, adapting the model to it
+	UINT32 decode(BitModel& model);
+	// Number of bytes read
+	size_t bytePosition(const BYTE* start) const;
+	// Whether the stream was over-read
+	bool failed() const;
+	ArithmeticDecoder(const BYTE* data, size_t size);
+};
+
+// Code a magnitude from 1 to 2048 as the category of one less in unary, a
+// context for each step, then the bits under its leading one with the
+// context of the category
+void encodeMagnitude(ArithmeticEncoder& encoder, BitModel* categories, BitModel* bits, UINT32 magnitude);
+
+// Decode a magnitude coded by encodeMagnitude
+UINT32 decodeMagnitude(ArithmeticDecoder& decoder, BitModel* categories, BitModel* bits);
+
+inline void BitModel::adapt(UINT32 bit)
+{
+	if (bit == 0) {
+		Probability += ((1 << ARITHMETIC_PROBABILITY_BITS) - Probability) >> Shift;
+	}
+	else {
+		Probability -= Probability >> Shift;
+	}
+	if (Shift < ARITHMETIC_ADAPTATION_SHIFT) {
+		Shift += 1;
+	}
+}
+
+inline void ArithmeticEncoder::encode(BitModel& model, UINT32 bit)
+{
+	UINT32 bound = (range >> ARITHMETIC_PROBABILITY_BITS) * model.Probability;
+	if (bit == 0) {
+		range = bound;
+	}
+	else {
+		low += bound;
+		range -= bound;
+	}
+	model.adapt(bit);
+	// Probabilities stay 31/4096 away from 0 and 1, so one byte always
+	// widens the range enough
+	if (range < TOP) {
+		range <<= 8;
+		shiftLow();
+	}
+}
+
+inline UINT64 ArithmeticEncoder::byteCount() const
+{
+	return bytes.size();
+}
+
+inline BYTE ArithmeticDecoder::nextByte()
+{
+	if (data == end) {
+		overrun = true;
+		return 0;
+	}
+	return *data++;
+}
+
+inline UINT32 ArithmeticDecoder::decode(BitModel& model)
+{
+	UINT32 bound = (range >> ARITHMETIC_PROBABILITY_BITS) * model.Probability;
+	UINT32 bit;
+	if (code < bound) {
+		range = bound;
+		bit = 0;
+	}
+	else {
+		code -= bound;
+		range -= bound;
+		bit = 1;
+	}
+	model.adapt(bit);
+	if (range < ArithmeticEncoder::TOP) {
+		range <<= 8;
+		code = (code << 8) | nextByte();
+	}
+	return bit;
+}
+
+inline size_t ArithmeticDecoder::bytePosition(const BYTE* start) const
+{
+	return data - start;
+}
+
+inline bool ArithmeticDecoder::failed() const
+{
+	return overrun;
+}
+
+inline void encodeMagnitude(ArithmeticEncoder& encoder, BitModel* categories, BitModel* bits, UINT32 magnitude)
+{
+	UINT32 value = magnitude - 1;
+	UINT32 category = 0;
+	while ((value >> category) != 0) {
+		encoder.encode(categories[category], 1);
+		category += 1;
+	}
+	// The last category needs no end
+	if (category < ARITHMETIC_MAGNITUDE_CATEGORIES - 1) {
+		encoder.encode(categories[category], 0);
+	}
+	for (INT32 bit = static_cast<INT32>(category) - 2; bit >= 0; bit--) {
+		encoder.encode(bits[category], (value >> bit) & 1);
+	}
+}
+
+inline UINT32 decodeMagnitude(ArithmeticDecoder& decoder, BitModel* categories, BitModel* bits)
+{
+	UINT32 category = 0;
+	while (category < ARITHMETIC_MAGNITUDE_CATEGORIES - 1 && decoder.decode(categories[category]) != 0) {
+		category += 1;
+	}
+	UINT32 value = category == 0 ? 0 : 1;
+	for (INT32 bit = static_cast<INT32>(category) - 2; bit >= 0; bit--) {
+		value = (value << 1) | decoder.decode(bits[category]);
+	}
+	return value + 1;
+}
@@ -0,0 +1,853 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include "Benchmark.h"
+#include "Codec.h"
+#include "ColorConvert.h"
+#include "DCT.h"
+#include "IM3File.h"
+#include "Stream.h"
+
+std::vector<DCT::Block<INT8>> Benchmark::sampleBlocks(UINT32 numBlocks)
+{
+	std::vector<DCT::Block<INT8>> blocks(numBlocks);
+	UINT32 seed = 0x1234567;
+	auto next = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return static_cast<INT32>((seed >> 16) & 0x7FFF);
+	};
+	for (UINT32 n = 0; n < numBlocks; n++) {
+		INT32 kind = n % 3;
+		INT32 base = next() % 256 - 128;
+		INT32 slopeX = next() % 9 - 4;
+		INT32 slopeY = next() % 9 - 4;
+		for (UINT8 j = 0; j < 8; j++) {
+			for (UINT8 i = 0; i < 8; i++) {
+				INT32 value;
+				switch (kind)
+				{
+				case 0: // Noise
+					value = next() % 256 - 128;
+					break;
+				case 1: // Gradient
+					value = base + slopeX * i + slopeY * j;
+					break;
+				default: // Flat
+					value = base;
+					break;
+				}
+				blocks[n][j][i] = static_cast<INT8>(std::max(-128, std::min(value, 127)));
+			}
+		}
+	}
+	return blocks;
+}
+
+void Benchmark::dctEngines(std::ostream& out, UINT32 numBlocks)
+{
+	typedef std::chrono::steady_clock Clock;
+	std::vector<DCT::Block<INT8>> blocks = sampleBlocks(numBlocks);
+	// Reference coefficients to check every engine against
+	std::vector<DCT::Block<INT16>> expected(numBlocks);
+	for (UINT8 e = 0; e < DCT::NUM_ENGINES; e++) {
+		DCT::Engine engine = static_cast<DCT::Engine>(e);
+		std::vector<DCT::Block<INT16>> coefficients(numBlocks);
+		Clock::time_point start = Clock::now();
+		for (UINT32 n = 0; n < numBlocks; n++) {
+			coefficients[n] = DCT::forward<INT8, INT16>(engine, blocks[n]);
+		}
+		Clock::time_point end = Clock::now();
+		if (engine == DCT::REFERENCE) {
+			expected = coefficients;
+		}
+		UINT32 mismatches = 0;
+		for (UINT32 n = 0; n < numBlocks; n++) {
+			mismatches += coefficients[n] != expected[n];
+		}
+		DOUBLE seconds = std::chrono::duration<DOUBLE>(end - start).count();
+		out << "dct " << DCT::engineName(engine)
+			<< ": " << static_cast<UINT64>(numBlocks / seconds) << " blocks/s"
+			<< ", " << mismatches << " blocks differ from reference"
+			<< std::endl;
+	}
+}
+
+void Benchmark::inverseDCTEngines(std::ostream& out, UINT32 numBlocks)
+{
+	typedef std::chrono::steady_clock Clock;
+	std::vector<DCT::Block<INT8>> blocks = sampleBlocks(numBlocks);
+	std::vector<DCT::Block<INT16>> coefficients(numBlocks);
+	for (UINT32 n = 0; n < numBlocks; n++) {
+		coefficients[n] = DCT::forward<INT8, INT16>(DCT::FAST, blocks[n]);
+	}
+	for (UINT8 e = 0; e < DCT::NUM_INVERSE_ENGINES; e++) {
+		DCT::InverseEngine engine = static_cast<DCT::InverseEngine>(e);
+		std::vector<DCT::Block<INT8>> samples(numBlocks);
+		Clock::time_point start = Clock::now();
+		for (UINT32 n = 0; n < numBlocks; n++) {
+			samples[n] = DCT::inverse<INT16, INT8>(engine, coefficients[n]);
+		}
+		Clock::time_point end = Clock::now();
+		DOUBLE seconds = std::chrono::duration<DOUBLE>(end - start).count();
+		out << "idct " << DCT::inverseEngineName(engine)
+			<< ": " << static_cast<UINT64>(numBlocks / seconds) << " blocks/s"
+			<< std::endl;
+	}
+}
+
+void Benchmark::inverseDCTAccuracy(std::ostream& out, UINT32 numBlocks)
+{
+	// Input ranges [-low, high] of the random spatial samples
+	static const INT32 RANGES[][2] = { { 128, 127 }, { 5, 5 } };
+	// IEEE 1180 limits
+	static const DOUBLE PEAK_ERROR = 1.0;
+	static const DOUBLE PIXEL_MEAN_SQUARE_ERROR = 0.06;
+	static const DOUBLE OVERALL_MEAN_SQUARE_ERROR = 0.02;
+	static const DOUBLE PIXEL_MEAN_ERROR = 0.015;
+	static const DOUBLE OVERALL_MEAN_ERROR = 0.0015;
+	for (UINT8 e = 0; e < DCT::NUM_INVERSE_ENGINES; e++) {
+		DCT::InverseEngine engine = static_cast<DCT::InverseEngine>(e);
+		if (engine == DCT::INVERSE_REFERENCE) {
+			continue;
+		}
+		for (const auto& range : RANGES) {
+			for (INT32 sign = 1; sign >= -1; sign -= 2) {
+				UINT32 seed = 0x7654321;
+				auto next = [&seed]() {
+					seed = seed * 1103515245 + 12345;
+					return static_cast<INT32>((seed >> 16) & 0x7FFF);
+				};
+				DCT::Block<DOUBLE> errorSum = {};
+				DCT::Block<DOUBLE> squareErrorSum = {};
+				INT32 peak = 0;
+				for (UINT32 n = 0; n < numBlocks; n++) {
+					DCT::Block<INT16> block;
+					for (UINT8 j = 0; j < 8; j++) {
+						for (UINT8 i = 0; i < 8; i++) {
+							INT32 value = next() % (range[0] + range[1] + 1) - range[0];
+							block[j][i] = static_cast<INT16>(sign * value);
+						}
+					}
+					DCT::Block<INT16> coefficients = DCT::forward<INT16, INT16>(DCT::REFERENCE, block);
+					DCT::Block<INT16> expected = DCT::inverse<INT16, INT16>(DCT::INVERSE_REFERENCE, coefficients);
+					DCT::Block<INT16> actual = DCT::inverse<INT16, INT16>(engine, coefficients);
+					for (UINT8 j = 0; j < 8; j++) {
+						for (UINT8 i = 0; i < 8; i++) {
+							INT32 error = actual[j][i] - expected[j][i];
+							peak = std::max(peak, std::abs(error));
+							errorSum[j][i] += error;
+							squareErrorSum[j][i] += error * error;
+						}
+					}
+				}
+				DOUBLE worstPixelMeanSquareError = 0.0;
+				DOUBLE worstPixelMeanError = 0.0;
+				DOUBLE overallSquareError = 0.0;
+				DOUBLE overallError = 0.0;
+				for (UINT8 j = 0; j < 8; j++) {
+					for (UINT8 i = 0; i < 8; i++) {
+						worstPixelMeanSquareError = std::max(worstPixelMeanSquareError, squareErrorSum[j][i] / numBlocks);
+						worstPixelMeanError = std::max(worstPixelMeanError, fabs(errorSum[j][i]) / numBlocks);
+						overallSquareError += squareErrorSum[j][i];
+						overallError += errorSum[j][i];
+					}
+				}
+				DOUBLE overallMeanSquareError = overallSquareError / (64.0 * numBlocks);
+				DOUBLE overallMeanError = fabs(overallError) / (64.0 * numBlocks);
+				bool pass = peak <= PEAK_ERROR
+					&& worstPixelMeanSquareError <= PIXEL_MEAN_SQUARE_ERROR
+					&& overallMeanSquareError <= OVERALL_MEAN_SQUARE_ERROR
+					&& worstPixelMeanError <= PIXEL_MEAN_ERROR
+					&& overallMeanError <= OVERALL_MEAN_ERROR;
+				out << "idct " << DCT::inverseEngineName(engine)
+					<< " range [" << -range[0] << ", " << range[1] << "]"
+					<< (sign < 0 ? " negated" : "")
+					<< ": peak " << peak
+					<< ", pixel mse " << worstPixelMeanSquareError
+					<< ", overall mse " << overallMeanSquareError
+					<< ", pixel mean " << worstPixelMeanError
+					<< ", overall mean " << overallMeanError
+					<< (pass ? " (pass)" : " (FAIL)")
+					<< std::endl;
+			}
+		}
+	}
+}
+
+void Benchmark::colorConversion(std::ostream& out, UINT32 numPixels)
+{
+	typedef std::chrono::steady_clock Clock;
+	// Rows a little over 1000 pixels, not a whole number of vectors, in
+	// strips of 8 sharing their block rows as the codec lays them out
+	static const INT32 ROW_PIXELS = 1003;
+	static const INT32 ROW_SAMPLES = (ROW_PIXELS + 7) / 8 * ColorConvert::BLOCK_STRIDE;
+	INT32 numRows = std::max<INT32>(1, static_cast<INT32>(numPixels / ROW_PIXELS));
+	INT32 numStrips = (numRows + 7) / 8;
+	// First sample of a row in the Y block rows, U and V following
+	auto rowSamples = [](INT32 row) {
+		return static_cast<size_t>(row / 8) * ROW_SAMPLES * 3 + (row % 8) * 8;
+	};
+	std::vector<BitmapFile::Pixel> pixels(static_cast<size_t>(numRows) * ROW_PIXELS);
+	UINT32 seed = 0x2468ACE;
+	for (BitmapFile::Pixel& pixel : pixels) {
+		seed = seed * 1103515245 + 12345;
+		pixel.Red = static_cast<BYTE>(seed >> 24);
+		pixel.Green = static_cast<BYTE>(seed >> 16);
+		pixel.Blue = static_cast<BYTE>(seed >> 8);
+	}
+	std::vector<INT8> expectedYUV(static_cast<size_t>(numStrips) * ROW_SAMPLES * 3);
+	std::vector<BitmapFile::Pixel> expectedPixels(pixels.size());
+	for (UINT8 k = 0; k < ColorConvert::NUM_KERNELS; k++) {
+		ColorConvert::Kernel kernel = static_cast<ColorConvert::Kernel>(k);
+		if (!ColorConvert::supported(kernel)) {
+			out << "color " << ColorConvert::kernelName(kernel) << ": not supported" << std::endl;
+			continue;
+		}
+		std::vector<INT8> yuv(expectedYUV.size());
+		std::vector<BitmapFile::Pixel> output(pixels.size());
+		Clock::time_point start = Clock::now();
+		for (INT32 row = 0; row < numRows; row++) {
+			INT8* samples = yuv.data() + rowSamples(row);
+			ColorConvert::rgbToYUV(
+				kernel, pixels.data() + static_cast<size_t>(row) * ROW_PIXELS, ROW_PIXELS,
+				samples, samples + ROW_SAMPLES, samples + 2 * ROW_SAMPLES);
+		}
+		Clock::time_point middle = Clock::now();
+		for (INT32 row = 0; row < numRows; row++) {
+			const INT8* samples = yuv.data() + rowSamples(row);
+			ColorConvert::yuvToRGB(
+				kernel, samples, samples + ROW_SAMPLES, samples + 2 * ROW_SAMPLES,
+				ROW_PIXELS, output.data() + static_cast<size_t>(row) * ROW_PIXELS);
+		}
+		Clock::time_point end = Clock::now();
+		if (kernel == ColorConvert::REFERENCE) {
+			expectedYUV = yuv;
+			expectedPixels = output;
+		}
+		// Largest difference from the reference in either direction, the
+		// inverse compared on the reference's own YUV samples
+		for (INT32 row = 0; row < numRows; row++) {
+			const INT8* samples = expectedYUV.data() + rowSamples(row);
+			ColorConvert::yuvToRGB(
+				kernel, samples, samples + ROW_SAMPLES, samples + 2 * ROW_SAMPLES,
+				ROW_PIXELS, output.data() + static_cast<size_t>(row) * ROW_PIXELS);
+		}
+		INT32 forwardError = 0;
+		for (size_t n = 0; n < yuv.size(); n++) {
+			forwardError = std::max(forwardError, std::abs(yuv[n] - expectedYUV[n]));
+		}
+		INT32 inverseError = 0;
+		for (size_t n = 0; n < output.size(); n++) {
+			inverseError = std::max(inverseError, std::abs(output[n].Red - expectedPixels[n].Red));
+			inverseError = std::max(inverseError, std::abs(output[n].Green - expectedPixels[n].Green));
+			inverseError = std::max(inverseError, std::abs(output[n].Blue - expectedPixels[n].Blue));
+		}
+		DOUBLE megapixels = static_cast<DOUBLE>(pixels.size()) / 1e6;
+		out << "color " << ColorConvert::kernelName(kernel)
+			<< ": rgb to yuv " << megapixels / std::chrono::duration<DOUBLE>(middle - start).count() << " MP/s"
+			<< ", yuv to rgb " << megapixels / std::chrono::duration<DOUBLE>(end - middle).count() << " MP/s"
+			<< ", max error " << forwardError << " / " << inverseError
+			<< std::endl;
+	}
+}
+
+const char* const Benchmark::STAGE_NAMES[Benchmark::NUM_STAGES] = {
+	"bitmapToYUV",
+	"dct",
+	"quantize",
+	"runLengthDifferenceCoder",
+	"entropyCoder",
+	"entropyDecoder",
+	"runLengthDifferenceDecoder",
+	"dequantize",
+	"inverseDCT",
+	"YUVToBitmap"
+};
+
+// Seconds of a stage run as part of another, which has its time
+static const DOUBLE FUSED_STAGE = -1.0;
+
+static DOUBLE secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<DOUBLE>(std::chrono::steady_clock::now() - start).count();
+}
+
+const char* Benchmark::patternName(Pattern pattern)
+{
+	switch (pattern)
+	{
+	case GRADIENT:
+		return "gradient";
+	case NOISE:
+		return "noise";
+	case TEXT:
+		return "text";
+	case FRACTAL:
+		return "fractal";
+	default:
+		return "unknown";
+	}
+}
+
+// Well mixed 32 bits of a lattice point, for noise that is the same
+// wherever it is sampled from
+static UINT32 latticeHash(INT32 x, INT32 y, UINT32 seed)
+{
+	UINT32 h = static_cast<UINT32>(x) * 0x8DA6B343u ^ static_cast<UINT32>(y) * 0xD8163841u ^ seed * 0xCB1AB31Fu;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return h;
+}
+
+// Value noise in [0, 1) over a lattice cellSize pixels apart, smoothly
+// interpolated between the lattice points
+static DOUBLE valueNoise(INT32 x, INT32 y, INT32 cellSize, UINT32 seed)
+{
+	INT32 cellX = x / cellSize;
+	INT32 cellY = y / cellSize;
+	DOUBLE fx = static_cast<DOUBLE>(x % cellSize) / cellSize;
+	DOUBLE fy = static_cast<DOUBLE>(y % cellSize) / cellSize;
+	fx = fx * fx * (3.0 - 2.0 * fx);
+	fy = fy * fy * (3.0 - 2.0 * fy);
+	auto corner = [&](INT32 dx, INT32 dy) {
+		return (latticeHash(cellX + dx, cellY + dy, seed) >> 8) / 16777216.0;
+	};
+	DOUBLE top = corner(0, 0) + (corner(1, 0) - corner(0, 0)) * fx;
+	DOUBLE bottom = corner(0, 1) + (corner(1, 1) - corner(0, 1)) * fx;
+	return top + (bottom - top) * fy;
+}
+
+static BYTE toByte(DOUBLE value)
+{
+	return static_cast<BYTE>(std::max(0.0, std::min(value * 255.0 + 0.5, 255.0)));
+}
+
+BitmapFile* Benchmark::syntheticImage(Pattern pattern, INT32 width, INT32 height)
+{
+	BitmapFile* image = new BitmapFile(width, height);
+	UINT32 seed = 0x9E3779B9u * (pattern + 1);
+	auto next = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return seed >> 8;
+	};
+	// Glyphs are 5 by 7 dots of 1 by 1 pixels in cells of 7 by 11
+	static const INT32 GLYPH_WIDTH = 5;
+	static const INT32 GLYPH_HEIGHT = 7;
+	static const INT32 CELL_WIDTH = 7;
+	static const INT32 CELL_HEIGHT = 11;
+	static const INT32 MARGIN = 16;
+	// Fractal octaves from cells of 256 pixels down to 2
+	static const INT32 OCTAVES = 7;
+	for (INT32 y = 0; y < height; y++) {
+		BitmapFile::Pixel* row = image->getPixelRow(y);
+		for (INT32 x = 0; x < width; x++) {
+			BitmapFile::Pixel& pixel = row[x];
+			switch (pattern)
+			{
+			case GRADIENT:
+				pixel.Red = toByte(static_cast<DOUBLE>(x) / std::max(width - 1, 1));
+				pixel.Green = toByte(static_cast<DOUBLE>(y) / std::max(height - 1, 1));
+				pixel.Blue = toByte(static_cast<DOUBLE>(x + y) / std::max(width + height - 2, 1));
+				break;
+			case NOISE: {
+				UINT32 bits = next();
+				pixel.Red = static_cast<BYTE>(bits);
+				pixel.Green = static_cast<BYTE>(bits >> 8);
+				pixel.Blue = static_cast<BYTE>(bits >> 16);
+				break;
+			}
+			case TEXT: {
+				// A page of lines of words, each glyph a dot pattern of its own
+				BYTE ink = 255;
+				INT32 column = (x - MARGIN) / CELL_WIDTH;
+				INT32 line = (y - MARGIN) / CELL_HEIGHT;
+				INT32 dotX = (x - MARGIN) % CELL_WIDTH;
+				INT32 dotY = (y - MARGIN) % CELL_HEIGHT;
+				bool onPage = x >= MARGIN && y >= MARGIN && x < width - MARGIN && y < height - MARGIN;
+				UINT32 glyph = latticeHash(column, line, seed);
+				// Every word ends in a space, a few lines in a blank one
+				bool space = glyph % 6 == 0 || latticeHash(0, line, seed) % 9 == 0;
+				if (onPage && !space && dotX < GLYPH_WIDTH && dotY < GLYPH_HEIGHT &&
+					(latticeHash(column * GLYPH_WIDTH + dotX, line * GLYPH_HEIGHT + dotY, glyph) & 3) != 0) {
+					ink = 24;
+				}
+				pixel.Red = ink;
+				pixel.Green = ink;
+				pixel.Blue = static_cast<BYTE>(std::min(ink + 8, 255));
+				break;
+			}
+			default: {
+				// Octaves of falling amplitude, summed to [0, 1) and stretched
+				// about the middle, the chroma weaker than the luma
+				DOUBLE luma = 0.0;
+				DOUBLE red = 0.0;
+				DOUBLE blue = 0.0;
+				DOUBLE amplitude = 1.0;
+				DOUBLE total = 0.0;
+				for (INT32 octave = 0; octave < OCTAVES; octave++) {
+					INT32 cellSize = 256 >> octave;
+					luma += amplitude * valueNoise(x, y, cellSize, seed + octave);
+					red += amplitude * valueNoise(x, y, cellSize, seed + 100 + octave);
+					blue += amplitude * valueNoise(x, y, cellSize, seed + 200 + octave);
+					total += amplitude;
+					amplitude *= 0.65;
+				}
+				luma = 0.5 + 2.5 * (luma / total - 0.5);
+				pixel.Red = toByte(luma + 1.5 * (red / total - 0.5));
+				pixel.Green = toByte(luma);
+				pixel.Blue = toByte(luma + 1.5 * (blue / total - 0.5));
+				break;
+			}
+			}
+		}
+	}
+	return image;
+}
+
+IM3File* Benchmark::encodeStages(Codec& codec, BitmapFile* bitmapFile, StageSeconds& seconds, UINT64& fileBytes)
+{
+	typedef std::chrono::steady_clock Clock;
+	INT32 width = bitmapFile->getWidth();
+	INT32 height = bitmapFile->getHeight();
+	UINT8 sampling = codec.sampling;
+	Codec::PixelRows image = { width, height,
+		[bitmapFile](INT32 y) { return bitmapFile->getPixelRow(y); } };
+	INT32 vertical = verticalFactor(sampling);
+	INT32 numStrips = (blocksCovering(height) + vertical - 1) / vertical;
+	// Colour conversion and any downsampling, strip by strip into whole
+	// planes
+	Clock::time_point start = Clock::now();
+	Codec::YUVPlanes<INT8> yuv(width, height, sampling);
+	codec.parallelFor(numStrips, [&](size_t stripIndex) {
+		Codec::Strip<INT8> strip;
+		Codec::Strip<INT8> chroma;
+		codec.bitmapToYUV(image, static_cast<INT32>(stripIndex), strip);
+		if (sampling != SAMPLING_444) {
+			codec.downsample(strip, chroma);
+		}
+		for (UINT8 plane = 0; plane < 3; plane++) {
+			Codec::Plane<INT8>& output = yuv.planes[plane];
+			bool fullResolution = plane == Codec::Y || sampling == SAMPLING_444;
+			const std::vector<Codec::Block<INT8>>& source = fullResolution ? strip[plane] : chroma[plane];
+			INT32 rowsPerStrip = fullResolution ? vertical : 1;
+			INT32 stride = static_cast<INT32>(source.size()) / rowsPerStrip;
+			INT32 firstRow = static_cast<INT32>(stripIndex) * rowsPerStrip;
+			INT32 numRows = std::min(rowsPerStrip, output.getBlocksHigh() - firstRow);
+			for (INT32 row = 0; row < numRows; row++) {
+				std::copy(
+					source.begin() + row * stride,
+					source.begin() + row * stride + output.getBlocksWide(),
+					output[firstRow + row]);
+			}
+		}
+	});
+	seconds[0] = secondsSince(start);
+	// Each task of the transform and quantization takes one row of blocks
+	// of one plane, as the decoder's do
+	INT32 blocksHigh = yuv.planes[Codec::Y].getBlocksHigh();
+	auto forEachBlockRow = [&](const std::function<void(UINT8, INT32)>& task) {
+		codec.parallelFor(3 * blocksHigh, [&](size_t index) {
+			UINT8 plane = static_cast<UINT8>(index / blocksHigh);
+			INT32 blockY = static_cast<INT32>(index % blocksHigh);
+			if (blockY < yuv.planes[plane].getBlocksHigh()) {
+				task(plane, blockY);
+			}
+		});
+	};
+	start = Clock::now();
+	Codec::YUVPlanes<INT16> dct(width, height, sampling);
+	forEachBlockRow([&](UINT8 plane, INT32 blockY) {
+		for (INT32 blockX = 0; blockX < yuv.planes[plane].getBlocksWide(); blockX++) {
+			dct.planes[plane][blockY][blockX] = codec.dctOnBlock<INT8, INT16>(yuv.planes[plane][blockY][blockX]);
+		}
+	});
+	seconds[1] = secondsSince(start);
+	// The quantized components take the place of the coefficients
+	start = Clock::now();
+	forEachBlockRow([&](UINT8 plane, INT32 blockY) {
+		const Codec::Quantizer& quantizer = codec.quantizers[plane == Codec::Y ? 0 : 1];
+		for (INT32 blockX = 0; blockX < yuv.planes[plane].getBlocksWide(); blockX++) {
+			dct.planes[plane][blockY][blockX] = Codec::quantizeOnBlock<INT16, INT16>(
+				dct.planes[plane][blockY][blockX], quantizer);
+		}
+	});
+	seconds[2] = secondsSince(start);
+	// A plane per task, the DC differences running through all of it
+	start = Clock::now();
+	CodedDC codedDC;
+	CodedAC codedAC;
+	codec.parallelFor(3, [&](size_t plane) {
+		const Codec::Plane<INT16>& quantized = dct.planes[plane];
+		INT32 numBlocks = quantized.getBlocksWide() * quantized.getBlocksHigh();
+		codedDC[plane].resize(numBlocks);
+		codedAC[plane].resize(static_cast<size_t>(numBlocks) * 8 + Codec::MAX_BLOCK_CODES);
+		size_t numCodes = 0;
+		INT16 lastDCValue = 0;
+		for (INT32 blockIndex = 0; blockIndex < numBlocks; blockIndex++) {
+			if (codec.restartInterval != 0 && blockIndex % codec.restartInterval == 0) {
+				lastDCValue = 0;
+			}
+			if (codedAC[plane].size() < numCodes + Codec::MAX_BLOCK_CODES) {
+				codedAC[plane].resize(std::max(2 * codedAC[plane].size(), numCodes + Codec::MAX_BLOCK_CODES));
+			}
+			numCodes += Codec::runLengthDifferenceCodeBlock(
+				quantized.block(blockIndex),
+				lastDCValue,
+				codedDC[plane].data() + blockIndex,
+				codedAC[plane].data() + numCodes);
+		}
+		codedAC[plane].resize(numCodes);
+	});
+	seconds[3] = secondsSince(start);
+	start = Clock::now();
+	std::vector<RestartSegment> restartSegments;
+	IM3File encoded(
+		codec.entropyCoder(codedDC, codedAC, restartSegments),
+		codec.fileExtensionHeader(width, height),
+		restartSegments);
+	seconds[4] = secondsSince(start);
+	// Saved and loaded back, as the decoder only takes loaded files
+	MemoryStream* file = new MemoryStream();
+	std::unique_ptr<Stream> stream(file);
+	encoded.Save(*file);
+	fileBytes = file->size();
+	return new IM3File(std::move(stream));
+}
+
+BitmapFile* Benchmark::decodeStages(Codec& codec, IM3File* im3File, StageSeconds& seconds)
+{
+	typedef std::chrono::steady_clock Clock;
+	// Entropy decoding places the run-length codes and DC differences in the
+	// blocks as it goes, so the two stages are timed together as entropy
+	// decoding, the second left without a time of its own
+	Clock::time_point start = Clock::now();
+	Codec::YUVPlanes<INT16> dct = im3File->getRestartInterval() != 0 ?
+		codec.restartDecoder(im3File) : codec.entropyDecoder(im3File);
+	seconds[5] = secondsSince(start);
+	seconds[6] = FUSED_STAGE;
+	start = Clock::now();
+	codec.dequantize(dct, Codec::fileQuantizers(im3File), dct);
+	seconds[7] = secondsSince(start);
+	start = Clock::now();
+	Codec::YUVPlanes<INT8> yuv;
+	codec.inverseDCT(dct, yuv);
+	seconds[8] = secondsSince(start);
+	start = Clock::now();
+	BitmapFile* decoded = codec.YUVToBitmap(yuv, im3File->getWidth(), im3File->getHeight());
+	seconds[9] = secondsSince(start);
+	return decoded;
+}
+
+DOUBLE Benchmark::psnr(BitmapFile* original, BitmapFile* decoded)
+{
+	DOUBLE squareErrorSum = 0.0;
+	for (INT32 y = 0; y < original->getHeight(); y++) {
+		const BitmapFile::Pixel* a = original->getPixelRow(y);
+		const BitmapFile::Pixel* b = decoded->getPixelRow(y);
+		for (INT32 x = 0; x < original->getWidth(); x++) {
+			DOUBLE red = a[x].Red - b[x].Red;
+			DOUBLE green = a[x].Green - b[x].Green;
+			DOUBLE blue = a[x].Blue - b[x].Blue;
+			squareErrorSum += red * red + green * green + blue * blue;
+		}
+	}
+	if (squareErrorSum == 0.0) {
+		return -1.0;
+	}
+	DOUBLE meanSquareError = squareErrorSum / (3.0 * original->getWidth() * original->getHeight());
+	return 10.0 * std::log10(255.0 * 255.0 / meanSquareError);
+}
+
+void Benchmark::codecStages(
+	std::ostream& out,
+	Codec& codec,
+	const std::vector<std::pair<INT32, INT32>>& sizes,
+	UINT32 iterations)
+{
+	typedef std::chrono::steady_clock Clock;
+	static const char* const SAMPLING_NAMES[] = { "444", "422", "420" };
+	static const char* const CODER_NAMES[] = { "huffman", "arithmetic" };
+	iterations = std::max(iterations, 1u);
+	out << "{\n"
+		<< "  \"settings\": {\n"
+		<< "    \"quality\": " << static_cast<UINT32>(codec.quality) << ",\n"
+		<< "    \"sampling\": \"" << SAMPLING_NAMES[codec.sampling] << "\",\n"
+		<< "    \"restartInterval\": " << codec.restartInterval << ",\n"
+		<< "    \"entropyCoding\": \"" << CODER_NAMES[codec.entropyCoding] << "\",\n"
+		<< "    \"huffmanTables\": \"" << (codec.optimizeTables ? "optimized" : "default") << "\",\n"
+		<< "    \"threads\": " << (codec.threadPool ? codec.threadPool->getThreadCount() : 1) << ",\n"
+		<< "    \"iterations\": " << iterations << ",\n"
+		<< "    \"fusedStages\": { \"" << STAGE_NAMES[6] << "\": \"" << STAGE_NAMES[5] << "\" }\n"
+		<< "  },\n"
+		<< "  \"images\": [";
+	bool first = true;
+	for (const std::pair<INT32, INT32>& size : sizes) {
+		for (UINT8 p = 0; p < NUM_PATTERNS; p++) {
+			Pattern pattern = static_cast<Pattern>(p);
+			std::unique_ptr<BitmapFile> original(syntheticImage(pattern, size.first, size.second));
+			StageSeconds best;
+			best.fill(std::numeric_limits<DOUBLE>::max());
+			DOUBLE compressSeconds = std::numeric_limits<DOUBLE>::max();
+			DOUBLE decompressSeconds = std::numeric_limits<DOUBLE>::max();
+			UINT64 fileBytes = 0;
+			DOUBLE peakSNR = 0.0;
+			for (UINT32 i = 0; i < iterations; i++) {
+				StageSeconds seconds = {};
+				std::unique_ptr<IM3File> im3File(encodeStages(codec, original.get(), seconds, fileBytes));
+				std::unique_ptr<BitmapFile> decoded(decodeStages(codec, im3File.get(), seconds));
+				for (UINT8 s = 0; s < NUM_STAGES; s++) {
+					best[s] = std::min(best[s], seconds[s]);
+				}
+				peakSNR = psnr(original.get(), decoded.get());
+				// The whole encoder and decoder, the stages fused as they run
+				Clock::time_point start = Clock::now();
+				std::unique_ptr<IM3File> compressed(codec.compress(original.get()));
+				compressSeconds = std::min(compressSeconds, secondsSince(start));
+				// The decoder takes the compressor's own output, saved and
+				// loaded back untimed as the staged file is
+				MemoryStream* saved = new MemoryStream();
+				std::unique_ptr<Stream> stream(saved);
+				compressed->Save(*saved);
+				compressed.reset(new IM3File(std::move(stream)));
+				start = Clock::now();
+				decoded.reset(codec.decompress(compressed.get()));
+				decompressSeconds = std::min(decompressSeconds, secondsSince(start));
+			}
+			DOUBLE megapixels = static_cast<DOUBLE>(size.first) * size.second / 1e6;
+			out << (first ? "\n" : ",\n")
+				<< "    {\n"
+				<< "      \"pattern\": \"" << patternName(pattern) << "\",\n"
+				<< "      \"width\": " << size.first << ",\n"
+				<< "      \"height\": " << size.second << ",\n"
+				<< "      \"bytes\": " << fileBytes << ",\n"
+				<< "      \"bitsPerPixel\": " << fileBytes * 8.0 / (megapixels * 1e6) << ",\n"
+				<< "      \"psnr\": ";
+			// Lossless results have no finite PSNR
+			if (peakSNR < 0.0) {
+				out << "null";
+			}
+			else {
+				out << peakSNR;
+			}
+			out << ",\n"
+				<< "      \"compress\": { \"milliseconds\": " << compressSeconds * 1000.0
+				<< ", \"megapixelsPerSecond\": " << megapixels / compressSeconds << " },\n"
+				<< "      \"decompress\": { \"milliseconds\": " << decompressSeconds * 1000.0
+				<< ", \"megapixelsPerSecond\": " << megapixels / decompressSeconds << " },\n"
+				<< "      \"stageMilliseconds\": {";
+			for (UINT8 s = 0; s < NUM_STAGES; s++) {
+				out << (s == 0 ? " " : ", ") << "\"" << STAGE_NAMES[s] << "\": ";
+				// Stages fused into another are timed with it
+				if (best[s] == FUSED_STAGE) {
+					out << "null";
+				}
+				else {
+					out << best[s] * 1000.0;
+				}
+			}
+			out << " }\n"
+				<< "    }";
+			first = false;
+		}
+	}
+	out << "\n  ]\n}" << std::endl;
+}
+
+void Benchmark::entropyCoders(
+	std::ostream& out,
+	Codec& codec,
+	const std::vector<std::pair<INT32, INT32>>& sizes,
+	UINT32 iterations)
+{
+	typedef std::chrono::steady_clock Clock;
+	static const char* const SAMPLING_NAMES[] = { "444", "422", "420" };
+	// Huffman coding with the default and with optimized tables, then
+	// arithmetic coding
+	static const char* const CODER_NAMES[] = { "huffman", "huffmanOptimized", "arithmetic" };
+	static const EntropyCoding CODERS[] = { ENTROPY_HUFFMAN, ENTROPY_HUFFMAN, ENTROPY_ARITHMETIC };
+	static const bool OPTIMIZED[] = { false, true, false };
+	EntropyCoding selected = codec.entropyCoding;
+	bool selectedTables = codec.optimizeTables;
+	iterations = std::max(iterations, 1u);
+	out << "{\n"
+		<< "  \"settings\": {\n"
+		<< "    \"quality\": " << static_cast<UINT32>(codec.quality) << ",\n"
+		<< "    \"sampling\": \"" << SAMPLING_NAMES[codec.sampling] << "\",\n"
+		<< "    \"restartInterval\": " << codec.restartInterval << ",\n"
+		<< "    \"threads\": " << (codec.threadPool ? codec.threadPool->getThreadCount() : 1) << ",\n"
+		<< "    \"iterations\": " << iterations << ",\n"
+		<< "    \"fusedStages\": { \"" << STAGE_NAMES[6] << "\": \"" << STAGE_NAMES[5] << "\" }\n"
+		<< "  },\n"
+		<< "  \"images\": [";
+	bool first = true;
+	for (const std::pair<INT32, INT32>& size : sizes) {
+		for (UINT8 p = 0; p < NUM_PATTERNS; p++) {
+			Pattern pattern = static_cast<Pattern>(p);
+			std::unique_ptr<BitmapFile> original(syntheticImage(pattern, size.first, size.second));
+			// Both coders take the same symbols
+			std::pair<CodedDC, CodedAC> symbols = codec.stripEncoder(original.get());
+			DOUBLE megabytes = 3.0 * size.first * size.second / 1e6;
+			out << (first ? "\n" : ",\n")
+				<< "    {\n"
+				<< "      \"pattern\": \"" << patternName(pattern) << "\",\n"
+				<< "      \"width\": " << size.first << ",\n"
+				<< "      \"height\": " << size.second;
+			for (UINT8 c = 0; c < 3; c++) {
+				codec.entropyCoding = CODERS[c];
+				codec.optimizeTables = OPTIMIZED[c];
+				DOUBLE encodeSeconds = std::numeric_limits<DOUBLE>::max();
+				DOUBLE decodeSeconds = std::numeric_limits<DOUBLE>::max();
+				UINT64 fileBytes = 0;
+				for (UINT32 i = 0; i < iterations; i++) {
+					Clock::time_point start = Clock::now();
+					std::vector<RestartSegment> restartSegments;
+					IM3File encoded(
+						codec.entropyCoder(symbols.first, symbols.second, restartSegments),
+						codec.fileExtensionHeader(size.first, size.second),
+						restartSegments);
+					encodeSeconds = std::min(encodeSeconds, secondsSince(start));
+					MemoryStream* file = new MemoryStream();
+					std::unique_ptr<Stream> stream(file);
+					encoded.Save(*file);
+					fileBytes = file->size();
+					IM3File loaded(std::move(stream));
+					start = Clock::now();
+					Codec::YUVPlanes<INT16> quantized = loaded.getRestartInterval() != 0 ?
+						codec.restartDecoder(&loaded) : codec.entropyDecoder(&loaded);
+					decodeSeconds = std::min(decodeSeconds, secondsSince(start));
+				}
+				out << ",\n"
+					<< "      \"" << CODER_NAMES[c] << "\": { \"bytes\": " << fileBytes
+					<< ", \"encodeMegabytesPerSecond\": " << megabytes / encodeSeconds
+					<< ", \"decodeMegabytesPerSecond\": " << megabytes / decodeSeconds << " }";
+			}
+			out << "\n"
+				<< "    }";
+			first = false;
+		}
+	}
+	out << "\n  ]\n}" << std::endl;
+	codec.entropyCoding = selected;
+	codec.optimizeTables = selectedTables;
+}
+
+void Benchmark::trainTables(
+	std::ostream& out,
+	Codec& codec,
+	const std::vector<std::pair<INT32, INT32>>& sizes)
+{
+	// Qualities each set of tables is trained at, in full and subsampled
+	// chroma, so that no one setting shapes the tables
+	static const std::array<std::array<UINT8, 4>, Codec::NUM_DEFAULT_TABLES> QUALITIES{ {
+		{ 0, 25, 50, 75 },
+		{ Codec::HIGH_QUALITY_TABLES, 90, 95, 100 }
+		} };
+	static const Sampling SAMPLINGS[] = { SAMPLING_444, SAMPLING_420 };
+	// Noise is the worst case rather than a kind of image, so it counts
+	// for less than the others
+	static const DOUBLE NOISE_WEIGHT = 0.5;
+	// Total weight of the symbols of each table
+	static const DOUBLE TABLE_WEIGHT = 1 << 20;
+	UINT8 selectedQuality = codec.quality;
+	Sampling selectedSampling = codec.sampling;
+	// Lengths of the DC and AC symbols of the luma and chroma planes
+	std::array<std::array<std::array<LengthTable<UINT8>, 2>, 2>, Codec::NUM_DEFAULT_TABLES> lengths;
+	for (UINT8 set = 0; set < Codec::NUM_DEFAULT_TABLES; set++) {
+		// Frequencies of the symbols, each image weighing the same whatever
+		// its size
+		std::array<std::array<std::array<DOUBLE, HUFFMAN_SYMBOLS>, 2>, 2> frequencies = {};
+		DOUBLE totalWeight = 0.0;
+		for (UINT8 quality : QUALITIES[set]) {
+			codec.setQuality(quality);
+			for (Sampling sampling : SAMPLINGS) {
+				codec.sampling = sampling;
+				for (const std::pair<INT32, INT32>& size : sizes) {
+					for (UINT8 p = 0; p < NUM_PATTERNS; p++) {
+						DOUBLE weight = p == NOISE ? NOISE_WEIGHT : 1.0;
+						std::unique_ptr<BitmapFile> image(syntheticImage(static_cast<Pattern>(p), size.first, size.second));
+						std::pair<CodedDC, CodedAC> symbols = codec.stripEncoder(image.get());
+						Codec::StreamCounts counts = {};
+						for (UINT8 i = 0; i < 3; i++) {
+							size_t next = 0;
+							for (INT16 dcDifference : symbols.first[i]) {
+								next += Codec::countBlockSymbols(counts[i], dcDifference, symbols.second[i].data() + next);
+							}
+						}
+						for (UINT8 table = 0; table < 2; table++) {
+							for (UINT8 kind = 0; kind < 2; kind++) {
+								std::array<UINT64, HUFFMAN_SYMBOLS> tableCounts = {};
+								UINT64 total = 0;
+								for (UINT8 i = table; i < (table == 0 ? 1 : 3); i++) {
+									for (UINT16 k = 0; k < HUFFMAN_SYMBOLS; k++) {
+										tableCounts[k] += counts[i][kind][k];
+										total += counts[i][kind][k];
+									}
+								}
+								for (UINT16 k = 0; total != 0 && k < HUFFMAN_SYMBOLS; k++) {
+									frequencies[table][kind][k] += weight * tableCounts[k] / total;
+								}
+							}
+						}
+						totalWeight += weight;
+					}
+				}
+			}
+		}
+		// Every symbol the format allows keeps a code: the DC sizes, the AC
+		// end-of-block and run of 16 zeroes, and every run with every size
+		for (UINT8 table = 0; table < 2; table++) {
+			for (UINT8 kind = 0; kind < 2; kind++) {
+				std::array<UINT32, HUFFMAN_SYMBOLS> counts = {};
+				for (UINT16 k = 0; k < HUFFMAN_SYMBOLS; k++) {
+					bool allowed = kind == 0 ? k < 16 :
+						(k & 15) != 0 || k == Codec::END_OF_BLOCK_SYMBOL || k == Codec::ZERO_RUN_SYMBOL;
+					if (allowed) {
+						counts[k] = 1 + static_cast<UINT32>(frequencies[table][kind][k] * TABLE_WEIGHT / std::max(totalWeight, 1.0) + 0.5);
+					}
+				}
+				lengths[set][table][kind] = huffmanCodeLengths(counts);
+			}
+		}
+	}
+	codec.setQuality(selectedQuality);
+	codec.sampling = selectedSampling;
+	out << "const std::array<std::array<std::array<UINT8, 16>, 2>, Codec::NUM_DEFAULT_TABLES> Codec::DEFAULT_DC_LENGTHS{ {\n";
+	for (UINT8 set = 0; set < Codec::NUM_DEFAULT_TABLES; set++) {
+		out << "\t{ {\n";
+		for (UINT8 table = 0; table < 2; table++) {
+			out << "\t\t{";
+			for (UINT16 k = 0; k < 16; k++) {
+				UINT32 length = lengths[set][table][0][k];
+				out << (k == 0 ? " " : ", ") << (length < 10 ? " " : "") << length;
+			}
+			out << " }" << (table == 0 ? "," : "") << "\n";
+		}
+		out << "\t} }" << (set + 1 < Codec::NUM_DEFAULT_TABLES ? "," : "") << "\n";
+	}
+	out << "\t} };\n\n";
+	out << "const std::array<std::array<std::array<std::array<UINT8, 16>, 16>, 2>, Codec::NUM_DEFAULT_TABLES> Codec::DEFAULT_AC_LENGTHS{ {\n";
+	for (UINT8 set = 0; set < Codec::NUM_DEFAULT_TABLES; set++) {
+		out << "\t{ {\n";
+		for (UINT8 table = 0; table < 2; table++) {
+			out << "\t\t{ {\n";
+			for (UINT16 run = 0; run < 16; run++) {
+				out << "\t\t\t{";
+				for (UINT16 size = 0; size < 16; size++) {
+					UINT32 length = lengths[set][table][1][run * 16 + size];
+					out << (size == 0 ? " " : ", ") << (length < 10 ? " " : "") << length;
+				}
+				out << " }" << (run < 15 ? "," : "") << "\n";
+			}
+			out << "\t\t} }" << (table == 0 ? "," : "") << "\n";
+		}
+		out << "\t} }" << (set + 1 < Codec::NUM_DEFAULT_TABLES ? "," : "") << "\n";
+	}
+	out << "\t} };\n";
+}
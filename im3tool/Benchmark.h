@@ -0,0 +1,95 @@
+#pragma once
+#include <array>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include "commontypes.h"
+#include "ColorConvert.h"
+#include "DCT.h"
+
+// Forward declaration of class dependencies
+class BitmapFile;
+class Codec;
+class IM3File;
+
+// Headless micro-benchmarks of the codec building blocks
+class Benchmark
+{
+public:
+	// Forward DCT throughput of every engine in blocks per second
+	static void dctEngines(std::ostream& out, UINT32 numBlocks = 100000);
+
+	// Inverse DCT throughput of every inverse engine in blocks per second
+	static void inverseDCTEngines(std::ostream& out, UINT32 numBlocks = 100000);
+
+	// IEEE 1180 style accuracy of every inverse engine against the reference
+	static void inverseDCTAccuracy(std::ostream& out, UINT32 numBlocks = 10000);
+
+	// RGB <---> YUV throughput of every supported colour conversion kernel
+	// in megapixels per second, and its largest difference from the reference
+	static void colorConversion(std::ostream& out, UINT32 numPixels = 1 << 22);
+
+	// Kinds of synthetic image in the benchmark corpus
+	enum Pattern {
+		GRADIENT, // Smooth ramps
+		NOISE, // Uniform noise in every channel
+		TEXT, // Dark glyphs on a light page, all hard edges
+		FRACTAL, // Fractal value noise with the falloff of a photograph
+		NUM_PATTERNS
+	};
+
+	// Name of a pattern
+	static const char* patternName(Pattern pattern);
+
+	// Deterministic image of a pattern, the same on every run
+	static BitmapFile* syntheticImage(Pattern pattern, INT32 width, INT32 height);
+
+	// Compress and decompress every pattern at every size with the codec's
+	// settings, writing as JSON the time of each stage, the megapixels per
+	// second of the whole encoder and decoder, the bits per pixel and the
+	// PSNR. Times are the best of the iterations.
+	static void codecStages(
+		std::ostream& out,
+		Codec& codec,
+		const std::vector<std::pair<INT32, INT32>>& sizes,
+		UINT32 iterations = 3);
+
+	// Entropy code and decode the symbols of every pattern at every size
+	// with each entropy coder in turn, Huffman with the default tables and
+	// with optimized ones, the codec's other settings as they are, writing
+	// as JSON the bytes of each file and the megabytes of image per second
+	// each coder codes and decodes. Times are the best of the iterations.
+	static void entropyCoders(
+		std::ostream& out,
+		Codec& codec,
+		const std::vector<std::pair<INT32, INT32>>& sizes,
+		UINT32 iterations = 3);
+
+	// Count the Huffman symbols of the corpus at every size, at a spread of
+	// qualities and samplings, and write the code lengths built from them
+	// as the definitions of Codec's default lengths
+	static void trainTables(
+		std::ostream& out,
+		Codec& codec,
+		const std::vector<std::pair<INT32, INT32>>& sizes);
+
+private:
+	// Encoder stages followed by decoder stages
+	static const UINT8 NUM_STAGES = 10;
+	static const char* const STAGE_NAMES[NUM_STAGES];
+	typedef std::array<DOUBLE, NUM_STAGES> StageSeconds;
+
+	// Compress a bitmap one stage at a time over the whole image, timing
+	// each of them, and load the result back as a file of fileBytes
+	static IM3File* encodeStages(Codec& codec, BitmapFile* bitmapFile, StageSeconds& seconds, UINT64& fileBytes);
+
+	// Decompress a file one stage at a time, timing each of them
+	static BitmapFile* decodeStages(Codec& codec, IM3File* im3File, StageSeconds& seconds);
+
+	// Peak signal to noise ratio of a decoded bitmap over all channels,
+	// negative when the two are the same
+	static DOUBLE psnr(BitmapFile* original, BitmapFile* decoded);
+
+	// Deterministic mix of noisy, smooth and flat level-shifted blocks
+	static std::vector<DCT::Block<INT8>> sampleBlocks(UINT32 numBlocks);
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstring>
+#include "commontypes.h"
+
+// Reads a least-significant-bit-first bitstream from raw bytes
+// through a 64-bit bit-buffer
+class BitReader
+{
+private:
+	const BYTE* data; // Next byte to load into the bit-buffer
+	const BYTE* end; // One past the last byte of the stream
+	UINT64 bits; // Bit-buffer, next bit in the least significant position
+	UINT32 available; // Number of valid bits in the bit-buffer
+	bool overrun; // Whether more bits were consumed than the stream holds
+public:
+	// Minimum number of bits available after a refill unless the stream ends
+	static const UINT32 REFILL_BITS = 56;
+
+	// Load whole bytes until at least REFILL_BITS bits are buffered
+	void refill();
+	// Next count (at most REFILL_BITS) bits without consuming them,
+	// zero-padded past the end of the stream
+	UINT64 peek(UINT32 count) const;
+	// Consume count bits that were refilled
+	void consume(UINT32 count);
+	// Skip to the next byte boundary
+	void alignToByte();
+	// Number of whole bytes consumed, valid on a byte boundary
+	size_t bytePosition(const BYTE* start) const;
+	// Mark the stream as unreadable
+	void invalidate();
+	// Whether the stream was over-read or invalid
+	bool failed() const;
+	BitReader(const BYTE* data, size_t size);
+};
+
+inline void BitReader::refill()
+{
+	if (end - data >= 8) {
+		// Fast path: one unaligned little-endian load
+		UINT64 word;
+		std::memcpy(&word, data, sizeof(word));
+		bits |= word << available;
+		data += (63 - available) >> 3;
+		available |= REFILL_BITS;
+		return;
+	}
+	while (available <= REFILL_BITS && data != end) {
+		bits |= static_cast<UINT64>(*data) << available;
+		data += 1;
+		available += 8;
+	}
+}
+
+inline UINT64 BitReader::peek(UINT32 count) const
+{
+	return bits & ((static_cast<UINT64>(1) << count) - 1);
+}
+
+inline void BitReader::consume(UINT32 count)
+{
+	if (count > available) {
+		overrun = true;
+		count = available;
+	}
+	bits >>= count;
+	available -= count;
+}
+
+inline void BitReader::alignToByte()
+{
+	consume(available % 8);
+}
+
+inline size_t BitReader::bytePosition(const BYTE* start) const
+{
+	return (data - start) - available / 8;
+}
+
+inline void BitReader::invalidate()
+{
+	overrun = true;
+	bits = 0;
+	available = 0;
+	data = end;
+}
+
+inline bool BitReader::failed() const
+{
+	return overrun;
+}
+
+inline BitReader::BitReader(const BYTE* data, size_t size)
+	: data(data), end(data + size), bits(0), available(0), overrun(false)
+{
+}
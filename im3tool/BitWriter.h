@@ -0,0 +1,92 @@
+#pragma once
+#include <vector>
+#include "commontypes.h"
+
+// Writes a least-significant-bit-first bitstream into a contiguous byte
+// buffer through a 64-bit register flushed a 32-bit word at a time
+class BitWriter
+{
+private:
+	std::vector<BYTE> bytes; // Flushed bytes
+	UINT64 bits; // Pending bits, first bit in the least significant position
+	UINT32 count; // Number of pending bits, always below 32 between writes
+	// Move the low 32 pending bits into the byte buffer
+	void flushWord();
+public:
+	// Append the low length bits of value, least significant bit first
+	void write(UINT64 value, UINT32 length);
+	// Zero-pad to a byte boundary, after which writing may continue
+	void alignToByte();
+	// Zero-pad to a byte boundary and return the finished buffer
+	std::vector<BYTE>& finish();
+	// Move out the bytes flushed so far, keeping any pending bits, so a long
+	// stream can be written out piece by piece
+	std::vector<BYTE> drain();
+	// Number of bits written since the last drain
+	UINT64 bitCount() const;
+	// Reserve space for an expected number of bytes
+	void reserve(size_t numBytes);
+	BitWriter();
+};
+
+inline void BitWriter::flushWord()
+{
+	size_t size = bytes.size();
+	bytes.resize(size + 4);
+	bytes[size] = static_cast<BYTE>(bits);
+	bytes[size + 1] = static_cast<BYTE>(bits >> 8);
+	bytes[size + 2] = static_cast<BYTE>(bits >> 16);
+	bytes[size + 3] = static_cast<BYTE>(bits >> 24);
+	bits >>= 32;
+	count -= 32;
+}
+
+inline void BitWriter::write(UINT64 value, UINT32 length)
+{
+	if (length > 32) {
+		write(value, 32);
+		write(value >> 32, length - 32);
+		return;
+	}
+	bits |= (value & ((static_cast<UINT64>(1) << length) - 1)) << count;
+	count += length;
+	if (count >= 32) {
+		flushWord();
+	}
+}
+
+inline void BitWriter::alignToByte()
+{
+	while (count > 0) {
+		bytes.push_back(static_cast<BYTE>(bits));
+		bits >>= 8;
+		count = count > 8 ? count - 8 : 0;
+	}
+}
+
+inline std::vector<BYTE>& BitWriter::finish()
+{
+	alignToByte();
+	return bytes;
+}
+
+inline std::vector<BYTE> BitWriter::drain()
+{
+	std::vector<BYTE> drained;
+	drained.swap(bytes);
+	return drained;
+}
+
+inline UINT64 BitWriter::bitCount() const
+{
+	return static_cast<UINT64>(bytes.size()) * 8 + count;
+}
+
+inline void BitWriter::reserve(size_t numBytes)
+{
+	bytes.reserve(numBytes);
+}
+
+inline BitWriter::BitWriter() : bits(0), count(0)
+{
+}
@@ -1,55 +1,57 @@
 #include "stdafx.h"
 #include "BitmapFile.h"
 #include "BitmapPixelOperation.h"
+#include "Stream.h"
 
 BitmapFile::CreateResult BitmapFile::TestFile() {
+  // Test the header read from the file
+  return TestHeader(File.Header);
+}
+
+BitmapFile::CreateResult BitmapFile::TestHeader(const struct File::Header& header) {
   // Record any difference between expected and actual values
   DWORD errorAccumulator = 0;
   // The first two bytes of the file must be "BM"
   errorAccumulator |= strncmp(
-    (CHAR*)&File.Header.Type,
+    (const CHAR*)&header.Type,
     "BM",
     2) != 0;
   // The two reserved fields must be 0
-  errorAccumulator |= File.Header.Reserved1 != 0;
-  errorAccumulator |= File.Header.Reserved2 != 0;
+  errorAccumulator |= header.Reserved1 != 0;
+  errorAccumulator |= header.Reserved2 != 0;
   // If otherwise then the file is not a bitmap
   if (errorAccumulator) {
     return ERROR_NOT_BMP;
   }
   // The bitmap must be uncompressed
-  errorAccumulator |= File.Header.Compression != 0;
+  errorAccumulator |= header.Compression != 0;
   if (errorAccumulator) {
     return ERROR_NOT_UNCOMPRESSED;
   }
   // The bitmap must be 24-bit
-  errorAccumulator |= File.Header.Planes != 1;
-  errorAccumulator |= File.Header.BitCount != 24;
-  errorAccumulator |= File.Header.ColorsUsed != 0;
-  errorAccumulator |= File.Header.ColorsImportant != 0;
+  errorAccumulator |= header.Planes != 1;
+  errorAccumulator |= header.BitCount != 24;
+  errorAccumulator |= header.ColorsUsed != 0;
+  errorAccumulator |= header.ColorsImportant != 0;
   if (errorAccumulator) {
     return ERROR_NOT_24BIT;
   }
   return OK;
 }
 
-BitmapFile::CreateResult BitmapFile::ReadBitmapFile(HANDLE fileHandle) {
+BitmapFile::CreateResult BitmapFile::ReadBitmapFile(Stream& stream) {
   // The basic header information is the first 54 bytes
   static const int HEADERSIZE = 54;
   // Record any differences between expected and actual bytes read
   DWORD errorAccumulator = 0;
-  DWORD bytesRead = 0;
-  DWORD bytesToRead = 0;
+  size_t bytesRead = 0;
+  size_t bytesToRead = 0;
   // Read the basic header information
   bytesToRead = HEADERSIZE;
-  errorAccumulator |= ReadFile(fileHandle, &File.Header, bytesToRead, &bytesRead, NULL) != TRUE;
+  bytesRead = stream.read(&File.Header, bytesToRead);
   errorAccumulator |= bytesRead != bytesToRead;
   // Skip over any other header information
-  SetFilePointer(
-    fileHandle,
-    File.Header.Offset - HEADERSIZE,
-    NULL,
-    FILE_CURRENT);
+  errorAccumulator |= stream.seek(File.Header.Offset) != TRUE;
   // Allocate space to store image pixel data
   File.Pixels = new Pixel[File.Header.Width * absHeight()];
   // Read and store the image pixels one scan line at a time
@@ -66,22 +68,12 @@ BitmapFile::CreateResult BitmapFile::ReadBitmapFile(HANDLE fileHandle) {
       bufPos = File.Pixels + (i * File.Header.Width);
     }
     // Read the pixel line
-    errorAccumulator |= ReadFile(
-      fileHandle,
-      bufPos,
-      bytesToRead,
-      &bytesRead,
-      NULL) != TRUE;
+    bytesRead = stream.read(bufPos, bytesToRead);
     errorAccumulator |= bytesRead != bytesToRead;
     // Skip the zero padding left in the scan line
-    SetFilePointer(
-      fileHandle,
-      scanLineBytes() - bytesToRead,
-      NULL,
-      FILE_CURRENT);
+    errorAccumulator |= stream.seek(
+      File.Header.Offset + static_cast<UINT64>(i + 1) * scanLineBytes()) != TRUE;
   }
-  // Close the file
-  CloseHandle(fileHandle);
   // If any mismatch between expected and actual bytes read
   if (errorAccumulator) // There was a read error
   {
@@ -112,9 +104,9 @@ INT32 BitmapFile::scanLineBytes() {
   return bytes - remainder + 4;
 }
 
-BitmapFile::BitmapFile(HANDLE fileHandle, CreateResult* result) {
+BitmapFile::BitmapFile(Stream& stream, CreateResult* result) {
   // Read a bitmap from the file
-  *result = ReadBitmapFile(fileHandle);
+  *result = ReadBitmapFile(stream);
 }
 
 BitmapFile::BitmapFile(INT32 width, INT32 height)
@@ -140,6 +132,11 @@ BitmapFile::Pixel BitmapFile::getPixel(UINT32 x, UINT32 y) {
   return File.Pixels[y * File.Header.Width + x];
 }
 
+BitmapFile::Pixel* BitmapFile::getPixelRow(UINT32 y) {
+  // Get the pixels of the line, stored one after the other
+  return File.Pixels + y * File.Header.Width;
+}
+
 INT32 BitmapFile::getWidth() {
   // Width in pixels of the bitmap
   return File.Header.Width;
@@ -170,6 +167,33 @@ void BitmapFile::doPixelOperation(BitmapPixelOperation& operation) {
 	}
 }
 
+BOOL BitmapFile::Save(Stream& stream) {
+  // The basic header information is the first 54 bytes
+  static const int HEADERSIZE = 54;
+  // Header of an uncompressed 24-bit bitmap, its scan lines bottom first
+  struct File::Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(&header.Type, "BM", 2);
+  header.SizeImage = scanLineBytes() * absHeight();
+  header.fSize = HEADERSIZE + header.SizeImage;
+  header.Offset = HEADERSIZE;
+  header.iSize = HEADERSIZE - 14;
+  header.Width = File.Header.Width;
+  header.Height = absHeight();
+  header.Planes = 1;
+  header.BitCount = 24;
+  // Record any write that fell short
+  DWORD errorAccumulator = 0;
+  errorAccumulator |= stream.write(&header, HEADERSIZE) != TRUE;
+  // Write each pixel line followed by its zero padding
+  static const BYTE padding[3] = {};
+  for (INT32 i = absHeight() - 1; i >= 0; i--) {
+    errorAccumulator |= stream.write(getPixelRow(i), pixelLineBytes()) != TRUE;
+    errorAccumulator |= stream.write(padding, scanLineBytes() - pixelLineBytes()) != TRUE;
+  }
+  return errorAccumulator == 0;
+}
+
 BitmapFile::File::File() : Pixels(NULL) {
   // Initialize pointer to image data as null before loading the image
 }
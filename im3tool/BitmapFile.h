@@ -1,6 +1,8 @@
 #pragma once
 // Forward declarations for class dependencies
 class BitmapPixelOperation;
+class BitmapReader;
+class Stream;
 // BitmapFile class declaration
 class BitmapFile {
 public:
@@ -53,15 +55,20 @@ private:
   INT32 pixelLineBytes(); // Bytes per pixel line
   INT32 scanLineBytes(); // Bytes per scan line
   CreateResult TestFile(); // Run tests to check file validity
-  CreateResult ReadBitmapFile(HANDLE fileHandle); // Read a file
+  static CreateResult TestHeader(const struct File::Header& header); // Run tests on header fields
+  CreateResult ReadBitmapFile(Stream& stream); // Read a file
+  // The reader shares the header format and its tests
+  friend class BitmapReader;
 public:
   // Public functions used by other classes and window code
-  BitmapFile(HANDLE fileHandle, CreateResult* result); // Constructor from file
+  BitmapFile(Stream& stream, CreateResult* result); // Constructor from file
   BitmapFile(INT32 width, INT32 height);
   BitmapFile(const BitmapFile& bitmapFile); // Deep copy constructor from other instance
   Pixel getPixel(UINT32 x, UINT32 y); // Get a pixel from the location
+  Pixel* getPixelRow(UINT32 y); // Get the contiguous pixels of a line
   INT32 getWidth(); // Get image width in pixels
   INT32 getHeight(); // Get image height in pixels
   void setPixel(UINT32 x, UINT32 y, Pixel pixel); // Set a pixel at location
   void doPixelOperation(BitmapPixelOperation & operation); // Execute a per-pixel operation
+  BOOL Save(Stream& stream); // Write as a bottom-up 24-bit file
 };
\ No newline at end of file
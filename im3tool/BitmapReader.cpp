@@ -0,0 +1,59 @@
+#include "stdafx.h"
+#include "BitmapReader.h"
+
+INT32 BitmapReader::absHeight() {
+  // How many scan lines are present
+  return abs(Header.Height);
+}
+
+INT32 BitmapReader::pixelLineBytes() {
+  // How many bytes per scan line are pixels
+  return Header.Width * 3;
+}
+
+INT32 BitmapReader::scanLineBytes() {
+  // Each scan line is zero-padded to a multiple of 4
+  return (pixelLineBytes() + 3) / 4 * 4;
+}
+
+BitmapReader::BitmapReader(Stream& input, BitmapFile::CreateResult* result)
+  : Input(input) {
+  // The basic header information is the first 54 bytes
+  static const int HEADERSIZE = 54;
+  memset(&Header, 0, sizeof(Header));
+  // Read the basic header information from the start of the stream,
+  // leaving the scan lines for later
+  if (Input.seek(0) != TRUE || Input.read(&Header, HEADERSIZE) != HEADERSIZE) {
+    *result = BitmapFile::ERROR_READ_FAILED;
+    return;
+  }
+  // Test header fields to determine if supported format
+  *result = BitmapFile::TestHeader(Header);
+}
+
+INT32 BitmapReader::getWidth() {
+  // Width in pixels of the bitmap
+  return Header.Width;
+}
+
+INT32 BitmapReader::getHeight() {
+  // Height in pixels (or scan lines) of the bitmap
+  return absHeight();
+}
+
+BOOL BitmapReader::readRows(INT32 y, INT32 count, BitmapFile::Pixel* pixels) {
+  // Record any differences between expected and actual bytes read
+  DWORD errorAccumulator = 0;
+  size_t bytesToRead = pixelLineBytes();
+  for (INT32 i = 0; i < count; i++) {
+    // Pixel lines ordered bottom first unless the height is negative
+    INT64 line = Header.Height >= 0 ? absHeight() - (y + i) - 1 : y + i;
+    // Seek to the start of the pixel line
+    errorAccumulator |= Input.seek(Header.Offset + line * scanLineBytes()) != TRUE;
+    // Read the pixel line
+    errorAccumulator |= Input.read(
+      pixels + static_cast<INT64>(i) * Header.Width,
+      bytesToRead) != bytesToRead;
+  }
+  return errorAccumulator == 0;
+}
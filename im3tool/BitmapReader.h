@@ -0,0 +1,24 @@
+#pragma once
+#include "BitmapFile.h"
+#include "Stream.h"
+// BitmapReader class declaration
+// Reads the scan lines of a 24-bit bitmap file a few at a time, for images
+// too large to hold in memory all at once
+class BitmapReader {
+private:
+  struct BitmapFile::File::Header Header; // Header read from the file
+  Stream& Input; // Stream the scan lines are read from
+  // Utility functions used by other class functions
+  INT32 absHeight(); // Image height
+  INT32 pixelLineBytes(); // Bytes per pixel line
+  INT32 scanLineBytes(); // Bytes per scan line
+public:
+  BitmapReader(Stream& input, BitmapFile::CreateResult* result); // Constructor reading the header
+  BitmapReader(const BitmapReader&) = delete;
+  BitmapReader& operator=(const BitmapReader&) = delete;
+  INT32 getWidth(); // Get image width in pixels
+  INT32 getHeight(); // Get image height in pixels
+  // Read count pixel lines from line y down, counted from the top, into
+  // pixels one line after the other
+  BOOL readRows(INT32 y, INT32 count, BitmapFile::Pixel* pixels);
+};
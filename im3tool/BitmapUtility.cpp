@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include <algorithm>
+#include <cmath>
 #include "BitmapUtility.h"
 
 
@@ -8,7 +9,7 @@
 BOOL BitmapUtility::FloatingPointEquals(DOUBLE x, DOUBLE y) {
 	// Compare floating points using an acceptably small tolerance
 	static const DOUBLE EPSILON = 1e-4;
-	return abs(x - y) <= EPSILON;
+	return std::abs(x - y) <= EPSILON;
 }
 
 BitmapUtility::NormalizedRGB BitmapUtility::PixelToNormalizedRGB(BitmapFile::Pixel pixel) {
@@ -61,7 +62,7 @@ BitmapUtility::NormalizedRGB BitmapUtility::HSVtoNormalizedRGB(HSV hsv) {
 	DOUBLE PrimaryChroma = V * S; // Chroma of the most significant colour
 	H /= 60.0; // Locate correct subface of the RGB cube (60 degrees per subface)
 			   // Chroma of the second most significant colour
-	DOUBLE SecondaryChroma = PrimaryChroma * (1 - abs(fmod(H, 2.0) - 1));
+	DOUBLE SecondaryChroma = PrimaryChroma * (1 - std::abs(fmod(H, 2.0) - 1));
 
 	NormalizedRGB rgb; // RGB output
 	switch ((LONG)H) // Color significance order depends on subface of the RGB cube
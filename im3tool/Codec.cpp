@@ -1,10 +1,64 @@
 #include "stdafx.h"
 #include <cmath>
+#include <cstring>
 #include <limits>
+#include <mutex>
 #include "BitmapUtility.h"
 #include "commontypes.h"
 #include "Codec.h"
 #include "IM3File.h"
+#include "BitmapReader.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	// Mask with bit k set when component k of 64 is nonzero, found 4
+	// components at a time: adding 0x7FFF to the low 15 bits carries into
+	// the top bit of any component but zero, and a multiply gathers the
+	// top bits into four bits
+	inline UINT64 nonzeroMask(const INT16* components) {
+		static const UINT64 LOW_BITS = 0x7FFF7FFF7FFF7FFFull;
+		static const UINT64 TOP_BITS = 0x8000800080008000ull;
+		static const UINT64 GATHER = 0x0001000200040008ull;
+		UINT64 mask = 0;
+		for (INT32 word = 0; word < 16; word++) {
+			UINT64 lanes;
+			memcpy(&lanes, components + word * 4, sizeof(lanes));
+			UINT64 nonzero = (((lanes & LOW_BITS) + LOW_BITS) | lanes) & TOP_BITS;
+			mask |= ((nonzero >> 15) * GATHER >> 48) << (word * 4);
+		}
+		return mask;
+	}
+
+	// Index of the lowest set bit of a nonzero mask
+	inline INT32 countTrailingZeros(UINT64 bits) {
+#ifdef _MSC_VER
+		unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+		_BitScanForward64(&index, bits);
+#else
+		if (!_BitScanForward(&index, static_cast<unsigned long>(bits))) {
+			_BitScanForward(&index, static_cast<unsigned long>(bits >> 32));
+			index += 32;
+		}
+#endif
+		return static_cast<INT32>(index);
+#else
+		return __builtin_ctzll(bits);
+#endif
+	}
+
+	// Class of a DC difference keying the contexts of the next: zero, then
+	// small and large, each positive or negative
+	inline INT32 dcDifferenceClass(INT16 dcDifference) {
+		if (dcDifference == 0) {
+			return 0;
+		}
+		bool large = dcDifference > 2 || dcDifference < -2;
+		return (large ? 3 : 1) + (dcDifference < 0 ? 1 : 0);
+	}
+}
 
 // Quantization matrix
 const std::array<std::array<INT8, 8>, 8> Codec::Q{ {
@@ -18,6 +72,18 @@ const std::array<std::array<INT8, 8>, 8> Codec::Q{ {
 	{ 72, 92, 95, 98, 112, 100, 103, 99 }
 	} };
 
+// Chroma quantization matrix
+const std::array<std::array<INT8, 8>, 8> Codec::QC{ {
+	{ 17, 18, 24, 47, 99, 99, 99, 99 },
+	{ 18, 21, 26, 66, 99, 99, 99, 99 },
+	{ 24, 26, 56, 99, 99, 99, 99, 99 },
+	{ 47, 66, 99, 99, 99, 99, 99, 99 },
+	{ 99, 99, 99, 99, 99, 99, 99, 99 },
+	{ 99, 99, 99, 99, 99, 99, 99, 99 },
+	{ 99, 99, 99, 99, 99, 99, 99, 99 },
+	{ 99, 99, 99, 99, 99, 99, 99, 99 }
+	} };
+
 // Zig-zag scan pattern
 const std::array<std::pair<INT8, INT8>, 63> Codec::Z{ {
 	{ 0,1 },{ 1,0 },
@@ -36,371 +102,1767 @@ const std::array<std::pair<INT8, INT8>, 63> Codec::Z{ {
 	{ 7,7 }
 	} };
 
-DOUBLE Codec::C(const UINT8 x) {
-	static const DOUBLE a = M_SQRT1_2;
-	return x == 0 ? a : 1.0;
+const std::array<UINT8, 64> Codec::ZIG_ZAG_OFFSETS = []() {
+	std::array<UINT8, 64> offsets = {};
+	for (UINT8 k = 0; k < 63; k++) {
+		offsets[k + 1] = static_cast<UINT8>(Z[k].second * 8 + Z[k].first);
+	}
+	return offsets;
+}();
+
+const std::array<UINT8, 64> Codec::ZIG_ZAG_INDICES = []() {
+	std::array<UINT8, 64> indices = {};
+	for (UINT8 k = 0; k < 64; k++) {
+		indices[ZIG_ZAG_OFFSETS[k]] = k;
+	}
+	return indices;
+}();
+
+const std::array<std::pair<UINT8, UINT8>, 64> Codec::ZIG_ZAG_NEIGHBOURS = []() {
+	std::array<std::pair<UINT8, UINT8>, 64> neighbours = {};
+	for (UINT8 k = 0; k < 64; k++) {
+		UINT8 offset = ZIG_ZAG_OFFSETS[k];
+		neighbours[k].first = offset % 8 != 0 ? offset - 1 : 64;
+		neighbours[k].second = offset >= 8 ? offset - 8 : 64;
+	}
+	return neighbours;
+}();
+
+// Default DC size code lengths of each set, luma then chroma, written by
+// im3bench --tables train from the symbols of its synthetic images at the
+// default sizes
+const std::array<std::array<std::array<UINT8, 16>, 2>, Codec::NUM_DEFAULT_TABLES> Codec::DEFAULT_DC_LENGTHS{ {
+	{ {
+		{  2,  2,  3,  3,  3,  4,  5,  6,  7, 10, 10, 10, 10, 10, 10,  9 },
+		{  1,  2,  3,  4,  5,  6,  7,  8, 11, 11, 11, 11, 11, 11, 11, 11 }
+	} },
+	{ {
+		{  4,  5,  3,  3,  3,  2,  3,  4,  4,  6,  7,  8, 10, 10, 10, 10 },
+		{  2,  3,  3,  3,  3,  3,  4,  5,  6,  7,  8, 11, 11, 10, 10, 10 }
+	} }
+	} };
+
+// Default AC code lengths of each set, a row per run of zeroes and a
+// column per size, luma then chroma, trained likewise
+const std::array<std::array<std::array<std::array<UINT8, 16>, 16>, 2>, Codec::NUM_DEFAULT_TABLES> Codec::DEFAULT_AC_LENGTHS{ {
+	{ {
+		{ {
+			{  2,  2,  3,  3,  5,  6,  8, 11, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  4,  5,  7,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  5,  7, 14, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  5,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  7, 11, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 11, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{ 15, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 }
+		} },
+		{ {
+			{  1,  2,  4,  6, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  4,  6,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  5,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  6, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  7, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  7, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 11, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 14, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  7, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 }
+		} }
+	} },
+	{ {
+		{ {
+			{  3,  3,  3,  3,  3,  4,  4,  5,  6,  8, 16, 16, 16, 16, 16, 16 },
+			{  0,  4,  6,  7,  8,  9, 10, 10, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  5,  8, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  6,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  6, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  7, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 11, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  8, 12, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 }
+		} },
+		{ {
+			{  2,  2,  3,  4,  5,  6,  7,  8, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  3,  6,  8, 11, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  5,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  6,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  6, 13, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  7, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  8, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0, 10, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  0,  9, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+			{  7, 14, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 }
+		} }
+	} }
+	} };
+
+const std::array<Codec::StreamCodes, Codec::NUM_DEFAULT_TABLES> Codec::DEFAULT_CODES = []() {
+	std::array<StreamCodes, NUM_DEFAULT_TABLES> codes;
+	for (UINT8 set = 0; set < NUM_DEFAULT_TABLES; set++) {
+		for (UINT8 k = 0; k < 3; k++) {
+			PlaneHeader planeHeader = defaultPlaneHeader(set, k == Y ? 0 : 1);
+			LengthTable<UINT8> dcLengths;
+			LengthTable<UINT8> acLengths;
+			std::copy(std::begin(planeHeader.DCLengths), std::end(planeHeader.DCLengths), dcLengths.begin());
+			std::copy(std::begin(planeHeader.ACZeroesLengths), std::end(planeHeader.ACZeroesLengths), acLengths.begin());
+			codes[set][k][0] = reversedCanonicalCodes(dcLengths);
+			codes[set][k][1] = reversedCanonicalCodes(acLengths);
+		}
+	}
+	return codes;
+}();
+
+const std::array<std::array<Codec::PlaneDecoders, 3>, Codec::NUM_DEFAULT_TABLES> Codec::DEFAULT_DECODERS = []() {
+	std::array<std::array<PlaneDecoders, 3>, NUM_DEFAULT_TABLES> decoders;
+	for (UINT8 set = 0; set < NUM_DEFAULT_TABLES; set++) {
+		decoders[set][0] = std::make_shared<const std::vector<HuffmanDecoder>>(planeDecoders(defaultPlaneHeader(set, 0)));
+		decoders[set][1] = std::make_shared<const std::vector<HuffmanDecoder>>(planeDecoders(defaultPlaneHeader(set, 1)));
+		decoders[set][2] = decoders[set][1];
+	}
+	return decoders;
+}();
+
+void Codec::bitmapToYUV(const PixelRows& image, INT32 stripIndex, Strip<INT8>& strip)
+{
+	INT32 width = image.Width;
+	INT32 height = image.Height;
+	INT32 blocksWide = blocksCovering(width);
+	INT32 blocksHigh = blocksCovering(height);
+	INT32 horizontal = horizontalFactor(sampling);
+	INT32 vertical = verticalFactor(sampling);
+	// Whole chroma blocks cover the full resolution rows
+	INT32 paddedBlocksWide = planeBlocks(sampling, U, blocksWide, blocksHigh).first * horizontal;
+	for (UINT8 i = 0; i < 3; i++) {
+		strip[i].resize(vertical * paddedBlocksWide);
+	}
+	if (width == 0 || height == 0) {
+		return;
+	}
+	// Each pixel row converts straight into the same row of every block
+	for (INT32 row = 0; row < 8 * vertical; row++) {
+		// Rows below the image repeat the last one
+		INT32 pixelY = std::min(stripIndex * 8 * vertical + row, height - 1);
+		INT32 firstBlock = (row / 8) * paddedBlocksWide;
+		INT32 offsetY = row % 8;
+		ColorConvert::rgbToYUV(
+			colorKernel,
+			image.Row(pixelY),
+			width,
+			&strip[Y][firstBlock][offsetY][0],
+			&strip[U][firstBlock][offsetY][0],
+			&strip[V][firstBlock][offsetY][0]);
+		// Columns right of the image repeat the last one
+		for (UINT8 i = 0; i < 3; i++) {
+			INT32 paddedWidth = (i == Y ? blocksWide : paddedBlocksWide) * 8;
+			INT8 last = strip[i][firstBlock + (width - 1) / 8][offsetY][(width - 1) % 8];
+			for (INT32 x = width; x < paddedWidth; x++) {
+				strip[i][firstBlock + x / 8][offsetY][x % 8] = last;
+			}
+		}
+	}
 }
 
-Codec::YUVPlanes<INT8> Codec::bitmapToYUV(BitmapFile * bitmapFile)
+void Codec::downsample(const Strip<INT8>& strip, Strip<INT8>& chroma)
 {
-	INT32 width = bitmapFile->getWidth();
-	INT32 height = bitmapFile->getHeight();
-	YUVPlanes<INT8> yuvPlanes(width, height);
-	for (INT32 i = 0; i < height; i++) {
-		for (INT32 j = 0; j < width; j++) {
-			BitmapFile::Pixel pixel = bitmapFile->getPixel(j, i);
-			YUV yuv = NormalizedRGBtoYUV(PixelToNormalizedRGB(pixel));
-			INT8 scaledY = static_cast<INT8>((yuv.Y * 255) - 128);
-			INT8 scaledU = static_cast<INT8>((yuv.U * 255) - 128);
-			INT8 scaledV = static_cast<INT8>((yuv.V * 255) - 128);
-			INT32 blockY = i / 8;
-			INT32 blockX = j / 8;
-			INT32 offsetY = i % 8;
-			INT32 offsetX = j % 8;
-			yuvPlanes.planes[Y][blockY][blockX][offsetY][offsetX] = scaledY;
-			yuvPlanes.planes[U][blockY][blockX][offsetY][offsetX] = scaledU;
-			yuvPlanes.planes[V][blockY][blockX][offsetY][offsetX] = scaledV;
+	INT32 horizontal = horizontalFactor(sampling);
+	INT32 vertical = verticalFactor(sampling);
+	INT32 paddedBlocksWide = static_cast<INT32>(strip[U].size()) / vertical;
+	INT32 chromaBlocksWide = paddedBlocksWide / horizontal;
+	// Average each 2-by-1 or 2-by-2 box, rounding to nearest
+	INT32 shift = horizontal * vertical == 4 ? 2 : 1;
+	INT32 rounding = 1 << (shift - 1);
+	for (UINT8 i = U; i <= V; i++) {
+		chroma[i].resize(chromaBlocksWide);
+		for (INT32 blockX = 0; blockX < chromaBlocksWide; blockX++) {
+			for (INT32 offsetY = 0; offsetY < 8; offsetY++) {
+				for (INT32 offsetX = 0; offsetX < 8; offsetX++) {
+					INT32 sum = 0;
+					for (INT32 dy = 0; dy < vertical; dy++) {
+						INT32 y = offsetY * vertical + dy;
+						for (INT32 dx = 0; dx < horizontal; dx++) {
+							INT32 x = (blockX * 8 + offsetX) * horizontal + dx;
+							sum += strip[i][(y / 8) * paddedBlocksWide + x / 8][y % 8][x % 8];
+						}
+					}
+					chroma[i][blockX][offsetY][offsetX] = static_cast<INT8>((sum + rounding) >> shift);
+				}
+			}
 		}
 	}
-	return yuvPlanes;
 }
 
-Codec::YUVPlanes<INT16> Codec::dct(const YUVPlanes<INT8>& yuv)
+void Codec::upsampleRow(
+	const Plane<INT8>& plane,
+	UINT8 sampling,
+	INT32 y,
+	INT32 width,
+	INT32 height,
+	INT8* output)
 {
-	INT32 width = yuv.getWidth();
-	INT32 height = yuv.getHeight();
-	YUVPlanes<INT16> output(width, height);
-	for (INT32 i = 0; i < height; i += 8) {
-		for (INT32 j = 0; j < width; j += 8) {
-			INT32 blockY = i / 8;
-			INT32 blockX = j / 8;
-			output.planes[Y][blockY][blockX] = dctOnBlock<INT8, INT16>(yuv.planes[Y][blockY][blockX]);
-			output.planes[U][blockY][blockX] = dctOnBlock<INT8, INT16>(yuv.planes[U][blockY][blockX]);
-			output.planes[V][blockY][blockX] = dctOnBlock<INT8, INT16>(yuv.planes[V][blockY][blockX]);
+	INT32 vertical = verticalFactor(sampling);
+	// Samples of the plane that are not padding
+	INT32 chromaWidth = (width + 1) / 2;
+	INT32 chromaHeight = (height + vertical - 1) / vertical;
+	auto sample = [&plane](INT32 x, INT32 row) -> INT32 {
+		return plane[row / 8][x / 8][row % 8][x % 8] + 128;
+	};
+	// Vertically weigh the own row 3 and the nearer neighbour row 1
+	INT32 chromaY = y / vertical;
+	INT32 neighbourY = chromaY;
+	if (vertical == 2) {
+		neighbourY = y % 2 == 0 ? std::max(chromaY - 1, 0) : std::min(chromaY + 1, chromaHeight - 1);
+	}
+	std::vector<INT32> columnSums(chromaWidth);
+	for (INT32 x = 0; x < chromaWidth; x++) {
+		columnSums[x] = 3 * sample(x, chromaY) + sample(x, neighbourY);
+	}
+	// Horizontally likewise, every sample becoming two pixels
+	for (INT32 x = 0; x < chromaWidth; x++) {
+		INT32 left = columnSums[std::max(x - 1, 0)];
+		INT32 right = columnSums[std::min(x + 1, chromaWidth - 1)];
+		INT32 pixelX = 2 * x;
+		output[(pixelX / 8) * ColorConvert::BLOCK_STRIDE + pixelX % 8] =
+			static_cast<INT8>(((3 * columnSums[x] + left + 8) >> 4) - 128);
+		pixelX += 1;
+		if (pixelX < width) {
+			output[(pixelX / 8) * ColorConvert::BLOCK_STRIDE + pixelX % 8] =
+				static_cast<INT8>(((3 * columnSums[x] + right + 7) >> 4) - 128);
 		}
 	}
-	return output;
 }
 
-Codec::YUVPlanes<INT8> Codec::quantize(const YUVPlanes<INT16>& dct)
+Codec::Block<UINT8> Codec::scaleTable(const std::array<std::array<INT8, 8>, 8>& matrix, UINT8 quality)
+{
+	// Percentage to scale by as libjpeg does it
+	INT32 clamped = std::min(std::max(static_cast<INT32>(quality), 1), 100);
+	INT32 scale = clamped < 50 ? 5000 / clamped : 200 - 2 * clamped;
+	Block<UINT8> table;
+	for (UINT8 i = 0; i < 8; i++) {
+		for (UINT8 j = 0; j < 8; j++) {
+			INT32 entry = (matrix[i][j] * scale + 50) / 100;
+			table[i][j] = static_cast<UINT8>(std::min(std::max(entry, static_cast<INT32>(MIN_QUANTIZATION)), 255));
+		}
+	}
+	return table;
+}
+
+Codec::Quantizer Codec::makeQuantizer(const Block<UINT8>& table)
+{
+	Quantizer quantizer;
+	for (UINT8 i = 0; i < 8; i++) {
+		for (UINT8 j = 0; j < 8; j++) {
+			// A zero entry of a damaged file divides by one instead
+			UINT8 entry = std::max(table[i][j], static_cast<UINT8>(1));
+			UINT64 divisor = 2 * static_cast<UINT64>(entry);
+			quantizer.Table[i][j] = entry;
+			quantizer.Reciprocals[i][j] = ((1ULL << RECIPROCAL_SHIFT) + divisor - 1) / divisor;
+		}
+	}
+	return quantizer;
+}
+
+std::array<Codec::Quantizer, 2> Codec::fileQuantizers(const IM3File* im3File)
+{
+	std::array<Quantizer, 2> planeQuantizers;
+	for (UINT8 k = 0; k < 2; k++) {
+		// Files without tables use the fixed matrix on every plane
+		Block<UINT8> table = scaleTable(Q, 50);
+		const UINT8* stored = im3File->getQuantizationTable(k);
+		for (UINT8 i = 0; i < 8 && stored; i++) {
+			for (UINT8 j = 0; j < 8; j++) {
+				table[i][j] = stored[i * 8 + j];
+			}
+		}
+		planeQuantizers[k] = makeQuantizer(table);
+	}
+	return planeQuantizers;
+}
+
+INT32 Codec::runLengthDifferenceCodeBlock(
+	const Block<INT16>& block,
+	INT16& lastDCValue,
+	INT16* dcDifference,
+	std::pair<UINT8, INT16>* runLengthCodes)
+{
+	// Encode the DC difference from last block
+	*dcDifference = static_cast<INT16>(block[0][0] - lastDCValue);
+	lastDCValue = block[0][0];
+	// Blocks with no AC components left after quantization, most of them,
+	// only take the end-of-block code. The others have their nonzero AC
+	// components moved to zig-zag order in a mask, a bit at a time, and
+	// each coded with the zeroes since the last.
+	const INT16* components = &block[0][0];
+	UINT64 nonzero = nonzeroMask(components) & ~static_cast<UINT64>(1);
+	INT32 numCodes = 0;
+	if (nonzero != 0) {
+		UINT64 zigZagNonzero = 0;
+		do {
+			zigZagNonzero |= static_cast<UINT64>(1) << ZIG_ZAG_INDICES[countTrailingZeros(nonzero)];
+			nonzero &= nonzero - 1;
+		} while (nonzero != 0);
+		INT32 last = 0;
+		do {
+			INT32 k = countTrailingZeros(zigZagNonzero);
+			runLengthCodes[numCodes++] = std::pair<UINT8, INT16>(
+				static_cast<UINT8>(k - last - 1), components[ZIG_ZAG_OFFSETS[k]]);
+			last = k;
+			zigZagNonzero &= zigZagNonzero - 1;
+		} while (zigZagNonzero != 0);
+	}
+	// Encode the end-of-block code
+	runLengthCodes[numCodes++] = std::pair<UINT8, INT16>(0, 0);
+	return numCodes;
+}
+
+INT32 Codec::neighbourClass(const NeighbourMagnitudes& magnitudes, INT32 zigZag)
+{
+	const std::pair<UINT8, UINT8>& neighbours = ZIG_ZAG_NEIGHBOURS[zigZag];
+	return std::min(magnitudes[neighbours.first] + magnitudes[neighbours.second], NEIGHBOUR_CLASSES - 1);
+}
+
+size_t Codec::arithmeticCodeBlock(
+	ArithmeticEncoder& encoder,
+	ArithmeticContexts& contexts,
+	INT16 dcDifference,
+	const std::pair<UINT8, INT16>* runLengthCodes)
+{
+	// The DC difference: whether it is zero, its sign and its magnitude
+	INT32 dcClass = contexts.DCClass;
+	encoder.encode(contexts.DCNonzero[dcClass], dcDifference != 0);
+	if (dcDifference != 0) {
+		encoder.encode(contexts.DCSign[dcClass], dcDifference < 0);
+		encodeMagnitude(
+			encoder,
+			contexts.DCCategories[dcClass].data(),
+			contexts.DCBits.data(),
+			static_cast<UINT32>(std::abs(static_cast<INT32>(dcDifference))));
+	}
+	contexts.DCClass = dcDifferenceClass(dcDifference);
+	// Along the zig-zag, whether the block ends, then whether each
+	// component is zero up to the next nonzero one, its sign and magnitude
+	NeighbourMagnitudes magnitudes = {};
+	INT32 zigZag = 1;
+	size_t next = 0;
+	// The end-of-block after the last component goes without saying
+	for (; zigZag < 64; next++) {
+		const std::pair<UINT8, INT16>& code = runLengthCodes[next];
+		encoder.encode(contexts.EndOfBlock[zigZag], code.second == 0);
+		if (code.second == 0) {
+			break;
+		}
+		for (UINT8 zero = 0; zero < code.first; zero++, zigZag++) {
+			encoder.encode(contexts.ACNonzero[zigZag][neighbourClass(magnitudes, zigZag)], 0);
+		}
+		INT32 neighbourhood = neighbourClass(magnitudes, zigZag);
+		encoder.encode(contexts.ACNonzero[zigZag][neighbourhood], 1);
+		encoder.encode(contexts.ACSign, code.second < 0);
+		UINT32 magnitude = static_cast<UINT32>(std::abs(static_cast<INT32>(code.second)));
+		INT32 band = zigZag <= LOW_BAND ? 0 : 1;
+		encodeMagnitude(
+			encoder,
+			contexts.ACCategories[band][neighbourhood].data(),
+			contexts.ACBits[band].data(),
+			magnitude);
+		magnitudes[ZIG_ZAG_OFFSETS[zigZag]] = static_cast<UINT8>(std::min(magnitude, 2u));
+		zigZag += 1;
+	}
+	return next + 1;
+}
+
+std::array<std::pair<EntropiedDC, EntropiedAC>, 3>
+Codec::arithmeticCoder(
+	const CodedDC& codedDC,
+	const CodedAC& codedAC,
+	std::vector<RestartSegment>& restartSegments)
 {
-	INT32 width = dct.getWidth();
-	INT32 height = dct.getHeight();
-	YUVPlanes<INT8> output(width, height);
-	for (INT32 i = 0; i < height; i += 8) {
-		for (INT32 j = 0; j < width; j += 8) {
-			INT32 blockY = i / 8;
-			INT32 blockX = j / 8;
-			output.planes[Y][blockY][blockX] = quantizeOnBlock<INT16, INT8>(dct.planes[Y][blockY][blockX]);
-			output.planes[U][blockY][blockX] = quantizeOnBlock<INT16, INT8>(dct.planes[U][blockY][blockX]);
-			output.planes[V][blockY][blockX] = quantizeOnBlock<INT16, INT8>(dct.planes[V][blockY][blockX]);
+	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> output;
+	std::array<std::vector<UINT32>, 3> segmentBytes;
+	parallelFor(3, [&](size_t i) {
+		ArithmeticEncoder encoder;
+		ArithmeticContexts contexts;
+		encoder.reserve(codedAC[i].size());
+		size_t next = 0;
+		UINT64 segmentStart = 0;
+		for (size_t blockIndex = 0; blockIndex < codedDC[i].size(); blockIndex++) {
+			next += arithmeticCodeBlock(encoder, contexts, codedDC[i][blockIndex], codedAC[i].data() + next);
+			bool segmentEnd = blockIndex + 1 == codedDC[i].size() ||
+				(restartInterval != 0 && (blockIndex + 1) % restartInterval == 0);
+			if (segmentEnd) {
+				encoder.flush();
+				contexts = ArithmeticContexts();
+				segmentBytes[i].push_back(static_cast<UINT32>(encoder.byteCount() - segmentStart));
+				segmentStart = encoder.byteCount();
+			}
+		}
+		output[i].first.second = encoder.drain();
+	});
+	// Index the segments plane by plane
+	restartSegments.clear();
+	if (restartInterval != 0) {
+		for (UINT8 i = 0; i < 3; i++) {
+			for (UINT32 bytes : segmentBytes[i]) {
+				RestartSegment segment = { bytes, 0, 0 };
+				restartSegments.push_back(segment);
+			}
 		}
 	}
 	return output;
 }
 
-std::pair<CodedDC, CodedAC> Codec::runLengthDifferenceCoder(const Codec::YUVPlanes<INT8>& quantized)
+void Codec::encodeStrip(
+	const PixelRows& image,
+	INT32 stripIndex,
+	Strip<INT8>& strip,
+	Strip<INT8>& chroma,
+	StripSymbols& symbols)
 {
-	// Difference coding DC components
-	std::array<std::vector<INT8>, 3> dcDifferences;
-	// Run-length coding AC components
-	std::array<std::vector<std::pair<UINT8, INT8>>, 3> runLengthCodes;
-	// Get plane dimensions
-	INT32 width = quantized.getWidth();
-	INT32 height = quantized.getHeight();
-	// For each channel
+	bitmapToYUV(image, stripIndex, strip);
+	if (sampling != SAMPLING_444) {
+		downsample(strip, chroma);
+	}
+	INT32 blocksWide = blocksCovering(image.Width);
+	INT32 blocksHigh = blocksCovering(image.Height);
+	INT32 vertical = verticalFactor(sampling);
 	for (UINT8 channel = 0; channel < 3; channel++) {
-		// For each block
-		INT8 lastDCValue = 0;
-		for (INT32 i = 0; i < height; i += 8) {
-			for (INT32 j = 0; j < width; j += 8) {
-				INT32 blockY = i / 8;
-				INT32 blockX = j / 8;
-				Block<INT8> block = quantized.planes[channel][blockY][blockX];
-				// Encode the DC difference from last block
-				dcDifferences[channel].push_back(block[0][0] - lastDCValue);
-				lastDCValue = block[0][0];
-				// Encode the run-length codes from zig-zag traversal
-				UINT8 numZeroes = 0;
-				for (auto it = Z.begin(); it != Z.end(); it++) {
-					INT8 offsetY = it->second;
-					INT8 offsetX = it->first;
-					INT8 value = block[offsetY][offsetX];
-					if (value == 0) {
-						numZeroes += 1;
-					}
-					else {
-						std::pair<UINT8, INT8> code(numZeroes, value);
-						runLengthCodes[channel].push_back(code);
-						numZeroes = 0;
-					}
+		std::pair<INT32, INT32> blocks = planeBlocks(sampling, channel, blocksWide, blocksHigh);
+		bool fullResolution = channel == Y || sampling == SAMPLING_444;
+		const std::vector<Block<INT8>>& source = fullResolution ? strip[channel] : chroma[channel];
+		INT32 rowsPerStrip = fullResolution ? vertical : 1;
+		INT32 stride = static_cast<INT32>(source.size()) / rowsPerStrip;
+		const Quantizer& quantizer = quantizers[channel == Y ? 0 : 1];
+		// The last strip may reach past the bottom of the plane
+		INT32 firstRow = stripIndex * rowsPerStrip;
+		INT32 numRows = std::min(rowsPerStrip, blocks.second - firstRow);
+		std::vector<INT16>& dcDifferences = symbols.DCDifferences[channel];
+		std::vector<std::pair<UINT8, INT16>>& runLengthCodes = symbols.RunLengthCodes[channel];
+		// Codes are written in place, room for a whole block kept ahead of
+		// them and the rest cut off at the end
+		dcDifferences.resize(numRows * blocks.first);
+		runLengthCodes.resize(numRows * blocks.first * 8 + MAX_BLOCK_CODES);
+		size_t numCodes = 0;
+		// Differences start from zero, the caller corrects the first one
+		INT16 lastDCValue = 0;
+		for (INT32 row = 0; row < numRows; row++) {
+			for (INT32 blockX = 0; blockX < blocks.first; blockX++) {
+				// Every restart segment starts over from a DC of zero
+				INT32 blockIndex = (firstRow + row) * blocks.first + blockX;
+				if (restartInterval != 0 && blockIndex % restartInterval == 0) {
+					lastDCValue = 0;
+				}
+				if (runLengthCodes.size() < numCodes + MAX_BLOCK_CODES) {
+					runLengthCodes.resize(std::max(2 * runLengthCodes.size(), numCodes + MAX_BLOCK_CODES));
 				}
-				// Encode the end-of-block code
-				runLengthCodes[channel].push_back(std::pair<UINT8, INT8>{ 0, 0 });
+				Block<INT16> quantized = quantizeOnBlock<INT16, INT16>(
+					dctOnBlock<INT8, INT16>(source[row * stride + blockX]), quantizer);
+				numCodes += runLengthDifferenceCodeBlock(
+					quantized,
+					lastDCValue,
+					dcDifferences.data() + row * blocks.first + blockX,
+					runLengthCodes.data() + numCodes);
 			}
 		}
+		runLengthCodes.resize(numCodes);
+		symbols.LastDC[channel] = lastDCValue;
+	}
+}
+
+void Codec::chainStrip(
+	INT32 blocksWide,
+	INT32 blocksHigh,
+	INT32 stripIndex,
+	const std::array<INT16, 3>& lastDCAbove,
+	StripSymbols& symbols)
+{
+	INT32 vertical = verticalFactor(sampling);
+	for (UINT8 channel = 0; channel < 3 && stripIndex > 0; channel++) {
+		std::pair<INT32, INT32> blocks = planeBlocks(sampling, channel, blocksWide, blocksHigh);
+		INT32 rowsPerStrip = channel == Y ? vertical : 1;
+		INT32 blockIndex = stripIndex * rowsPerStrip * blocks.first;
+		bool restart = restartInterval != 0 && blockIndex % restartInterval == 0;
+		if (blocks.first > 0 && !restart) {
+			symbols.DCDifferences[channel][0] -= lastDCAbove[channel];
+		}
+	}
+}
+
+std::pair<CodedDC, CodedAC> Codec::stripEncoder(BitmapFile * bitmapFile)
+{
+	PixelRows image = { bitmapFile->getWidth(), bitmapFile->getHeight(),
+		[bitmapFile](INT32 y) { return bitmapFile->getPixelRow(y); } };
+	INT32 blocksWide = blocksCovering(image.Width);
+	INT32 blocksHigh = blocksCovering(image.Height);
+	INT32 vertical = verticalFactor(sampling);
+	INT32 numStrips = (blocksHigh + vertical - 1) / vertical;
+	// Each task encodes one strip, joined in order afterwards
+	std::vector<StripSymbols> strips(numStrips);
+	parallelFor(numStrips, [&](size_t task) {
+		Strip<INT8> strip;
+		Strip<INT8> chroma;
+		encodeStrip(image, static_cast<INT32>(task), strip, chroma, strips[task]);
+	});
+	for (INT32 stripIndex = numStrips - 1; stripIndex > 0; stripIndex--) {
+		chainStrip(blocksWide, blocksHigh, stripIndex, strips[stripIndex - 1].LastDC, strips[stripIndex]);
+	}
+	// Difference coding DC components
+	std::array<std::vector<INT16>, 3> dcDifferences;
+	// Run-length coding AC components
+	std::array<std::vector<std::pair<UINT8, INT16>>, 3> runLengthCodes;
+	for (UINT8 channel = 0; channel < 3; channel++) {
+		std::pair<INT32, INT32> blocks = planeBlocks(sampling, channel, blocksWide, blocksHigh);
+		size_t numCodes = 0;
+		for (const StripSymbols& symbols : strips) {
+			numCodes += symbols.RunLengthCodes[channel].size();
+		}
+		dcDifferences[channel].reserve(static_cast<size_t>(blocks.first) * blocks.second);
+		runLengthCodes[channel].reserve(numCodes);
+		for (const StripSymbols& symbols : strips) {
+			dcDifferences[channel].insert(dcDifferences[channel].end(),
+				symbols.DCDifferences[channel].begin(), symbols.DCDifferences[channel].end());
+			runLengthCodes[channel].insert(runLengthCodes[channel].end(),
+				symbols.RunLengthCodes[channel].begin(), symbols.RunLengthCodes[channel].end());
+		}
 	}
 	std::pair<CodedDC, CodedAC> result(dcDifferences, runLengthCodes);
 	return result;
 }
 
+size_t Codec::countBlockSymbols(
+	PlaneCounts& counts,
+	INT16 dcDifference,
+	const std::pair<UINT8, INT16>* runLengthCodes)
+{
+	return blockSymbols(dcDifference, runLengthCodes, [&counts](UINT32 table, UINT32 symbol, UINT32, UINT32) {
+		counts[table][symbol] += 1;
+	});
+}
+
+size_t Codec::huffmanCodeBlock(
+	std::array<BitWriter, 3>& writers,
+	const PlaneCodes& codes,
+	INT16 dcDifference,
+	const std::pair<UINT8, INT16>* runLengthCodes)
+{
+	// The magnitude bits of the DC difference follow its code, those of
+	// the AC components have a stream of their own
+	return blockSymbols(dcDifference, runLengthCodes, [&](UINT32 table, UINT32 symbol, UINT32 bits, UINT32 size) {
+		const HuffmanCode& code = codes[table][symbol];
+		writers[table].write(code.Bits, code.Length);
+		writers[table == 0 ? 0 : 2].write(bits, size);
+	});
+}
+
+PlaneHeader Codec::defaultPlaneHeader(UINT8 set, UINT8 table)
+{
+	PlaneHeader planeHeader = {};
+	for (UINT16 k = 0; k < 16; k++) {
+		planeHeader.DCLengths[k] = DEFAULT_DC_LENGTHS[set][table][k];
+	}
+	for (UINT16 k = 0; k < HUFFMAN_SYMBOLS; k++) {
+		planeHeader.ACZeroesLengths[k] = DEFAULT_AC_LENGTHS[set][table][k >> 4][k & 15];
+	}
+	return planeHeader;
+}
+
+UINT8 Codec::defaultTables() const
+{
+	return quality >= HIGH_QUALITY_TABLES ? 1 : 0;
+}
+
+void Codec::planeTables(
+	const PlaneCounts& counts,
+	PlaneCodes& codes,
+	std::pair<EntropiedDC, EntropiedAC>& entropied,
+	std::array<UINT64, 3>& streamBytes)
+{
+	// Length-limited code lengths, 0 for symbols that do not occur
+	entropied.first.first = huffmanCodeLengths(counts[0]);
+	entropied.second.first.first = huffmanCodeLengths(counts[1]);
+	entropied.second.second.first.fill(0);
+	// Canonical codes as (bits, length) pairs ready for the bit writer
+	codes[0] = reversedCanonicalCodes(entropied.first.first);
+	codes[1] = reversedCanonicalCodes(entropied.second.first.first);
+	// The low four bits of every symbol are the size of its magnitude bits
+	std::array<UINT64, 3> numBits = {};
+	for (UINT16 k = 0; k < HUFFMAN_SYMBOLS; k++) {
+		numBits[0] += static_cast<UINT64>(counts[0][k]) * (codes[0][k].Length + k);
+		numBits[1] += static_cast<UINT64>(counts[1][k]) * codes[1][k].Length;
+		numBits[2] += static_cast<UINT64>(counts[1][k]) * (k & 15);
+	}
+	for (UINT8 j = 0; j < 3; j++) {
+		streamBytes[j] = (numBits[j] + 7) / 8;
+	}
+}
+
 std::array<std::pair<EntropiedDC, EntropiedAC>, 3>
-Codec::entropyCoder(const CodedDC& codedDC, const CodedAC& codedAC)
+Codec::entropyCoder(
+	const CodedDC& codedDC,
+	const CodedAC& codedAC,
+	std::vector<RestartSegment>& restartSegments)
 {
+	if (entropyCoding == ENTROPY_ARITHMETIC) {
+		return arithmeticCoder(codedDC, codedAC, restartSegments);
+	}
 	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> output;
-	for (UINT8 i = 0; i < 3; i++) {
-		std::vector<INT8> dcComponents = codedDC[i];
-		std::vector<std::pair<UINT8, INT8>> runLengthACComponents = codedAC[i];
-		std::vector<UINT8> zeroesACComponents;
-		std::vector<INT8> valuesACComponents;
-		for (auto it = runLengthACComponents.begin();
-			it != runLengthACComponents.end();
-			it++) {
-			zeroesACComponents.push_back(it->first);
-			valuesACComponents.push_back(it->second);
-		}
-		EntropiedDC entropiedDC = huffmanEncode<INT8>(dcComponents);
-		EntropiedACFirst entropiedACFirst = huffmanEncode<UINT8>(zeroesACComponents);
-		EntropiedACSecond entropiedACSecond = huffmanEncode<INT8>(valuesACComponents);
-		EntropiedAC entropiedAC = EntropiedAC(entropiedACFirst, entropiedACSecond);
-		std::pair<EntropiedDC, EntropiedAC> entropiedPlane(entropiedDC, entropiedAC);
-		output[i] = entropiedPlane;
+	std::array<std::vector<RestartSegment>, 3> planeSegments;
+	// Each plane is counted, then coded with tables from its counts, or
+	// coded straight away with the default tables
+	parallelFor(3, [&](size_t i) {
+		const PlaneCodes* codes = &DEFAULT_CODES[defaultTables()][i];
+		PlaneCodes optimizedCodes;
+		std::array<UINT64, 3> streamBytes = {};
+		size_t next = 0;
+		if (optimizeTables) {
+			PlaneCounts counts = {};
+			for (INT16 dcDifference : codedDC[i]) {
+				next += countBlockSymbols(counts, dcDifference, codedAC[i].data() + next);
+			}
+			planeTables(counts, optimizedCodes, output[i], streamBytes);
+			codes = &optimizedCodes;
+		}
+		std::array<BitWriter, 3> writers;
+		size_t numSegments = restartInterval != 0 ? codedDC[i].size() / restartInterval + 1 : 1;
+		for (UINT8 j = 0; j < 3; j++) {
+			writers[j].reserve(static_cast<size_t>(streamBytes[j]) + numSegments);
+		}
+		// Each segment ends padded to a whole byte
+		std::array<UINT64, 3> segmentStart = {};
+		next = 0;
+		for (size_t blockIndex = 0; blockIndex < codedDC[i].size(); blockIndex++) {
+			next += huffmanCodeBlock(writers, *codes, codedDC[i][blockIndex], codedAC[i].data() + next);
+			bool segmentEnd = blockIndex + 1 == codedDC[i].size() ||
+				(restartInterval != 0 && (blockIndex + 1) % restartInterval == 0);
+			if (segmentEnd) {
+				std::array<UINT32, 3> bytes;
+				for (UINT8 j = 0; j < 3; j++) {
+					writers[j].alignToByte();
+					bytes[j] = static_cast<UINT32>((writers[j].bitCount() - segmentStart[j]) / 8);
+					segmentStart[j] = writers[j].bitCount();
+				}
+				RestartSegment segment = { bytes[0], bytes[1], bytes[2] };
+				planeSegments[i].push_back(segment);
+			}
+		}
+		output[i].first.second = writers[0].drain();
+		output[i].second.first.second = writers[1].drain();
+		output[i].second.second.second = writers[2].drain();
+	});
+	// Index the segments plane by plane
+	restartSegments.clear();
+	if (restartInterval != 0) {
+		for (UINT8 i = 0; i < 3; i++) {
+			restartSegments.insert(restartSegments.end(), planeSegments[i].begin(), planeSegments[i].end());
+		}
 	}
 	return output;
 }
 
-std::pair<CodedDC, CodedAC> Codec::entropyDecoder(const FileHeaderWithTables & fileHeaderWithTables, std::vector<bool>& bitsReadFromFile)
+std::vector<HuffmanDecoder> Codec::planeDecoders(const PlaneHeader& planeHeader)
 {
-	UINT8 blocksWide = fileHeaderWithTables.FileHeader.BlocksWide;
-	UINT8 blocksHigh = fileHeaderWithTables.FileHeader.BlocksHigh;
-	INT32 numBlocks = blocksWide * blocksHigh;
-	CodedDC codedDC;
-	CodedAC codedAC;
-	for (UINT8 i = 0; i < 3; i++) {
-		const PlaneHeader* planeHeader = NULL;
-		UINT16 acZeroesBytes;
-		UINT16 acValuesBytes;
-		switch (i)
-		{
-		case 0:
-			planeHeader = &(fileHeaderWithTables.YPlaneHeader);
-			acZeroesBytes = fileHeaderWithTables.FileHeader.YACZeroesBytes;
-			acValuesBytes = fileHeaderWithTables.FileHeader.YACValuesBytes;
-			break;
-		case 1:
-			planeHeader = &(fileHeaderWithTables.UPlaneHeader);
-			acZeroesBytes = fileHeaderWithTables.FileHeader.UACZeroesBytes;
-			acValuesBytes = fileHeaderWithTables.FileHeader.UACValuesBytes;
-			break;
-		case 2:
-			planeHeader = &(fileHeaderWithTables.VPlaneHeader);
-			acZeroesBytes = fileHeaderWithTables.FileHeader.VACZeroesBytes;
-			acValuesBytes = fileHeaderWithTables.FileHeader.VACValuesBytes;
-			break;
+	LengthTable<INT8> dcLengths;
+	LengthTable<UINT8> acZeroesLengths;
+	LengthTable<INT8> acValuesLengths;
+	std::copy(
+		std::begin(planeHeader.DCLengths),
+		std::end(planeHeader.DCLengths),
+		dcLengths.begin());
+	std::copy(
+		std::begin(planeHeader.ACZeroesLengths),
+		std::end(planeHeader.ACZeroesLengths),
+		acZeroesLengths.begin());
+	std::copy(
+		std::begin(planeHeader.ACValuesLengths),
+		std::end(planeHeader.ACValuesLengths),
+		acValuesLengths.begin());
+	std::vector<HuffmanDecoder> decoders;
+	decoders.emplace_back(dcLengths);
+	decoders.emplace_back(acZeroesLengths);
+	decoders.emplace_back(acValuesLengths);
+	return decoders;
+}
+
+Codec::PlaneDecoders Codec::fileDecoders(const IM3File* im3File, UINT8 plane)
+{
+	if (im3File->getHuffmanTables() != TABLES_OPTIMIZED) {
+		return DEFAULT_DECODERS[im3File->getHuffmanTables() - TABLES_DEFAULT][plane];
+	}
+	FileHeaderWithTables fileHeaderWithTables = im3File->getFileHeaderWithTables();
+	const PlaneHeader* planeHeaders[3] = {
+		&fileHeaderWithTables.YPlaneHeader,
+		&fileHeaderWithTables.UPlaneHeader,
+		&fileHeaderWithTables.VPlaneHeader
+	};
+	return cachedDecoders(*planeHeaders[plane]);
+}
+
+Codec::PlaneDecoders Codec::cachedDecoders(const PlaneHeader& planeHeader)
+{
+	// A file decoded again, a region or a scale at a time, or files coded
+	// with the same tables find theirs here, most recently used first
+	static std::mutex mutex;
+	static std::vector<std::pair<PlaneHeader, PlaneDecoders>> cache;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t k = 0; k < cache.size(); k++) {
+			if (std::memcmp(&cache[k].first, &planeHeader, sizeof(PlaneHeader)) == 0) {
+				std::rotate(cache.begin(), cache.begin() + k, cache.begin() + k + 1);
+				return cache.front().second;
+			}
 		}
-		LengthTable<INT8> dcLengths;
-		LengthTable<UINT8> acZeroesLengths;
-		LengthTable<INT8> acValuesLengths;
-		std::copy(
-			std::begin(planeHeader->DCLengths),
-			std::end(planeHeader->DCLengths),
-			dcLengths.begin());
-		std::copy(
-			std::begin(planeHeader->ACZeroesLengths),
-			std::end(planeHeader->ACZeroesLengths),
-			acZeroesLengths.begin());
-		std::copy(
-			std::begin(planeHeader->ACValuesLengths),
-			std::end(planeHeader->ACValuesLengths),
-			acValuesLengths.begin());
-		std::vector<INT8> dcDifferences =
-			huffmanDecode<INT8>(
-				dcLengths,
-				bitsReadFromFile,
-				numBlocks);
-		std::vector<bool> entropiedACZeroes(
-			bitsReadFromFile.begin(),
-			bitsReadFromFile.begin() + (acZeroesBytes * 8));
-		bitsReadFromFile.erase(
-			bitsReadFromFile.begin(),
-			bitsReadFromFile.begin() + (acZeroesBytes * 8));
-		std::vector<UINT8> acZeroes =
-			huffmanDecode<UINT8>(
-				acZeroesLengths,
-				entropiedACZeroes);
-		std::vector<bool> entropiedACValues(
-			bitsReadFromFile.begin(),
-			bitsReadFromFile.begin() + (acValuesBytes * 8));
-		bitsReadFromFile.erase(
-			bitsReadFromFile.begin(),
-			bitsReadFromFile.begin() + (acValuesBytes * 8));
-		std::vector<INT8> acValues =
-			huffmanDecode<INT8>(
-				acValuesLengths,
-				entropiedACValues);
-		codedDC[i] = dcDifferences;
-		std::vector<std::pair<UINT8, INT8>> runLengthCodedAC(acZeroes.size());
-		INT32 blocksCoded = 0;
-		for (INT32 j = 0; j < runLengthCodedAC.size(); j++) {
-			runLengthCodedAC[j] = { acZeroes[j], acValues[j] };
-			if (acValues[j] == 0) {
-				blocksCoded += 1;
+	}
+	// Built unlocked, two threads missing on the same tables at most
+	// building them twice
+	PlaneDecoders decoders = std::make_shared<const std::vector<HuffmanDecoder>>(planeDecoders(planeHeader));
+	std::lock_guard<std::mutex> lock(mutex);
+	cache.insert(cache.begin(), std::make_pair(planeHeader, decoders));
+	if (cache.size() > DECODER_CACHE_SIZE) {
+		cache.pop_back();
+	}
+	return decoders;
+}
+
+INT16 Codec::decodeDC(BitReader& dcReader, const HuffmanDecoder& dcDecoder, UINT8 version, INT16 dc)
+{
+	// Older files difference code 8-bit components, wrapping around
+	if (version < 3) {
+		return static_cast<INT8>(dc + dcDecoder.decode<INT8>(dcReader));
+	}
+	UINT32 size = dcDecoder.decodeIndex(dcReader);
+	if (size > MAX_MAGNITUDE_BITS) {
+		dcReader.invalidate();
+		return dc;
+	}
+	dcReader.refill();
+	INT32 difference = extendMagnitude(static_cast<UINT32>(dcReader.peek(size)), size);
+	dcReader.consume(size);
+	return static_cast<INT16>(dc + difference);
+}
+
+void Codec::decodeACBlock(
+	BitReader& acZeroesReader,
+	BitReader& acValuesReader,
+	const HuffmanDecoder& acZeroesDecoder,
+	const HuffmanDecoder& acValuesDecoder,
+	UINT8 version,
+	Block<INT16>& block)
+{
+	INT16* components = &block[0][0];
+	if (version < 3) {
+		// AC components from 1 on in zig-zag order, runs past the last one
+		// dropped
+		size_t zigZag = 1;
+		while (!acZeroesReader.failed() && !acValuesReader.failed()) {
+			UINT8 zeroes = acZeroesDecoder.decode<UINT8>(acZeroesReader);
+			INT8 value = acValuesDecoder.decode<INT8>(acValuesReader);
+			if (value == 0) {
+				break;
+			}
+			zigZag += zeroes;
+			if (zigZag < ZIG_ZAG_OFFSETS.size()) {
+				components[ZIG_ZAG_OFFSETS[zigZag]] = value;
+				zigZag += 1;
 			}
-			if (blocksCoded == numBlocks) {
+		}
+		return;
+	}
+	// The block ends with its end-of-block or its last component
+	for (UINT32 zigZag = 1; zigZag < 64 && !acZeroesReader.failed() && !acValuesReader.failed(); zigZag++) {
+		UINT32 symbol = acZeroesDecoder.decodeIndex(acZeroesReader);
+		UINT32 size = symbol & 15;
+		if (size == 0) {
+			if (symbol != ZERO_RUN_SYMBOL) {
 				break;
 			}
+			zigZag += 15;
+			continue;
+		}
+		zigZag += symbol >> 4;
+		acValuesReader.refill();
+		INT32 value = extendMagnitude(static_cast<UINT32>(acValuesReader.peek(size)), size);
+		acValuesReader.consume(size);
+		if (zigZag < 64) {
+			components[ZIG_ZAG_OFFSETS[zigZag]] = static_cast<INT16>(value);
 		}
-		codedAC[i] = runLengthCodedAC;
 	}
-	return std::pair<CodedDC, CodedAC>(codedDC, codedAC);
 }
 
-Codec::YUVPlanes<INT8> Codec::runLengthDifferenceDecoder(
-	const FileHeaderWithTables & fileHeaderWithTables,
-	const std::pair<CodedDC, CodedAC> & runLengthDifferenceCoded)
+void Codec::arithmeticDecodeBlock(
+	ArithmeticDecoder& decoder,
+	ArithmeticContexts& contexts,
+	INT16& dc,
+	Block<INT16>& block)
 {
-	UINT8 blocksWide = fileHeaderWithTables.FileHeader.BlocksWide;
-	UINT8 blocksHigh = fileHeaderWithTables.FileHeader.BlocksHigh;
-	INT32 imageWidth = blocksWide * 8;
-	INT32 imageHeight = blocksHigh * 8;
-	// DC differences
-	CodedDC dcDifferences = runLengthDifferenceCoded.first;
-	// Run-length coded AC
-	CodedAC runLengthCodes = runLengthDifferenceCoded.second;
-	// Create planes
-	YUVPlanes<INT8> quantized(imageWidth, imageHeight);
-	// For each channel
+	INT32 dcClass = contexts.DCClass;
+	INT16 dcDifference = 0;
+	if (decoder.decode(contexts.DCNonzero[dcClass]) != 0) {
+		bool negative = decoder.decode(contexts.DCSign[dcClass]) != 0;
+		INT32 magnitude = static_cast<INT32>(decodeMagnitude(
+			decoder,
+			contexts.DCCategories[dcClass].data(),
+			contexts.DCBits.data()));
+		dcDifference = static_cast<INT16>(negative ? -magnitude : magnitude);
+	}
+	contexts.DCClass = dcDifferenceClass(dcDifference);
+	dc = static_cast<INT16>(dc + dcDifference);
+	block[0][0] = dc;
+	INT16* components = &block[0][0];
+	NeighbourMagnitudes magnitudes = {};
+	for (INT32 zigZag = 1; zigZag < 64 && decoder.decode(contexts.EndOfBlock[zigZag]) == 0; zigZag++) {
+		INT32 neighbourhood = neighbourClass(magnitudes, zigZag);
+		while (decoder.decode(contexts.ACNonzero[zigZag][neighbourhood]) == 0) {
+			// Only a corrupt stream runs past the last component
+			if (++zigZag == 64) {
+				return;
+			}
+			neighbourhood = neighbourClass(magnitudes, zigZag);
+		}
+		bool negative = decoder.decode(contexts.ACSign) != 0;
+		INT32 band = zigZag <= LOW_BAND ? 0 : 1;
+		INT32 magnitude = static_cast<INT32>(decodeMagnitude(
+			decoder,
+			contexts.ACCategories[band][neighbourhood].data(),
+			contexts.ACBits[band].data()));
+		components[ZIG_ZAG_OFFSETS[zigZag]] = static_cast<INT16>(negative ? -magnitude : magnitude);
+		magnitudes[ZIG_ZAG_OFFSETS[zigZag]] = static_cast<UINT8>(std::min(magnitude, 2));
+	}
+}
+
+Codec::BlockWindows Codec::fileWindows(const IM3File* im3File, const BlockWindows* windows)
+{
+	if (windows) {
+		return *windows;
+	}
+	BlockWindows whole;
+	for (UINT8 channel = 0; channel < 3; channel++) {
+		std::pair<INT32, INT32> blocks = planeBlocks(
+			im3File->getSampling(), channel, im3File->getBlocksWide(), im3File->getBlocksHigh());
+		whole[channel] = { 0, 0, blocks.first, blocks.second };
+	}
+	return whole;
+}
+
+Codec::YUVPlanes<INT16> Codec::windowPlanes(const BlockWindows& windows, UINT8 sampling)
+{
+	YUVPlanes<INT16> planes;
+	planes.sampling = sampling;
 	for (UINT8 channel = 0; channel < 3; channel++) {
-		// Previous block's DC component
-		INT8 dc = 0;
-		// For each block
-		for (INT32 i = 0; i < imageHeight; i += 8) {
-			INT32 blockY = i / 8;
-			for (INT32 j = 0; j < imageWidth; j += 8) {
-				INT32 blockX = j / 8;
-				// Create block
-				Block<INT8> block;
-				block.fill(std::array<INT8, 8>{});
-				// Decode the DC differences
-				dc += dcDifferences[channel][0];
-				dcDifferences[channel].erase(dcDifferences[channel].begin());
+		const BlockWindow& window = windows[channel];
+		planes.planes[channel].resize(window.Right - window.Left, window.Bottom - window.Top);
+	}
+	return planes;
+}
+
+size_t Codec::arithmeticDecodeBlocks(
+	const BYTE* data,
+	size_t size,
+	WindowedPlane& plane,
+	INT32 firstBlock,
+	INT32 lastBlock)
+{
+	// An empty plane has an empty stream
+	if (firstBlock >= lastBlock) {
+		return 0;
+	}
+	ArithmeticDecoder decoder(data, size);
+	ArithmeticContexts contexts;
+	INT16 dc = 0;
+	for (INT32 blockIndex = firstBlock; blockIndex < lastBlock; blockIndex++) {
+		Block<INT16>& block = plane.block(blockIndex);
+		block.fill(std::array<INT16, 8>{});
+		if (!decoder.failed()) {
+			arithmeticDecodeBlock(decoder, contexts, dc, block);
+		}
+	}
+	return std::min(decoder.bytePosition(data), size);
+}
+
+Codec::YUVPlanes<INT16> Codec::entropyDecoder(const IM3File* im3File, const BlockWindows* windows)
+{
+	UINT8 version = im3File->getVersion();
+	const BYTE* data = im3File->getPayload();
+	size_t size = im3File->getPayloadSize();
+	BlockWindows planeWindows = fileWindows(im3File, windows);
+	YUVPlanes<INT16> quantized = windowPlanes(planeWindows, im3File->getSampling());
+	// Byte offset of the current plane in the payload
+	size_t position = 0;
+	for (UINT8 channel = 0; channel < 3; channel++) {
+		std::pair<INT32, INT32> blocks = planeBlocks(
+			im3File->getSampling(), channel, im3File->getBlocksWide(), im3File->getBlocksHigh());
+		WindowedPlane plane(quantized.planes[channel], blocks.first, planeWindows[channel]);
+		INT32 numBlocks = blocks.first * blocks.second;
+		// An arithmetic coded plane ends where its decoder stops reading
+		if (im3File->getEntropyCoding() == ENTROPY_ARITHMETIC) {
+			position += arithmeticDecodeBlocks(data + position, size - position, plane, 0, numBlocks);
+			continue;
+		}
+		PlaneDecoders decoders = fileDecoders(im3File, channel);
+		const HuffmanDecoder& dcDecoder = (*decoders)[0];
+		const HuffmanDecoder& acZeroesDecoder = (*decoders)[1];
+		const HuffmanDecoder& acValuesDecoder = (*decoders)[2];
+		// The DC differences go straight into the blocks, the end of their
+		// byte-aligned stream being where the AC streams start
+		BitReader dcReader(data + position, size - position);
+		INT16 dc = 0;
+		for (INT32 blockIndex = 0; blockIndex < numBlocks; blockIndex++) {
+			Block<INT16>& block = plane.block(blockIndex);
+			block.fill(std::array<INT16, 8>{});
+			if (!dcReader.failed()) {
+				dc = decodeDC(dcReader, dcDecoder, version, dc);
 				block[0][0] = dc;
-				// Decode the zig-zag traversed run-length codes
-				std::pair<UINT8, INT8> code;
-				for (auto it = Z.begin(); it != Z.end(); it++) {
-					code = runLengthCodes[channel][0];
-					runLengthCodes[channel].erase(runLengthCodes[channel].begin());
-					if (code.first == 0 && code.second == 0) {
-						break;
-					}
-					while (code.first > 0) {
-						it++;
-						code.first -= 1;
-					}
-					block[it->second][it->first] = code.second;
-				}
-				if (!(code.first == 0 && code.second == 0)) {
-					runLengthCodes[channel].erase(runLengthCodes[channel].begin());
-				}
-				quantized.planes[channel][blockY][blockX] = block;
 			}
 		}
-
+		dcReader.alignToByte();
+		position = std::min(position + dcReader.bytePosition(data + position), size);
+		// The AC zeroes and values streams have their sizes in the header
+		size_t acZeroesStart = position;
+		size_t acValuesStart = acZeroesStart +
+			static_cast<size_t>(std::min<UINT64>(im3File->getACZeroesBytes(channel), size - acZeroesStart));
+		position = acValuesStart +
+			static_cast<size_t>(std::min<UINT64>(im3File->getACValuesBytes(channel), size - acValuesStart));
+		BitReader acZeroesReader(data + acZeroesStart, acValuesStart - acZeroesStart);
+		BitReader acValuesReader(data + acValuesStart, position - acValuesStart);
+		for (INT32 blockIndex = 0; blockIndex < numBlocks; blockIndex++) {
+			decodeACBlock(
+				acZeroesReader,
+				acValuesReader,
+				acZeroesDecoder,
+				acValuesDecoder,
+				version,
+				plane.block(blockIndex));
+		}
 	}
 	return quantized;
 }
 
-Codec::YUVPlanes<INT16> Codec::dequantize(const YUVPlanes<INT8>& quantized)
+Codec::YUVPlanes<INT16> Codec::restartDecoder(const IM3File* im3File, const BlockWindows* windows)
 {
-	INT32 width = quantized.getWidth();
-	INT32 height = quantized.getHeight();
-	YUVPlanes<INT16> output(width, height);
-	for (INT32 i = 0; i < height; i += 8) {
-		INT32 blockY = i / 8;
-		for (INT32 j = 0; j < width; j += 8) {
-			INT32 blockX = j / 8;
-			output.planes[Y][blockY][blockX] = dequantizeOnBlock<INT8, INT16>(quantized.planes[Y][blockY][blockX]);
-			output.planes[U][blockY][blockX] = dequantizeOnBlock<INT8, INT16>(quantized.planes[U][blockY][blockX]);
-			output.planes[V][blockY][blockX] = dequantizeOnBlock<INT8, INT16>(quantized.planes[V][blockY][blockX]);
+	UINT8 version = im3File->getVersion();
+	UINT16 restartInterval = im3File->getRestartInterval();
+	const std::vector<RestartSegment>& restartSegments = im3File->getRestartSegments();
+	const BYTE* data = im3File->getPayload();
+	size_t size = im3File->getPayloadSize();
+	BlockWindows planeWindows = fileWindows(im3File, windows);
+	YUVPlanes<INT16> quantized = windowPlanes(planeWindows, im3File->getSampling());
+	if (restartInterval == 0) {
+		return quantized;
+	}
+	// Plane and first block of every segment, the planes being of
+	// different sizes when chroma is subsampled
+	std::array<std::pair<INT32, INT32>, 3> blocks;
+	std::vector<std::pair<UINT8, INT32>> segmentBlocks;
+	for (UINT8 channel = 0; channel < 3; channel++) {
+		blocks[channel] = planeBlocks(
+			im3File->getSampling(), channel, im3File->getBlocksWide(), im3File->getBlocksHigh());
+		INT32 numBlocks = blocks[channel].first * blocks[channel].second;
+		for (INT32 firstBlock = 0; firstBlock < numBlocks; firstBlock += restartInterval) {
+			segmentBlocks.push_back({ channel, firstBlock });
 		}
 	}
-	return output;
+	if (segmentBlocks.size() != restartSegments.size()) {
+		return quantized;
+	}
+	// Start of every segment in the payload
+	std::vector<size_t> offsets(restartSegments.size());
+	size_t position = 0;
+	for (size_t k = 0; k < restartSegments.size(); k++) {
+		offsets[k] = position;
+		position += static_cast<size_t>(restartSegments[k].DCBytes) +
+			restartSegments[k].ACZeroesBytes +
+			restartSegments[k].ACValuesBytes;
+	}
+	bool arithmetic = im3File->getEntropyCoding() == ENTROPY_ARITHMETIC;
+	std::array<PlaneDecoders, 3> decoders;
+	for (UINT8 channel = 0; channel < 3 && !arithmetic; channel++) {
+		decoders[channel] = fileDecoders(im3File, channel);
+	}
+	// Each task decodes one segment of one plane
+	parallelFor(restartSegments.size(), [&](size_t task) {
+		UINT8 channel = segmentBlocks[task].first;
+		INT32 firstBlock = segmentBlocks[task].second;
+		INT32 blocksWide = blocks[channel].first;
+		INT32 lastBlock = std::min(firstBlock + restartInterval, blocksWide * blocks[channel].second);
+		const BlockWindow& window = planeWindows[channel];
+		if (lastBlock <= window.Top * blocksWide || firstBlock >= window.Bottom * blocksWide) {
+			return;
+		}
+		WindowedPlane plane(quantized.planes[channel], blocksWide, window);
+		const RestartSegment& segment = restartSegments[task];
+		// Clamp the three streams of the segment to the payload
+		size_t dcStart = std::min(offsets[task], size);
+		size_t acZeroesStart = std::min(dcStart + segment.DCBytes, size);
+		size_t acValuesStart = std::min(acZeroesStart + segment.ACZeroesBytes, size);
+		size_t end = std::min(acValuesStart + segment.ACValuesBytes, size);
+		if (arithmetic) {
+			arithmeticDecodeBlocks(data + dcStart, acZeroesStart - dcStart, plane, firstBlock, lastBlock);
+			return;
+		}
+		BitReader dcReader(data + dcStart, acZeroesStart - dcStart);
+		BitReader acZeroesReader(data + acZeroesStart, acValuesStart - acZeroesStart);
+		BitReader acValuesReader(data + acValuesStart, end - acValuesStart);
+		const HuffmanDecoder& dcDecoder = (*decoders[channel])[0];
+		const HuffmanDecoder& acZeroesDecoder = (*decoders[channel])[1];
+		const HuffmanDecoder& acValuesDecoder = (*decoders[channel])[2];
+		// The DC predictor starts over in every segment
+		INT16 dc = 0;
+		for (INT32 blockIndex = firstBlock; blockIndex < lastBlock; blockIndex++) {
+			Block<INT16>& block = plane.block(blockIndex);
+			block.fill(std::array<INT16, 8>{});
+			if (dcReader.failed() || acZeroesReader.failed() || acValuesReader.failed()) {
+				continue;
+			}
+			dc = decodeDC(dcReader, dcDecoder, version, dc);
+			block[0][0] = dc;
+			decodeACBlock(acZeroesReader, acValuesReader, acZeroesDecoder, acValuesDecoder, version, block);
+		}
+	});
+	return quantized;
 }
 
-Codec::YUVPlanes<INT8> Codec::inverseDCT(const YUVPlanes<INT16>& dct)
+void Codec::dequantize(
+	const YUVPlanes<INT16>& quantized,
+	const std::array<Quantizer, 2>& planeQuantizers,
+	YUVPlanes<INT16>& output)
 {
-	INT32 width = dct.getWidth();
-	INT32 height = dct.getHeight();
-	YUVPlanes<INT8> output(width, height);
-	for (INT32 i = 0; i < height; i += 8) {
-		INT32 blockY = i / 8;
-		for (INT32 j = 0; j < width; j += 8) {
-			INT32 blockX = j / 8;
-			output.planes[Y][blockY][blockX] = inverseDCTOnBlock<INT16, INT8>(dct.planes[Y][blockY][blockX]);
-			output.planes[U][blockY][blockX] = inverseDCTOnBlock<INT16, INT8>(dct.planes[U][blockY][blockX]);
-			output.planes[V][blockY][blockX] = inverseDCTOnBlock<INT16, INT8>(dct.planes[V][blockY][blockX]);
+	output.resize(quantized.getWidth(), quantized.getHeight(), quantized.getSampling());
+	// Each task dequantizes one row of blocks of one plane, the luma plane
+	// being the highest
+	INT32 blocksHigh = quantized.planes[Y].getBlocksHigh();
+	parallelFor(3 * blocksHigh, [&](size_t task) {
+		UINT8 plane = static_cast<UINT8>(task / blocksHigh);
+		INT32 blockY = static_cast<INT32>(task % blocksHigh);
+		if (blockY >= quantized.planes[plane].getBlocksHigh()) {
+			return;
 		}
-	}
-	return output;
+		for (INT32 blockX = 0; blockX < quantized.planes[plane].getBlocksWide(); blockX++) {
+			output.planes[plane][blockY][blockX] = dequantizeOnBlock<INT16, INT16>(
+				quantized.planes[plane][blockY][blockX], planeQuantizers[plane == Y ? 0 : 1]);
+		}
+	});
+}
+
+void Codec::inverseDCT(const YUVPlanes<INT16>& dct, YUVPlanes<INT8>& output)
+{
+	output.resize(dct.getWidth(), dct.getHeight(), dct.getSampling());
+	// Each task transforms one row of blocks of one plane, the luma plane
+	// being the highest
+	INT32 blocksHigh = dct.planes[Y].getBlocksHigh();
+	parallelFor(3 * blocksHigh, [&](size_t task) {
+		UINT8 plane = static_cast<UINT8>(task / blocksHigh);
+		INT32 blockY = static_cast<INT32>(task % blocksHigh);
+		if (blockY >= dct.planes[plane].getBlocksHigh()) {
+			return;
+		}
+		for (INT32 blockX = 0; blockX < dct.planes[plane].getBlocksWide(); blockX++) {
+			output.planes[plane][blockY][blockX] = inverseDCTOnBlock<INT16, INT8>(dct.planes[plane][blockY][blockX]);
+		}
+	});
+}
+
+void Codec::windowInverseDCT(
+	const YUVPlanes<INT16>& quantized,
+	const std::array<Quantizer, 2>& planeQuantizers,
+	UINT8 size,
+	YUVPlanes<INT8>& output)
+{
+	output.resize(quantized.getWidth() / 8 * size, quantized.getHeight() / 8 * size, quantized.getSampling());
+	// Each task transforms one row of blocks of one plane of the window,
+	// the luma plane being the highest
+	INT32 windowHigh = quantized.planes[Y].getBlocksHigh();
+	parallelFor(3 * windowHigh, [&](size_t task) {
+		UINT8 plane = static_cast<UINT8>(task / windowHigh);
+		INT32 windowY = static_cast<INT32>(task % windowHigh);
+		const Plane<INT16>& source = quantized.planes[plane];
+		Plane<INT8>& target = output.planes[plane];
+		if (windowY >= source.getBlocksHigh()) {
+			return;
+		}
+		const Quantizer& quantizer = planeQuantizers[plane == Y ? 0 : 1];
+		for (INT32 windowX = 0; windowX < source.getBlocksWide(); windowX++) {
+			Block<INT16> dct = dequantizeOnBlock<INT16, INT16>(source[windowY][windowX], quantizer);
+			if (size == 8) {
+				if (windowY < target.getBlocksHigh() && windowX < target.getBlocksWide()) {
+					target[windowY][windowX] = inverseDCTOnBlock<INT16, INT8>(dct);
+				}
+				continue;
+			}
+			Block<INT8> samples = DCT::inverseReduced<INT16, INT8>(dct, size);
+			for (UINT8 j = 0; j < size; j++) {
+				for (UINT8 i = 0; i < size; i++) {
+					INT32 x = windowX * size + i;
+					INT32 y = windowY * size + j;
+					if (y / 8 < target.getBlocksHigh() && x / 8 < target.getBlocksWide()) {
+						target[y / 8][x / 8][y % 8][x % 8] = samples[j][i];
+					}
+				}
+			}
+		}
+	});
 }
 
-BitmapFile * Codec::YUVToBitmap(const YUVPlanes<INT8>& yuv)
+BitmapFile * Codec::YUVToBitmap(const YUVPlanes<INT8>& yuv, INT32 width, INT32 height)
 {
-	INT32 width = yuv.getWidth();
-	INT32 height = yuv.getHeight();
+	// Never past the planes, whatever a damaged file says
+	width = std::min(width, yuv.getWidth());
+	height = std::min(height, yuv.getHeight());
 	BitmapFile* bitmapFile = new BitmapFile(width, height);
-	for (INT32 i = 0; i < height; i++) {
+	if (width == 0) {
+		return bitmapFile;
+	}
+	UINT8 sampling = yuv.getSampling();
+	// Each task converts one row of pixels from the same row of its blocks
+	parallelFor(height, [&](size_t task) {
+		INT32 i = static_cast<INT32>(task);
 		INT32 blockY = i / 8;
 		INT32 offsetY = i % 8;
-		for (INT32 j = 0; j < width; j++) {
-			INT32 blockX = j / 8;
-			INT32 offsetX = j % 8;
-			INT32 scaledY = yuv.planes[Y][blockY][blockX][offsetY][offsetX];
-			INT32 scaledU = yuv.planes[U][blockY][blockX][offsetY][offsetX];
-			INT32 scaledV = yuv.planes[V][blockY][blockX][offsetY][offsetX];
-			YUV yuvOutput;
-			yuvOutput.Y = static_cast<DOUBLE>(scaledY + 128) / 255.0;
-			yuvOutput.U = static_cast<DOUBLE>(scaledU + 128) / 255.0;
-			yuvOutput.V = static_cast<DOUBLE>(scaledV + 128) / 255.0;
-			NormalizedRGB rgbOutput = YUVtoNormalizedRGB(yuvOutput);
-			BitmapFile::Pixel pixelOutput = NormalizedRGBtoPixel(rgbOutput);
-			bitmapFile->setPixel(j, i, pixelOutput);
+		if (sampling != SAMPLING_444) {
+			// Upsample the chroma of the row into rows of blocks first
+			INT32 rowSamples = blocksCovering(width) * ColorConvert::BLOCK_STRIDE;
+			std::vector<INT8> chroma(2 * rowSamples);
+			INT8* upsampledU = chroma.data();
+			INT8* upsampledV = chroma.data() + rowSamples;
+			upsampleRow(yuv.planes[U], sampling, i, width, height, upsampledU);
+			upsampleRow(yuv.planes[V], sampling, i, width, height, upsampledV);
+			ColorConvert::yuvToRGB(
+				colorKernel,
+				&yuv.planes[Y][blockY][0][offsetY][0],
+				upsampledU,
+				upsampledV,
+				width,
+				bitmapFile->getPixelRow(i));
+			return;
 		}
-	}
+		ColorConvert::yuvToRGB(
+			colorKernel,
+			&yuv.planes[Y][blockY][0][offsetY][0],
+			&yuv.planes[U][blockY][0][offsetY][0],
+			&yuv.planes[V][blockY][0][offsetY][0],
+			width,
+			bitmapFile->getPixelRow(i));
+	});
 	return bitmapFile;
 }
 
 IM3File* Codec::compress(BitmapFile * bitmapFile)
 {
-	Codec::YUVPlanes<INT8> yuv = bitmapToYUV(bitmapFile);
-	Codec::YUVPlanes<INT16> dctCoefficients = dct(yuv);
-	Codec::YUVPlanes<INT8> quantized = quantize(dctCoefficients);
-	std::pair<CodedDC, CodedAC> runLengthDifferenceCoded =
-		runLengthDifferenceCoder(quantized);
-	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> entropyCoded = entropyCoder(
-		runLengthDifferenceCoded.first, runLengthDifferenceCoded.second);
-	UINT8 blocksWide = yuv.getWidth() / 8;
-	UINT8 blocksHigh = yuv.getHeight() / 8;
-	IM3File* file = new IM3File(blocksWide, blocksHigh, entropyCoded);
+	std::vector<RestartSegment> restartSegments;
+	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> entropyCoded;
+	// Tables of the image's own need all of its symbols first
+	if (entropyCoding == ENTROPY_HUFFMAN && optimizeTables) {
+		std::pair<CodedDC, CodedAC> runLengthDifferenceCoded =
+			stripEncoder(bitmapFile);
+		entropyCoded = entropyCoder(
+			runLengthDifferenceCoded.first, runLengthDifferenceCoded.second, restartSegments);
+	}
+	else {
+		// Every batch of strips is coded while the next one is encoded
+		PixelRows image = { bitmapFile->getWidth(), bitmapFile->getHeight(),
+			[bitmapFile](INT32 y) { return bitmapFile->getPixelRow(y); } };
+		std::array<StreamedPlane, 3> planes;
+		for (UINT8 i = 0; i < 3; i++) {
+			std::pair<INT32, INT32> blocks = planeBlocks(
+				sampling, i, blocksCovering(image.Width), blocksCovering(image.Height));
+			planes[i].NumBlocks = blocks.first * blocks.second;
+			planes[i].BlocksCoded = 0;
+			planes[i].SegmentsDone = 0;
+			planes[i].StreamBytes.fill(0);
+			planes[i].SegmentStart.fill(0);
+			planes[i].KeepBytes = true;
+		}
+		encodeStrips(image, NULL, [&](std::vector<StripSymbols>& symbols, INT32 count) {
+			codeStrips(symbols, count, DEFAULT_CODES[defaultTables()], planes, NULL);
+		});
+		for (UINT8 i = 0; i < 3; i++) {
+			entropyCoded[i].first.second.swap(planes[i].Bytes[0]);
+			entropyCoded[i].second.first.second.swap(planes[i].Bytes[1]);
+			entropyCoded[i].second.second.second.swap(planes[i].Bytes[2]);
+			restartSegments.insert(restartSegments.end(), planes[i].Segments.begin(), planes[i].Segments.end());
+		}
+	}
+	IM3File* file = new IM3File(
+		entropyCoded,
+		fileExtensionHeader(bitmapFile->getWidth(), bitmapFile->getHeight()),
+		restartSegments);
 	return file;
 }
 
+ExtensionHeader Codec::fileExtensionHeader(INT32 width, INT32 height) const
+{
+	ExtensionHeader extensionHeader = {};
+	extensionHeader.Width = width;
+	extensionHeader.Height = height;
+	extensionHeader.RestartInterval = restartInterval;
+	extensionHeader.Sampling = sampling;
+	extensionHeader.EntropyCoding = entropyCoding;
+	if (entropyCoding == ENTROPY_HUFFMAN && !optimizeTables) {
+		extensionHeader.HuffmanTables = TABLES_DEFAULT + defaultTables();
+	}
+	if (quality != 0) {
+		for (UINT8 k = 0; k < 2; k++) {
+			for (UINT8 i = 0; i < 8; i++) {
+				for (UINT8 j = 0; j < 8; j++) {
+					extensionHeader.QuantizationTables[k][i * 8 + j] = quantizers[k].Table[i][j];
+				}
+			}
+		}
+	}
+	return extensionHeader;
+}
+
+BOOL Codec::encodeStrips(
+	const PixelRows& image,
+	const std::function<BOOL(INT32 firstRow, INT32 numRows)>& load,
+	const std::function<void(std::vector<StripSymbols>& symbols, INT32 count)>& consume)
+{
+	INT32 blocksWide = blocksCovering(image.Width);
+	INT32 blocksHigh = blocksCovering(image.Height);
+	INT32 stripRows = 8 * verticalFactor(sampling);
+	INT32 numStrips = (blocksHigh * 8 + stripRows - 1) / stripRows;
+	// A batch holds a strip per thread, the symbols of the batch before
+	// being consumed alongside in a task of its own
+	INT32 batchStrips = threadPool ? static_cast<INT32>(threadPool->getThreadCount()) : 1;
+	std::array<std::vector<StripSymbols>, 2> symbols;
+	symbols[0].resize(batchStrips);
+	symbols[1].resize(batchStrips);
+	std::array<INT16, 3> lastDC = {};
+	// Strips of the batch before, waiting to be consumed
+	INT32 waiting = 0;
+	for (INT32 first = 0; first < numStrips; first += batchStrips) {
+		std::vector<StripSymbols>& encoded = symbols[(first / batchStrips) % 2];
+		std::vector<StripSymbols>& previous = symbols[(first / batchStrips + 1) % 2];
+		INT32 count = std::min(batchStrips, numStrips - first);
+		INT32 firstRow = first * stripRows;
+		INT32 numRows = std::min(count * stripRows, image.Height - firstRow);
+		if (load && !load(firstRow, numRows)) {
+			return FALSE;
+		}
+		parallelFor(count + (waiting > 0 ? 1 : 0), [&](size_t task) {
+			if (task == static_cast<size_t>(count)) {
+				consume(previous, waiting);
+				return;
+			}
+			Strip<INT8> strip;
+			Strip<INT8> chroma;
+			encoded[task] = StripSymbols();
+			encodeStrip(image, first + static_cast<INT32>(task), strip, chroma, encoded[task]);
+		});
+		for (INT32 k = 0; k < count; k++) {
+			chainStrip(blocksWide, blocksHigh, first + k, lastDC, encoded[k]);
+			lastDC = encoded[k].LastDC;
+		}
+		waiting = count;
+	}
+	if (waiting > 0) {
+		consume(symbols[((numStrips - 1) / batchStrips) % 2], waiting);
+	}
+	return TRUE;
+}
+
+BOOL Codec::streamStrips(
+	BitmapReader& reader,
+	const std::function<void(std::vector<StripSymbols>& symbols, INT32 count)>& consume)
+{
+	INT32 width = reader.getWidth();
+	std::vector<BitmapFile::Pixel> pixels;
+	INT32 batchRow = 0;
+	// Rows below the image are never asked for, bitmapToYUV repeating the
+	// last one instead
+	PixelRows image = { width, reader.getHeight(), [&](INT32 y) {
+		return &pixels[static_cast<size_t>(y - batchRow) * width];
+	} };
+	return encodeStrips(image, [&](INT32 firstRow, INT32 numRows) {
+		batchRow = firstRow;
+		pixels.resize(std::max(pixels.size(), static_cast<size_t>(numRows) * width));
+		return reader.readRows(firstRow, numRows, pixels.data());
+	}, consume);
+}
+
+BOOL Codec::flushStreams(StreamedPlane& plane, Stream& output)
+{
+	BOOL written = TRUE;
+	for (UINT8 j = 0; j < 3; j++) {
+		std::vector<BYTE> bytes = plane.Writers[j].drain();
+		// The arithmetic stream stands in for the DC
+		if (j == 0 && bytes.empty()) {
+			bytes = plane.Arithmetic.drain();
+		}
+		if (bytes.empty()) {
+			continue;
+		}
+		written &= output.seek(plane.Cursors[j]);
+		written &= output.write(bytes.data(), bytes.size());
+		plane.Cursors[j] += bytes.size();
+	}
+	return written;
+}
+
+void Codec::drainStreams(StreamedPlane& plane)
+{
+	for (UINT8 j = 0; j < 3; j++) {
+		std::vector<BYTE> bytes = plane.Writers[j].drain();
+		// The arithmetic stream stands in for the DC
+		if (j == 0 && bytes.empty()) {
+			bytes = plane.Arithmetic.drain();
+		}
+		plane.StreamBytes[j] += bytes.size();
+		if (!plane.KeepBytes) {
+			continue;
+		}
+		if (plane.Bytes[j].empty()) {
+			plane.Bytes[j].swap(bytes);
+		}
+		else {
+			plane.Bytes[j].insert(plane.Bytes[j].end(), bytes.begin(), bytes.end());
+		}
+	}
+}
+
+BOOL Codec::codeRun(
+	const std::vector<StripSymbols>& symbols,
+	const StripRun& run,
+	const PlaneCodes& codes,
+	StreamedPlane& plane,
+	Stream* output)
+{
+	UINT8 i = run.Plane;
+	INT32 k = run.Strip;
+	INT32 j = 0;
+	// The codes of every block end with its end-of-block, the one code
+	// with a zero value
+	size_t next = 0;
+	for (; j < run.Block; j++) {
+		while (symbols[k].RunLengthCodes[i][next].second != 0) {
+			next++;
+		}
+		next++;
+	}
+	BOOL written = TRUE;
+	for (INT32 n = 0; n < run.NumBlocks; n++, j++) {
+		while (j == static_cast<INT32>(symbols[k].DCDifferences[i].size())) {
+			k++;
+			j = 0;
+			next = 0;
+		}
+		INT16 dcDifference = symbols[k].DCDifferences[i][j];
+		const std::pair<UINT8, INT16>* runLengthCodes = &symbols[k].RunLengthCodes[i][next];
+		if (entropyCoding == ENTROPY_ARITHMETIC) {
+			next += arithmeticCodeBlock(plane.Arithmetic, plane.Contexts, dcDifference, runLengthCodes);
+		}
+		else {
+			next += huffmanCodeBlock(plane.Writers, codes, dcDifference, runLengthCodes);
+		}
+		plane.BlocksCoded += 1;
+		bool segmentEnd = plane.BlocksCoded == plane.NumBlocks ||
+			(restartInterval != 0 && plane.BlocksCoded % restartInterval == 0);
+		if (!segmentEnd) {
+			continue;
+		}
+		for (BitWriter& writer : plane.Writers) {
+			writer.alignToByte();
+		}
+		if (entropyCoding == ENTROPY_ARITHMETIC) {
+			plane.Arithmetic.flush();
+			plane.Contexts = ArithmeticContexts();
+		}
+		if (!output) {
+			// The streams of the plane are sized in 64-bit totals as
+			// they drain, restart segments as they end
+			drainStreams(plane);
+			if (restartInterval != 0) {
+				RestartSegment segment;
+				segment.DCBytes = static_cast<UINT32>(plane.StreamBytes[0] - plane.SegmentStart[0]);
+				segment.ACZeroesBytes = static_cast<UINT32>(plane.StreamBytes[1] - plane.SegmentStart[1]);
+				segment.ACValuesBytes = static_cast<UINT32>(plane.StreamBytes[2] - plane.SegmentStart[2]);
+				plane.Segments.push_back(segment);
+				plane.SegmentStart = plane.StreamBytes;
+			}
+			continue;
+		}
+		written &= flushStreams(plane, *output);
+		// The next segment starts where this one's AC values end
+		plane.SegmentsDone += 1;
+		if (plane.SegmentsDone < plane.Segments.size()) {
+			const RestartSegment& segment = plane.Segments[plane.SegmentsDone];
+			UINT64 start = plane.Cursors[2];
+			plane.Cursors[0] = start;
+			plane.Cursors[1] = start + segment.DCBytes;
+			plane.Cursors[2] = start + segment.DCBytes + segment.ACZeroesBytes;
+		}
+	}
+	// Nothing but the bits of the last code is held past a run
+	if (output) {
+		written &= flushStreams(plane, *output);
+	}
+	else {
+		drainStreams(plane);
+	}
+	return written;
+}
+
+BOOL Codec::codeStrips(
+	const std::vector<StripSymbols>& symbols,
+	INT32 count,
+	const StreamCodes& codes,
+	std::array<StreamedPlane, 3>& planes,
+	Stream* output)
+{
+	std::array<INT32, 3> batchBlocks = {};
+	for (INT32 k = 0; k < count; k++) {
+		for (UINT8 i = 0; i < 3; i++) {
+			batchBlocks[i] += static_cast<INT32>(symbols[k].DCDifferences[i].size());
+		}
+	}
+	// The planes share nothing but the output
+	if (output) {
+		BOOL written = TRUE;
+		for (UINT8 i = 0; i < 3; i++) {
+			StripRun run = { i, 0, 0, batchBlocks[i] };
+			written &= codeRun(symbols, run, codes[i], planes[i], output);
+		}
+		return written;
+	}
+	// Each plane goes on with its open segment in a run, and the restart
+	// segments starting in the batch are coded in runs of their own into
+	// planes of their own
+	std::vector<StripRun> runs;
+	std::vector<INT32> runBlocks; // Block of its plane each run starts at
+	for (UINT8 i = 0; i < 3; i++) {
+		INT32 k = 0;
+		INT32 j = 0;
+		INT32 runStart = 0;
+		while (runStart < batchBlocks[i]) {
+			// The run ends at the first segment start MIN_RUN_BLOCKS on
+			INT32 runEnd = batchBlocks[i];
+			if (restartInterval != 0) {
+				INT32 blockIndex = planes[i].BlocksCoded + runStart + MIN_RUN_BLOCKS;
+				INT32 segmentStart = (blockIndex + restartInterval - 1) / restartInterval * restartInterval;
+				runEnd = std::min(segmentStart - planes[i].BlocksCoded, batchBlocks[i]);
+			}
+			runs.push_back({ i, k, j, runEnd - runStart });
+			runBlocks.push_back(planes[i].BlocksCoded + runStart);
+			// The strip and block the next run starts at
+			j += runEnd - runStart;
+			while (k < count && j >= static_cast<INT32>(symbols[k].DCDifferences[i].size())) {
+				j -= static_cast<INT32>(symbols[k].DCDifferences[i].size());
+				k++;
+			}
+			runStart = runEnd;
+		}
+	}
+	std::vector<StreamedPlane> runPlanes(runs.size());
+	parallelFor(runs.size(), [&](size_t r) {
+		const StripRun& run = runs[r];
+		StreamedPlane& plane = planes[run.Plane];
+		// The first run of a plane goes on with its streams
+		if (r == 0 || runs[r - 1].Plane != run.Plane) {
+			codeRun(symbols, run, codes[run.Plane], plane, NULL);
+			return;
+		}
+		StreamedPlane& runPlane = runPlanes[r];
+		runPlane.NumBlocks = plane.NumBlocks;
+		runPlane.BlocksCoded = runBlocks[r];
+		runPlane.SegmentsDone = 0;
+		runPlane.StreamBytes.fill(0);
+		runPlane.SegmentStart.fill(0);
+		runPlane.KeepBytes = plane.KeepBytes;
+		codeRun(symbols, run, codes[run.Plane], runPlane, NULL);
+	});
+	// The runs follow one another in their planes, the last one's open
+	// segment going on in the next batch
+	for (size_t r = 1; r < runs.size(); r++) {
+		if (runs[r - 1].Plane != runs[r].Plane) {
+			continue;
+		}
+		StreamedPlane& plane = planes[runs[r].Plane];
+		StreamedPlane& runPlane = runPlanes[r];
+		for (UINT8 j = 0; j < 3; j++) {
+			plane.SegmentStart[j] = plane.StreamBytes[j] + runPlane.SegmentStart[j];
+			plane.StreamBytes[j] += runPlane.StreamBytes[j];
+			plane.Bytes[j].insert(plane.Bytes[j].end(), runPlane.Bytes[j].begin(), runPlane.Bytes[j].end());
+		}
+		plane.Segments.insert(plane.Segments.end(), runPlane.Segments.begin(), runPlane.Segments.end());
+		plane.BlocksCoded = runPlane.BlocksCoded;
+		plane.Writers = std::move(runPlane.Writers);
+		plane.Arithmetic = std::move(runPlane.Arithmetic);
+		plane.Contexts = runPlane.Contexts;
+	}
+	return TRUE;
+}
+
+BOOL Codec::compressStream(Stream& bitmapStream, Stream& im3Stream, BitmapFile::CreateResult* result)
+{
+	BitmapReader reader(bitmapStream, result);
+	if (*result != BitmapFile::OK) {
+		return FALSE;
+	}
+	INT32 blocksWide = blocksCovering(reader.getWidth());
+	INT32 blocksHigh = blocksCovering(reader.getHeight());
+	// First pass with optimized tables: count the symbols of every stream,
+	// which the default tables and arithmetic coding have no need of
+	bool counting = entropyCoding == ENTROPY_HUFFMAN && optimizeTables;
+	StreamCounts counts = {};
+	BOOL read = !counting || streamStrips(reader, [&counts](std::vector<StripSymbols>& symbols, INT32 count) {
+		for (INT32 k = 0; k < count; k++) {
+			for (UINT8 i = 0; i < 3; i++) {
+				size_t next = 0;
+				for (INT16 dcDifference : symbols[k].DCDifferences[i]) {
+					next += countBlockSymbols(counts[i], dcDifference, &symbols[k].RunLengthCodes[i][next]);
+				}
+			}
+		}
+	});
+	// Tables from the counts, or the default ones
+	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> entropyCoded;
+	StreamCodes codes = DEFAULT_CODES[defaultTables()];
+	std::array<StreamedPlane, 3> planes;
+	std::array<std::array<UINT64, 3>, 3> streamBytes = {};
+	for (UINT8 i = 0; i < 3; i++) {
+		if (counting) {
+			planeTables(counts[i], codes[i], entropyCoded[i], streamBytes[i]);
+		}
+		std::pair<INT32, INT32> blocks = planeBlocks(sampling, i, blocksWide, blocksHigh);
+		planes[i].NumBlocks = blocks.first * blocks.second;
+		planes[i].BlocksCoded = 0;
+		planes[i].SegmentsDone = 0;
+		planes[i].StreamBytes.fill(0);
+		planes[i].SegmentStart.fill(0);
+		planes[i].KeepBytes = false;
+	}
+	// Second pass with restart segments or without counts: size every
+	// segment, or without restarts every plane
+	bool sizing = restartInterval != 0 || !counting;
+	if (read && sizing) {
+		read = streamStrips(reader, [&](std::vector<StripSymbols>& symbols, INT32 count) {
+			codeStrips(symbols, count, codes, planes, NULL);
+		});
+		for (UINT8 i = 0; i < 3; i++) {
+			planes[i].BlocksCoded = 0;
+			streamBytes[i] = planes[i].StreamBytes;
+		}
+	}
+	if (!read) {
+		*result = BitmapFile::ERROR_READ_FAILED;
+		return FALSE;
+	}
+	// The headers go first, every stream then knowing its place
+	std::vector<RestartSegment> restartSegments;
+	for (UINT8 i = 0; i < 3; i++) {
+		restartSegments.insert(restartSegments.end(), planes[i].Segments.begin(), planes[i].Segments.end());
+	}
+	IM3File file(entropyCoded, fileExtensionHeader(reader.getWidth(), reader.getHeight()), restartSegments);
+	for (UINT8 i = 0; i < 3; i++) {
+		file.setACBytes(i, streamBytes[i][1], streamBytes[i][2]);
+	}
+	UINT64 position = file.SaveHeader(im3Stream);
+	BOOL written = position != 0;
+	for (UINT8 i = 0; i < 3; i++) {
+		// Each plane's first segment, or its whole streams, one after the other
+		std::array<UINT64, 3> firstBytes = streamBytes[i];
+		if (!planes[i].Segments.empty()) {
+			firstBytes[0] = planes[i].Segments[0].DCBytes;
+			firstBytes[1] = planes[i].Segments[0].ACZeroesBytes;
+		}
+		planes[i].Cursors[0] = position;
+		planes[i].Cursors[1] = position + firstBytes[0];
+		planes[i].Cursors[2] = position + firstBytes[0] + firstBytes[1];
+		position += streamBytes[i][0] + streamBytes[i][1] + streamBytes[i][2];
+	}
+	// Last pass: code every stream into place
+	read = streamStrips(reader, [&](std::vector<StripSymbols>& symbols, INT32 count) {
+		written &= codeStrips(symbols, count, codes, planes, &im3Stream);
+	});
+	if (!read) {
+		*result = BitmapFile::ERROR_READ_FAILED;
+	}
+	return read && written;
+}
+
 BitmapFile * Codec::decompress(IM3File* im3File)
 {
-	FileHeaderWithTables fileHeaderWithTables =
-		im3File->getFileHeaderWithTables();
-	std::vector<bool> bitsReadFromFile =
-		im3File->getBitsReadFromFile();
-	std::pair<CodedDC, CodedAC> runLengthDifferenceCoded =
-		entropyDecoder(fileHeaderWithTables, bitsReadFromFile);
-	YUVPlanes<INT8> quantized = runLengthDifferenceDecoder(
-		fileHeaderWithTables,
-		runLengthDifferenceCoded);
-	YUVPlanes<INT16> dct = dequantize(quantized);
-	YUVPlanes<INT8> yuv = inverseDCT(dct);
-	return YUVToBitmap(yuv);
+	// Files with restart segments decode segment by segment
+	YUVPlanes<INT16> dct = im3File->getRestartInterval() != 0 ?
+		restartDecoder(im3File) : entropyDecoder(im3File);
+	// The components are dequantized in place
+	dequantize(dct, fileQuantizers(im3File), dct);
+	YUVPlanes<INT8> yuv;
+	inverseDCT(dct, yuv);
+	return YUVToBitmap(yuv, im3File->getWidth(), im3File->getHeight());
+}
+
+BitmapFile * Codec::decompressRegion(
+	IM3File* im3File,
+	INT32 left,
+	INT32 top,
+	INT32 width,
+	INT32 height,
+	UINT8 scale)
+{
+	// Samples across a block at the scale
+	UINT8 size = scale >= 8 ? 1 : scale >= 4 ? 2 : scale >= 2 ? 4 : 8;
+	scale = 8 / size;
+	// The rectangle within the image
+	INT64 imageWidth = im3File->getWidth();
+	INT64 imageHeight = im3File->getHeight();
+	INT64 x0 = std::min(std::max(static_cast<INT64>(left), static_cast<INT64>(0)), imageWidth);
+	INT64 y0 = std::min(std::max(static_cast<INT64>(top), static_cast<INT64>(0)), imageHeight);
+	INT64 x1 = std::min(std::max(static_cast<INT64>(left) + width, x0), imageWidth);
+	INT64 y1 = std::min(std::max(static_cast<INT64>(top) + height, y0), imageHeight);
+	// The luma blocks under it in whole chroma blocks, with a chroma block
+	// more on each side for the upsampling to see the neighbours it would
+	// in the whole image
+	UINT8 sampling = im3File->getSampling();
+	INT32 horizontal = horizontalFactor(sampling);
+	INT32 vertical = verticalFactor(sampling);
+	INT32 margin = sampling == SAMPLING_444 ? 0 : 1;
+	INT32 blocksWide = im3File->getBlocksWide();
+	INT32 blocksHigh = im3File->getBlocksHigh();
+	INT32 blocksLeft = std::max(static_cast<INT32>(x0 / 8) / horizontal - margin, 0) * horizontal;
+	INT32 blocksTop = std::max(static_cast<INT32>(y0 / 8) / vertical - margin, 0) * vertical;
+	INT32 blocksRight = std::min(
+		((blocksCovering(x1) + horizontal - 1) / horizontal + margin) * horizontal, blocksWide);
+	INT32 blocksBottom = std::min(
+		((blocksCovering(y1) + vertical - 1) / vertical + margin) * vertical, blocksHigh);
+	blocksRight = std::max(blocksRight, blocksLeft);
+	blocksBottom = std::max(blocksBottom, blocksTop);
+	// Only the blocks of the window are kept, its edges in each plane being
+	// whole chroma blocks
+	BlockWindows windows;
+	for (UINT8 plane = 0; plane < 3; plane++) {
+		INT32 planeHorizontal = plane == Y ? 1 : horizontal;
+		INT32 planeVertical = plane == Y ? 1 : vertical;
+		windows[plane] = {
+			blocksLeft / planeHorizontal,
+			blocksTop / planeVertical,
+			(blocksRight + planeHorizontal - 1) / planeHorizontal,
+			(blocksBottom + planeVertical - 1) / planeVertical };
+	}
+	YUVPlanes<INT16> quantized = im3File->getRestartInterval() != 0 ?
+		restartDecoder(im3File, &windows) : entropyDecoder(im3File, &windows);
+	YUVPlanes<INT8> window;
+	windowInverseDCT(quantized, fileQuantizers(im3File), size, window);
+	// The window scaled, the image edge cropping it as in a whole decode
+	INT64 windowWidth = std::min(static_cast<INT64>(blocksRight) * 8, imageWidth) - blocksLeft * 8;
+	INT64 windowHeight = std::min(static_cast<INT64>(blocksBottom) * 8, imageHeight) - blocksTop * 8;
+	BitmapFile* windowBitmap = YUVToBitmap(
+		window,
+		static_cast<INT32>((std::max(windowWidth, static_cast<INT64>(0)) + scale - 1) / scale),
+		static_cast<INT32>((std::max(windowHeight, static_cast<INT64>(0)) + scale - 1) / scale));
+	// Crop the rectangle out of the window
+	INT32 cropLeft = static_cast<INT32>((x0 - blocksLeft * 8) / scale);
+	INT32 cropTop = static_cast<INT32>((y0 - blocksTop * 8) / scale);
+	INT32 cropRight = std::min(
+		static_cast<INT32>((x1 - blocksLeft * 8 + scale - 1) / scale), windowBitmap->getWidth());
+	INT32 cropBottom = std::min(
+		static_cast<INT32>((y1 - blocksTop * 8 + scale - 1) / scale), windowBitmap->getHeight());
+	cropRight = std::max(cropRight, cropLeft);
+	cropBottom = std::max(cropBottom, cropTop);
+	BitmapFile* bitmapFile = new BitmapFile(cropRight - cropLeft, cropBottom - cropTop);
+	for (INT32 y = cropTop; y < cropBottom; y++) {
+		memcpy(
+			bitmapFile->getPixelRow(y - cropTop),
+			windowBitmap->getPixelRow(y) + cropLeft,
+			static_cast<size_t>(cropRight - cropLeft) * sizeof(BitmapFile::Pixel));
+	}
+	delete windowBitmap;
+	return bitmapFile;
+}
+
+void Codec::parallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	if (threadPool) {
+		threadPool->parallelFor(count, task);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		task(i);
+	}
+}
+
+void Codec::setColorKernel(ColorConvert::Kernel kernel)
+{
+	colorKernel = kernel;
+}
+
+void Codec::setDCTEngine(DCT::Engine engine)
+{
+	dctEngine = engine;
+}
+
+void Codec::setInverseDCTEngine(DCT::InverseEngine engine)
+{
+	inverseDCTEngine = engine;
+}
+
+void Codec::setThreadCount(UINT32 numThreads)
+{
+	if (numThreads == 1) {
+		threadPool.reset();
+	}
+	else {
+		threadPool.reset(new ThreadPool(numThreads));
+	}
+}
+
+void Codec::setRestartInterval(UINT16 blocks)
+{
+	restartInterval = blocks;
+}
+
+void Codec::setSampling(Sampling sampling)
+{
+	this->sampling = sampling;
+}
+
+void Codec::setQuality(UINT8 quality)
+{
+	this->quality = std::min(quality, static_cast<UINT8>(100));
+	if (this->quality == 0) {
+		quantizers[0] = makeQuantizer(scaleTable(Q, 50));
+		quantizers[1] = quantizers[0];
+		return;
+	}
+	quantizers[0] = makeQuantizer(scaleTable(Q, this->quality));
+	quantizers[1] = makeQuantizer(scaleTable(QC, this->quality));
+}
+
+void Codec::setEntropyCoding(EntropyCoding coding)
+{
+	entropyCoding = coding;
+}
+
+void Codec::setOptimizeTables(bool optimize)
+{
+	optimizeTables = optimize;
 }
 
-Codec::Codec()
+Codec::Codec() : dctEngine(DCT::FAST), inverseDCTEngine(DCT::INVERSE_INTEGER),
+	colorKernel(ColorConvert::bestKernel()), restartInterval(0), sampling(SAMPLING_444),
+	entropyCoding(ENTROPY_HUFFMAN), optimizeTables(false)
 {
+	setQuality(0);
 }
@@ -2,16 +2,27 @@
 #define _USE_MATH_DEFINES
 #include <algorithm>
 #include <array>
+#include <functional>
+#include <memory>
 #include <vector>
-#include <queue>
-#include <map>
 #include <utility>
 #include <limits>
 #include <math.h>
 #include "BitmapUtility.h"
 #include "BitmapFile.h"
+#include "BitmapReader.h"
 #include "commontypes.h"
+#include "AlignedAllocator.h"
+#include "Arithmetic.h"
+#include "ColorConvert.h"
+#include "DCT.h"
+#include "BitWriter.h"
+#include "Huffman.h"
+#include "ThreadPool.h"
 #include "IM3File.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // Forward declaration of class dependencies
 class IM3File;
@@ -22,21 +33,128 @@ private:
 	// Quantization matrix
 	static const std::array<std::array<INT8, 8>, 8> Q;
 
+	// Chroma quantization matrix
+	static const std::array<std::array<INT8, 8>, 8> QC;
+
+	// Smallest table entry. Quantized components take 16 bits, so even
+	// the at most 1024 a DCT gives fit undivided.
+	static const INT32 MIN_QUANTIZATION = 1;
+
+	// Fixed-point precision of the quantization reciprocals
+	static const UINT8 RECIPROCAL_SHIFT = 32;
+
 	// Zig-zag scan pattern
 	static const std::array<std::pair<INT8, INT8>, 63> Z;
 
+	// Offsets of the components of a block from its first in zig-zag
+	// order, the DC component first
+	static const std::array<UINT8, 64> ZIG_ZAG_OFFSETS;
+
+	// Place in zig-zag order of the component at each offset
+	static const std::array<UINT8, 64> ZIG_ZAG_INDICES;
+
+	// Offsets of the components left of and above each component in
+	// zig-zag order, 64 for none. The zig-zag passes both before it.
+	static const std::array<std::pair<UINT8, UINT8>, 64> ZIG_ZAG_NEIGHBOURS;
+
+	// Most run-length codes a block takes, every AC component nonzero and
+	// the end-of-block code
+	static const INT32 MAX_BLOCK_CODES = 64;
+
+	// Huffman symbols of a run of 16 zeroes and of the end-of-block in the
+	// AC zeroes stream, the others being the run of zeroes before an AC
+	// component in the high four bits and its size in the low four
+	static const UINT8 ZERO_RUN_SYMBOL = 0xF0;
+	static const UINT8 END_OF_BLOCK_SYMBOL = 0x00;
+
+	// Largest size in bits of a component or DC difference decoded
+	static const UINT32 MAX_MAGNITUDE_BITS = 15;
+
+	// Sets of default tables, one for the fixed table and the lower
+	// qualities and one for the higher, whose blocks keep many more
+	// components
+	static const UINT8 NUM_DEFAULT_TABLES = 2;
+
+	// Lowest quality coded with the second set of default tables
+	static const UINT8 HIGH_QUALITY_TABLES = 85;
+
+	// Default Huffman code lengths of the DC sizes of each set, luma then
+	// chroma
+	static const std::array<std::array<std::array<UINT8, 16>, 2>, NUM_DEFAULT_TABLES> DEFAULT_DC_LENGTHS;
+
+	// Default Huffman code lengths of the AC symbols of each set by run of
+	// zeroes, then size, luma then chroma
+	static const std::array<std::array<std::array<std::array<UINT8, 16>, 16>, 2>, NUM_DEFAULT_TABLES> DEFAULT_AC_LENGTHS;
+
+	// Forward DCT implementation in use
+	DCT::Engine dctEngine;
+
+	// Inverse DCT implementation in use
+	DCT::InverseEngine inverseDCTEngine;
+
+	// Colour conversion kernel in use
+	ColorConvert::Kernel colorKernel;
+
+	// Worker threads, none when running serially
+	std::unique_ptr<ThreadPool> threadPool;
+
+	// Blocks per restart segment of compressed files, 0 for none
+	UINT16 restartInterval;
+
+	// Chroma sampling of compressed files
+	Sampling sampling;
+
+	// Quality the tables are scaled to, 0 for the fixed matrix on every plane
+	UINT8 quality;
+
+	// Entropy coding of compressed files
+	EntropyCoding entropyCoding;
+
+	// Whether Huffman tables are built for each compressed file rather
+	// than the default ones used
+	bool optimizeTables;
+
 	// Template types
 
 	// Before DCT: T == INT8
 	// Before Quantization: T == INT16
-	// Before Entropy Coding: T == INT8
+	// Before Entropy Coding: T == INT16
 
 	// Alias templates
 	template <typename T>
 	using Block = std::array<std::array<T, 8>, 8>;
 
+	// Plane of 8-by-8 blocks in a single cache line aligned buffer, block
+	// rows one after the other
 	template <typename T>
-	using Plane = std::vector<std::vector<Block<T>>>;
+	class Plane {
+	private:
+		std::vector<Block<T>, AlignedAllocator<Block<T>, 64>> blocks;
+		INT32 blocksWide;
+		INT32 blocksHigh;
+	public:
+		// View of a row of blocks, indexed by block column
+		Block<T>* operator[](INT32 blockY);
+		const Block<T>* operator[](INT32 blockY) const;
+		// Block by its index in raster order
+		Block<T>& block(INT32 blockIndex);
+		const Block<T>& block(INT32 blockIndex) const;
+		INT32 getBlocksWide() const;
+		INT32 getBlocksHigh() const;
+		// Reshape, keeping the buffer when the number of blocks is unchanged
+		void resize(INT32 blocksWide, INT32 blocksHigh);
+		Plane();
+	};
+
+	// Quantization table and the reciprocals of twice its entries, so that
+	// rounding a coefficient divided by an entry takes a multiply and shift
+	struct Quantizer {
+		Block<UINT8> Table;
+		Block<UINT64> Reciprocals;
+	};
+
+	// Luma and chroma quantizers
+	std::array<Quantizer, 2> quantizers;
 
 	// Keys for each plane
 	enum PlaneKeys {
@@ -45,20 +163,24 @@ private:
 		V = 2
 	};
 
-	// Y, U, and V image planes consisting of 8-by-8 blocks
+	// Y, U, and V image planes consisting of 8-by-8 blocks, U and V
+	// subsampled as sampling says
 	template <typename T>
 	struct YUVPlanes {
 		std::array<Plane<T>, 3> planes;
+		UINT8 sampling;
 		INT32 getWidth() const;
 		INT32 getHeight() const;
-		YUVPlanes(const INT32 width, const INT32 height);
+		UINT8 getSampling() const;
+		// Reshape all planes for an image of the given size, rounded up to
+		// whole blocks
+		void resize(const INT32 width, const INT32 height, const UINT8 sampling);
+		YUVPlanes();
+		YUVPlanes(const INT32 width, const INT32 height, const UINT8 sampling = SAMPLING_444);
 	};
 
 	// Utility functions
 
-	// Function C in DCT
-	DOUBLE C(const UINT8 x);
-
 	// DCT on a 8-by-8 block
 	template <typename T, typename W>
 	Block<W> dctOnBlock(const Block<T>& block);
@@ -67,406 +189,680 @@ private:
 	template <typename T, typename W>
 	Block<W> inverseDCTOnBlock(const Block<T>& block);
 
-	// Quantization on a 8-by-8 block
+	// Quantization on a 8-by-8 block, saturating at the range of W
 	template <typename T, typename W>
-	Block<W> quantizeOnBlock(const Block<T>& block);
+	static Block<W> quantizeOnBlock(const Block<T>& block, const Quantizer& quantizer);
 
 	// Dequantization on a 8-by-8 block
 	template <typename T, typename W>
-	Block<W> dequantizeOnBlock(const Block<T>& block);
-
-	// Compression functions
+	static Block<W> dequantizeOnBlock(const Block<T>& block, const Quantizer& quantizer);
 
-	// Transform bitmap to YUV planes
-	YUVPlanes<INT8> bitmapToYUV(BitmapFile* bitmapFile);
+	// Scale a matrix to a quality from 1 to 100, 50 leaving it as is, the
+	// entries no smaller than MIN_QUANTIZATION
+	static Block<UINT8> scaleTable(const std::array<std::array<INT8, 8>, 8>& matrix, UINT8 quality);
 
-	// Discrete Cosine Transform (DCT) on YUV planes
-	YUVPlanes<INT16> dct(const YUVPlanes<INT8>& yuv);
+	// Precompute the reciprocals of a table
+	static Quantizer makeQuantizer(const Block<UINT8>& table);
 
-	// Quantization on DCT'd YUV planes
-	YUVPlanes<INT8> quantize(const YUVPlanes<INT16>& dct);
+	// Luma and chroma quantizers of a file
+	static std::array<Quantizer, 2> fileQuantizers(const IM3File* im3File);
 
-	// Difference code the DC components and run-length code the AC components
-	std::pair<CodedDC, CodedAC> runLengthDifferenceCoder(const Codec::YUVPlanes<INT8>& quantized);
+	// Run task(i) for every i in [0, count), on the thread pool if any
+	void parallelFor(size_t count, const std::function<void(size_t)>& task);
 
-	// Huffman coding utility types and functions
-	struct SymbolWithCount {
-		INT32 Symbol;
-		UINT32 Count;
-		bool operator>(const SymbolWithCount& a) const {
-			return Count > a.Count;
-		}
-	};
+	// Compression functions
 
-	// Frequency table type
+	// Rows of blocks of each of the Y, U, and V planes
 	template <typename T>
-	using FrequencyTable = std::array<SymbolWithCount, std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1>;
+	using Strip = std::array<std::vector<Block<T>>, 3>;
+
+	// Pixel rows of an image by row from the top, held whole or a batch of
+	// strips at a time
+	struct PixelRows {
+		INT32 Width;
+		INT32 Height;
+		std::function<BitmapFile::Pixel*(INT32)> Row;
+	};
 
-	// Frequency count function
-	template <typename T>
-	FrequencyTable<T> freqCount(const std::vector<T>& symbols);
+	// Difference and run-length codes of one strip
+	struct StripSymbols {
+		std::array<std::vector<INT16>, 3> DCDifferences;
+		std::array<std::vector<std::pair<UINT8, INT16>>, 3> RunLengthCodes;
+		// DC component of the last block of each plane
+		std::array<INT16, 3> LastDC;
+	};
 
-	// Huffman coding of symbols
-	template <typename T>
-	std::pair<LengthTable<T>, std::vector<bool>> huffmanEncode(const std::vector<T>& input);
+	// Transform the pixel rows of a strip of the bitmap to full resolution
+	// YUV, one row of blocks per 8 rows, replicating the right and bottom
+	// edges out to whole blocks and whole chroma blocks
+	void bitmapToYUV(const PixelRows& image, INT32 stripIndex, Strip<INT8>& strip);
+
+	// Box filter the U and V of a full resolution strip down to one row of
+	// chroma blocks
+	void downsample(const Strip<INT8>& strip, Strip<INT8>& chroma);
+
+	// Fancy upsampling of one row of a subsampled plane to the image width,
+	// written as a row of blocks
+	static void upsampleRow(
+		const Plane<INT8>& plane,
+		UINT8 sampling,
+		INT32 y,
+		INT32 width,
+		INT32 height,
+		INT8* output);
+
+	// Difference code the DC component and run-length code the AC components
+	// of a quantized block, writing the difference at dcDifference and up
+	// to MAX_BLOCK_CODES codes from runLengthCodes on. Returns the number
+	// of codes written.
+	static INT32 runLengthDifferenceCodeBlock(
+		const Block<INT16>& block,
+		INT16& lastDCValue,
+		INT16* dcDifference,
+		std::pair<UINT8, INT16>* runLengthCodes);
+
+	// Colour convert, transform, quantize and code one strip of 8 pixel rows,
+	// 16 when chroma is halved vertically, each block going through every
+	// stage while it is in cache
+	void encodeStrip(
+		const PixelRows& image,
+		INT32 stripIndex,
+		Strip<INT8>& strip,
+		Strip<INT8>& chroma,
+		StripSymbols& symbols);
+
+	// Make the first DC difference of each plane of a strip follow the last
+	// DC of the strip above, unless a restart segment starts with it
+	void chainStrip(
+		INT32 blocksWide,
+		INT32 blocksHigh,
+		INT32 stripIndex,
+		const std::array<INT16, 3>& lastDCAbove,
+		StripSymbols& symbols);
+
+	// Encode the bitmap strip by strip into difference and run-length codes
+	std::pair<CodedDC, CodedAC> stripEncoder(BitmapFile* bitmapFile);
+
+	// Extension header of a compressed file with the current settings
+	ExtensionHeader fileExtensionHeader(INT32 width, INT32 height) const;
 
-	// Huffman decoding of symbols
-	template <typename T>
-	std::vector<T> huffmanDecode(
-		const LengthTable<T>& lengthTable,
-		std::vector<bool>& input,
-		size_t numToDecode = std::numeric_limits<size_t>::max());
+	// Huffman coding utility types and functions
 
-	// Entropy coding on run-length difference-encoded AC and DC components
+	// Huffman codes of the DC and the AC symbols of a plane
+	typedef std::array<std::array<HuffmanCode, HUFFMAN_SYMBOLS>, 2> PlaneCodes;
+
+	// Counts of the same symbols
+	typedef std::array<std::array<UINT32, HUFFMAN_SYMBOLS>, 2> PlaneCounts;
+
+	// Huffman codes of each plane
+	typedef std::array<PlaneCodes, 3> StreamCodes;
+
+	// Symbol counts of each plane
+	typedef std::array<PlaneCounts, 3> StreamCounts;
+
+	// Default codes of each set and plane, luma then chroma twice, built
+	// once from the default lengths
+	static const std::array<StreamCodes, NUM_DEFAULT_TABLES> DEFAULT_CODES;
+
+	// Decoders of the DC, AC zeroes and AC values of a plane
+	typedef std::shared_ptr<const std::vector<HuffmanDecoder>> PlaneDecoders;
+
+	// Decoders of the default tables of each set and plane, built once and
+	// shared
+	static const std::array<std::array<PlaneDecoders, 3>, NUM_DEFAULT_TABLES> DEFAULT_DECODERS;
+
+	// Default lengths of a set and plane in the length tables of a plane
+	// header
+	static PlaneHeader defaultPlaneHeader(UINT8 set, UINT8 table);
+
+	// Set of default tables coding at the selected quality
+	UINT8 defaultTables() const;
+
+	// Size in bits of the magnitude of a component or DC difference, 0
+	// for zero
+	static UINT32 magnitudeSize(INT32 value);
+
+	// Low size bits of a value, those of one less when it is negative, as
+	// in JPEG
+	static UINT32 magnitudeBits(INT32 value, UINT32 size);
+
+	// Value of the size bits magnitudeBits gives
+	static INT32 extendMagnitude(UINT32 bits, UINT32 size);
+
+	// Visit the Huffman symbols of the DC difference and the run-length
+	// codes of one block up to its end-of-block, calling
+	// visit(table, symbol, bits, size) with table 0 for the DC and 1 for
+	// the AC, and the size magnitude bits going with the symbol. Returns
+	// the number of codes.
+	template <typename F>
+	static size_t blockSymbols(
+		INT16 dcDifference,
+		const std::pair<UINT8, INT16>* runLengthCodes,
+		const F& visit);
+
+	// Count the Huffman symbols of one block, returning the number of codes
+	static size_t countBlockSymbols(
+		PlaneCounts& counts,
+		INT16 dcDifference,
+		const std::pair<UINT8, INT16>* runLengthCodes);
+
+	// Huffman code one block into the DC, AC zeroes and AC values writers,
+	// returning the number of codes
+	static size_t huffmanCodeBlock(
+		std::array<BitWriter, 3>& writers,
+		const PlaneCodes& codes,
+		INT16 dcDifference,
+		const std::pair<UINT8, INT16>* runLengthCodes);
+
+	// Code lengths and codes of a plane from its symbol counts, the lengths
+	// going into the tables of entropied, and the bytes each of its DC, AC
+	// zeroes and AC values streams take without restart segments
+	static void planeTables(
+		const PlaneCounts& counts,
+		PlaneCodes& codes,
+		std::pair<EntropiedDC, EntropiedAC>& entropied,
+		std::array<UINT64, 3>& streamBytes);
+
+	// Entropy coding on run-length difference-encoded AC and DC components,
+	// filling in the restart segment sizes when restarts are on. The
+	// symbols of each plane are counted for tables of its own when tables
+	// are optimized, else coded with the default ones. Hands over to
+	// arithmeticCoder when arithmetic coding is selected.
 	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> entropyCoder(
 		const CodedDC& codedDC,
-		const CodedAC& codedAC);
+		const CodedAC& codedAC,
+		std::vector<RestartSegment>& restartSegments);
+
+	// Arithmetic coding utility types and functions
+
+	// Classes of the last DC difference keying the DC contexts: zero, or
+	// small or large and positive or negative
+	static const INT32 DC_CLASSES = 5;
+
+	// Classes of the magnitudes of the components left of and above an AC
+	// component keying its contexts, their sum with each at most 2
+	static const INT32 NEIGHBOUR_CLASSES = 5;
+
+	// Zig-zag positions of the low band of AC components, with magnitude
+	// contexts of their own
+	static const INT32 LOW_BAND = 5;
+
+	// Adaptive contexts of the arithmetic coding of one plane, started over
+	// with every restart segment. As in the JPEG arithmetic coder, the DC
+	// difference is keyed by the one before it, and each AC decision by its
+	// zig-zag position or band, and here also by its neighbours.
+	struct ArithmeticContexts {
+		std::array<BitModel, DC_CLASSES> DCNonzero;
+		std::array<BitModel, DC_CLASSES> DCSign;
+		std::array<std::array<BitModel, ARITHMETIC_MAGNITUDE_CATEGORIES>, DC_CLASSES> DCCategories;
+		std::array<BitModel, ARITHMETIC_MAGNITUDE_CATEGORIES> DCBits;
+		std::array<BitModel, 64> EndOfBlock; // By zig-zag position
+		std::array<std::array<BitModel, NEIGHBOUR_CLASSES>, 64> ACNonzero; // By zig-zag position
+		BitModel ACSign;
+		std::array<std::array<std::array<BitModel, ARITHMETIC_MAGNITUDE_CATEGORIES>, NEIGHBOUR_CLASSES>, 2> ACCategories;
+		std::array<std::array<BitModel, ARITHMETIC_MAGNITUDE_CATEGORIES>, 2> ACBits;
+		INT32 DCClass = 0; // Class of the last DC difference
+	};
 
-	// Decompression functions
+	// Magnitudes of the components of a block coded so far, at most 2, by
+	// offset, and a last one for the neighbours outside the block
+	typedef std::array<UINT8, 65> NeighbourMagnitudes;
 
-	// Entropy decoding
-	std::pair<CodedDC, CodedAC> entropyDecoder(
-		const FileHeaderWithTables& fileHeaderWithTables,
-		std::vector<bool>& bitsReadFromFile);
+	// Class of the neighbours of the component at a zig-zag position
+	static INT32 neighbourClass(const NeighbourMagnitudes& magnitudes, INT32 zigZag);
 
-	// Run-length and difference decoding
-	YUVPlanes<INT8> runLengthDifferenceDecoder(
-		const FileHeaderWithTables & fileHeaderWithTables,
-		const std::pair<CodedDC, CodedAC> & runLengthDifferenceCoded);
+	// Arithmetic code the DC difference and the run-length codes of one
+	// block up to its end-of-block, returning the number of codes
+	static size_t arithmeticCodeBlock(
+		ArithmeticEncoder& encoder,
+		ArithmeticContexts& contexts,
+		INT16 dcDifference,
+		const std::pair<UINT8, INT16>* runLengthCodes);
 
-	// Dequantization
-	YUVPlanes<INT16> dequantize(const YUVPlanes<INT8>& quantized);
+	// Arithmetic coding of the run-length difference-coded components,
+	// each plane or restart segment in one stream in place of the DC one
+	std::array<std::pair<EntropiedDC, EntropiedAC>, 3> arithmeticCoder(
+		const CodedDC& codedDC,
+		const CodedAC& codedAC,
+		std::vector<RestartSegment>& restartSegments);
+
+	// Streamed compression functions
+
+	// Output of one plane of a streamed encode
+	struct StreamedPlane {
+		std::array<BitWriter, 3> Writers; // DC, AC zeroes and AC values
+		std::array<UINT64, 3> Cursors; // File offset the next bytes of each stream go to
+		std::vector<RestartSegment> Segments; // Sizes of the restart segments
+		std::array<UINT64, 3> StreamBytes; // Bytes of each stream coded so far without an output
+		std::array<UINT64, 3> SegmentStart; // StreamBytes where the current restart segment starts
+		size_t SegmentsDone; // Restart segments written out
+		INT32 BlocksCoded; // Blocks coded so far
+		INT32 NumBlocks; // Blocks of the plane
+		ArithmeticEncoder Arithmetic; // Stream in place of the DC with arithmetic coding
+		ArithmeticContexts Contexts; // Contexts of the arithmetic coding
+		bool KeepBytes; // Whether the coded bytes are kept when there is no output
+		std::array<std::vector<BYTE>, 3> Bytes; // Coded bytes kept of each stream
+	};
+
+	// Encode an image a batch of strips at a time, a strip per thread,
+	// handing the symbols of the count strips of each batch to consume in
+	// order, each batch consumed while the next one is encoded. Given load,
+	// it is called before each batch to make the rows of the batch readable
+	// through the image, false when they cannot be.
+	BOOL encodeStrips(
+		const PixelRows& image,
+		const std::function<BOOL(INT32 firstRow, INT32 numRows)>& load,
+		const std::function<void(std::vector<StripSymbols>& symbols, INT32 count)>& consume);
+
+	// Encode a bitmap read a batch of strips at a time, as encodeStrips
+	BOOL streamStrips(
+		BitmapReader& reader,
+		const std::function<void(std::vector<StripSymbols>& symbols, INT32 count)>& consume);
+
+	// Entropy code the symbols of count strips. Without an output only the
+	// sizes of the streams and restart segments are recorded, the coded
+	// bytes kept by the planes that keep them, and the planes are coded
+	// concurrently, as are the restart segments starting in the batch. With
+	// one the coded bytes are written at the cursors.
+	BOOL codeStrips(
+		const std::vector<StripSymbols>& symbols,
+		INT32 count,
+		const StreamCodes& codes,
+		std::array<StreamedPlane, 3>& planes,
+		Stream* output);
+
+	// Blocks of one plane of a batch of strips coded in one go
+	struct StripRun {
+		UINT8 Plane;
+		INT32 Strip; // Strip of the batch the run starts in
+		INT32 Block; // Block of that strip the run starts at
+		INT32 NumBlocks;
+	};
+
+	// Fewest blocks a run of restart segments is coded in, fewer not being
+	// worth a task of their own
+	static const INT32 MIN_RUN_BLOCKS = 128;
+
+	// Entropy code a run of blocks into a plane as codeStrips does, holding
+	// nothing but the bits of the last code past its end
+	BOOL codeRun(
+		const std::vector<StripSymbols>& symbols,
+		const StripRun& run,
+		const PlaneCodes& codes,
+		StreamedPlane& plane,
+		Stream* output);
+
+	// Write out the coded bytes of a plane at its cursors
+	static BOOL flushStreams(StreamedPlane& plane, Stream& output);
+
+	// Move the coded bytes of a plane out of its writers, adding them to
+	// its stream sizes and keeping them when it keeps its bytes
+	static void drainStreams(StreamedPlane& plane);
+
+	// Decompression functions
 
-	// Inverse DCT
-	YUVPlanes<INT8> inverseDCT(const YUVPlanes<INT16>& dct);
+	// Huffman decoders for the DC, AC zeroes and AC values of a plane
+	static std::vector<HuffmanDecoder> planeDecoders(const PlaneHeader& planeHeader);
+
+	// Huffman decoders of a plane of a file, the shared ones when it is
+	// coded with the default tables
+	static PlaneDecoders fileDecoders(const IM3File* im3File, UINT8 plane);
+
+	// Planes whose optimized tables keep their decoders for the files
+	// decoded next
+	static const size_t DECODER_CACHE_SIZE = 12;
+
+	// Decoders of a plane header's tables, built only when they are not
+	// among those of the planes decoded last
+	static PlaneDecoders cachedDecoders(const PlaneHeader& planeHeader);
+
+	// DC component of the next block from the last, decoded as the file's
+	// version codes it
+	static INT16 decodeDC(BitReader& dcReader, const HuffmanDecoder& dcDecoder, UINT8 version, INT16 dc);
+
+	// Place the AC components of one block along the zig-zag up to its
+	// end-of-block, the block's AC components being zero. Version 3 files
+	// code them as run and size symbols and magnitude bits, older ones as
+	// the zeroes and value of run-length pairs, one byte each.
+	static void decodeACBlock(
+		BitReader& acZeroesReader,
+		BitReader& acValuesReader,
+		const HuffmanDecoder& acZeroesDecoder,
+		const HuffmanDecoder& acValuesDecoder,
+		UINT8 version,
+		Block<INT16>& block);
+
+	// Arithmetic decode one block, adding its DC difference to dc, the
+	// block's components being zero
+	static void arithmeticDecodeBlock(
+		ArithmeticDecoder& decoder,
+		ArithmeticContexts& contexts,
+		INT16& dc,
+		Block<INT16>& block);
+
+	// First and past-the-last block column and row of a plane
+	struct BlockWindow {
+		INT32 Left;
+		INT32 Top;
+		INT32 Right;
+		INT32 Bottom;
+	};
+
+	// Window of each plane
+	typedef std::array<BlockWindow, 3> BlockWindows;
+
+	// The blocks of a plane of the image as a decoder reaches them, those
+	// in the window going to a plane of the window alone and the rest to a
+	// scratch block, their codes being read all the same
+	class WindowedPlane {
+	private:
+		Plane<INT16>& plane;
+		INT32 blocksWide;
+		BlockWindow window;
+		Block<INT16> scratch;
+	public:
+		// Block by its index in raster order of the image plane
+		Block<INT16>& block(INT32 blockIndex);
+		WindowedPlane(Plane<INT16>& plane, INT32 blocksWide, const BlockWindow& window);
+	};
 
-	// YUV to bitmap
-	//YUVPlanes<INT8> bitmapToYUV(BitmapFile* bitmapFile)
-	BitmapFile* YUVToBitmap(const YUVPlanes<INT8>& yuv);
+	// Windows of the planes of a file, the whole planes without windows,
+	// and planes of zeroes sized to them
+	static BlockWindows fileWindows(const IM3File* im3File, const BlockWindows* windows);
+	static YUVPlanes<INT16> windowPlanes(const BlockWindows& windows, UINT8 sampling);
+
+	// Arithmetic decode the blocks of a plane from first to past-the-last
+	// from one stream, returning the bytes it took. The blocks after any
+	// end of the stream are left zero.
+	static size_t arithmeticDecodeBlocks(
+		const BYTE* data,
+		size_t size,
+		WindowedPlane& plane,
+		INT32 firstBlock,
+		INT32 lastBlock);
+
+	// Entropy, run-length and difference decoding of a file without restart
+	// segments, plane after plane, each code going straight into its block.
+	// Given windows, the planes hold those blocks alone.
+	YUVPlanes<INT16> entropyDecoder(const IM3File* im3File, const BlockWindows* windows = NULL);
+
+	// Entropy, run-length and difference decoding of a file with restart
+	// segments, the segments decoded concurrently. Given windows, the planes
+	// hold those blocks alone and only the segments with rows of them are
+	// decoded.
+	YUVPlanes<INT16> restartDecoder(const IM3File* im3File, const BlockWindows* windows = NULL);
+
+	// Dequantization into reused planes, which may be the quantized ones
+	void dequantize(
+		const YUVPlanes<INT16>& quantized,
+		const std::array<Quantizer, 2>& planeQuantizers,
+		YUVPlanes<INT16>& output);
+
+	// Inverse DCT into reused planes
+	void inverseDCT(const YUVPlanes<INT16>& dct, YUVPlanes<INT8>& output);
+
+	// Dequantize and inverse transform the planes of a window decoded alone.
+	// Every block gives its top-left size-by-size samples, reduced for a
+	// size under 8.
+	void windowInverseDCT(
+		const YUVPlanes<INT16>& quantized,
+		const std::array<Quantizer, 2>& planeQuantizers,
+		UINT8 size,
+		YUVPlanes<INT8>& output);
+
+	// YUV to a bitmap width by height pixels in size, upsampling
+	// subsampled chroma and cropping the padding of the edge blocks
+	BitmapFile* YUVToBitmap(const YUVPlanes<INT8>& yuv, INT32 width, INT32 height);
+
+	// The benchmarks time the stages one by one
+	friend class Benchmark;
 
 public:
-	// Compress a bitmap
+	// Compress a bitmap. With the default tables or arithmetic coding the
+	// strips are coded as they are encoded, else the symbols of the whole
+	// image are gathered for its tables first.
 	IM3File* compress(BitmapFile* bitmapFile);
+	// Compress a bitmap file into an IM3 file a few strips at a time, so that
+	// memory use does not grow with the image. The bitmap is read twice to
+	// size the streams before anything is written, three times when
+	// optimized tables and restart segments both need a pass. Result is set
+	// as reading the bitmap went.
+	BOOL compressStream(Stream& bitmapStream, Stream& im3Stream, BitmapFile::CreateResult* result);
 	// Decompress an IM3
 	BitmapFile* decompress(IM3File* im3File);
+	// Decompress the part of an IM3 within a rectangle of the image, scaled
+	// down by 1, 2, 4 or 8 with reduced inverse DCTs. Only the blocks the
+	// rectangle needs are transformed, and with restart segments only the
+	// segments holding them are decoded.
+	BitmapFile* decompressRegion(
+		IM3File* im3File,
+		INT32 left,
+		INT32 top,
+		INT32 width,
+		INT32 height,
+		UINT8 scale);
+	// Select the forward DCT implementation
+	void setDCTEngine(DCT::Engine engine);
+	// Select the inverse DCT implementation
+	void setInverseDCTEngine(DCT::InverseEngine engine);
+	// Select the colour conversion kernel
+	void setColorKernel(ColorConvert::Kernel kernel);
+	// Number of threads to work with, 1 for serial and 0 for one per core
+	void setThreadCount(UINT32 numThreads);
+	// Blocks per restart segment in compressed files, 0 to leave them out
+	void setRestartInterval(UINT16 blocks);
+	// Chroma sampling of compressed files
+	void setSampling(Sampling sampling);
+	// Quality of compressed files from 1 to 100, scaling separate luma and
+	// chroma tables stored in the file. 0 quantizes every plane with the
+	// fixed matrix and stores no tables.
+	void setQuality(UINT8 quality);
+	// Entropy coding of compressed files, Huffman unless arithmetic coding
+	// is asked for. Arithmetic coding takes fewer bytes but codes and
+	// decodes more slowly.
+	void setEntropyCoding(EntropyCoding coding);
+	// Whether compressed files get Huffman tables built for them, taking
+	// a pass over their symbols, rather than the built-in default ones.
+	// Optimized tables take fewer bytes on all but small images, whose
+	// files are smaller without tables of their own.
+	void setOptimizeTables(bool optimize);
 	Codec();
 };
 
-template<typename T>
-inline std::pair<LengthTable<T>, std::vector<bool>> Codec::huffmanEncode(const std::vector<T>& input)
-{
-	// Typedef for Symbol
-	typedef INT32 Symbol;
-	// Constants
-	static const Symbol FIRST_PARENT = std::numeric_limits<T>::max() + 1;
-	static const Symbol PARENT_STEP = 1;
-	static const Symbol NO_CHILD = std::numeric_limits<T>::min() - 1;
-	static const Symbol NO_PARENT = std::numeric_limits<T>::min() - 1;
-	// Build the frequency table
-	FrequencyTable<T> freqTable = freqCount<T>(input);
-	// Sort the frequency table
-	std::priority_queue<
-		SymbolWithCount,
-		std::vector<SymbolWithCount>,
-		std::greater<SymbolWithCount>>
-		sorted(freqTable.begin(), freqTable.end());
-	// Setup the Huffman tree
-	// Node
-	struct Node {
-		Symbol Parent;
-		Symbol Left;
-		Symbol Right;
-	};
-	// Map to store the tree
-	std::map<Symbol, Node> tree;
-	Symbol parentSymbol = FIRST_PARENT;
-	while (sorted.size() > 1) {
-		// Get and remove the two lowest frequency symbols
-		SymbolWithCount a = sorted.top();
-		sorted.pop();
-		SymbolWithCount b = sorted.top();
-		sorted.pop();
-		// Create a parent node
-		SymbolWithCount parent = { parentSymbol, a.Count + b.Count };
-		// Put the parent node back
-		sorted.push(parent);
-		// Add the parent to the tree
-		tree.insert(std::pair<Symbol, Node>(parentSymbol, { NO_PARENT, a.Symbol, b.Symbol }));
-		// Add the children to the tree
-		if (tree.find(a.Symbol) == tree.end()) {
-			tree.insert(std::pair<Symbol, Node>(a.Symbol, { parentSymbol, NO_CHILD, NO_CHILD }));
-		}
-		else {
-			tree[a.Symbol].Parent = parentSymbol;
-		}
-		if (tree.find(b.Symbol) == tree.end()) {
-			tree.insert(std::pair<Symbol, Node>(b.Symbol, { parentSymbol, NO_CHILD, NO_CHILD }));
-		}
-		else {
-			tree[b.Symbol].Parent = parentSymbol;
-		}
-		parentSymbol += PARENT_STEP;
-	}
-	// The root node is the last parent
-	Symbol root = parentSymbol - PARENT_STEP;
-	// Set up the table for storing sorted code lengths
-	std::array<
-		std::pair<UINT8, T>,
-		std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1> sortedLengths;
-	// Additionally generate a symbol bit length table
-	LengthTable<T> lengths;
-	// Store the code lengths
-	for (Symbol i = std::numeric_limits<T>::min();
-		i <= std::numeric_limits<T>::max();
-		i++) {
-		auto it = tree.find(i);
-		Symbol symbol = it->first;
-		Node node = tree[symbol];
-		UINT8 length = 0;
-		while (symbol != root) {
-			Symbol nextSymbol = node.Parent;
-			Node nextNode = tree[nextSymbol];
-			length += 1;
-			symbol = nextSymbol;
-			node = nextNode;
-		}
-		INT32 index = i - std::numeric_limits<T>::min();
-		lengths[index] = length;
-		sortedLengths[index] = { length, static_cast<T>(i) };
-	}
-	// Sort the code lengths
-	std::sort(sortedLengths.begin(), sortedLengths.end());
-	// Set up the canonical code table
-	std::array<
-		std::pair<std::vector<bool>, T>,
-		std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1> canonicalCodes;
-	// Assign canonical codes
-	canonicalCodes[0] = { std::vector<bool>(sortedLengths[0].first, false), sortedLengths[0].second };
-	for (INT32 i = 1; i < canonicalCodes.size(); i++) {
-		// Increment from the previous code for the next code
-		std::vector<bool> code = canonicalCodes[i - 1].first;
-		UINT8 bitIndex;
-		for (bitIndex = static_cast<UINT8>(code.size() - 1); bitIndex >= 0; bitIndex--) {
-			if (code[bitIndex]) {
-				code[bitIndex] = false;
-			} else {
-				break;
-			}
-		}
-		code[bitIndex] = true;
-		// If the code length increases, append zeroes
-		UINT8 length = sortedLengths[i].first;
-		while (code.size() != length) {
-			code.push_back(false);
-		}
-		canonicalCodes[i] = { code, sortedLengths[i].second };
-	}
-	// Build an easier to traverse code table
-	std::array<
-		std::vector<bool>,
-		std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1> codes;
-	for (Symbol i = std::numeric_limits<T>::min();
-		i <= std::numeric_limits<T>::max();
-		i++) {
-		INT32 index = i - std::numeric_limits<T>::min();
-		auto result = std::find_if(
-			canonicalCodes.begin(),
-			canonicalCodes.end(),
-			[i](const std::pair<std::vector<bool>, T>& entry) {
-				return entry.second == static_cast<T>(i);
-			});
-		codes[index] = result->first;
-	}
-	// Compress the data
-	std::vector<bool> compressed;
-	for (auto it = input.begin(); it != input.end(); it++) {
-		INT32 index = (*it) - std::numeric_limits<T>::min();
-		std::vector<bool> code = codes[index];
-		compressed.insert(compressed.end(), code.begin(), code.end());
-	}
-	return std::pair<LengthTable<T>, std::vector<bool>>(lengths, compressed);
-}
-
-template<typename T>
-inline std::vector<T> Codec::huffmanDecode(
-	const LengthTable<T>& lengthTable,
-	std::vector<bool>& input,
-	size_t numToDecode)
-{
-	// Typedef for Symbol
-	typedef INT32 Symbol;
-	// Set up the table for storing sorted code lengths
-	std::array<
-		std::pair<UINT8, T>,
-		std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1> sortedLengths;
-	// Generate the sorted symbol bit length table
-	for (Symbol i = std::numeric_limits<T>::min();
-		i <= std::numeric_limits<T>::max();
-		i++) {
-		INT32 index = i - std::numeric_limits<T>::min();
-		sortedLengths[index] = { lengthTable[index], static_cast<T>(i) };
-	}
-	// Sort the code lengths
-	std::sort(sortedLengths.begin(), sortedLengths.end());
-	// Set up the canonical code table
-	std::array<
-		std::pair<std::vector<bool>, T>,
-		std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1> canonicalCodes;
-	// Assign canonical codes
-	canonicalCodes[0] = { std::vector<bool>(sortedLengths[0].first, false), sortedLengths[0].second };
-	for (INT32 i = 1; i < canonicalCodes.size(); i++) {
-		// Increment from the previous code for the next code
-		std::vector<bool> code = canonicalCodes[i - 1].first;
-		UINT8 bitIndex;
-		for (bitIndex = static_cast<UINT8>(code.size() - 1); bitIndex >= 0; bitIndex--) {
-			if (code[bitIndex]) {
-				code[bitIndex] = false;
-			}
-			else {
-				break;
-			}
-		}
-		code[bitIndex] = true;
-		// If the code length increases, append zeroes
-		UINT8 length = sortedLengths[i].first;
-		while (code.size() != length) {
-			code.push_back(false);
-		}
-		canonicalCodes[i] = { code, sortedLengths[i].second };
-	}
-	// Decompress the data
-	size_t bitsRead = 0;
-	std::vector<bool> buffer;
-	std::vector<T> decompressed;
-	for (auto it = input.begin(); it != input.end(); it++) {
-		buffer.push_back(*it);
-		bitsRead += 1;
-		auto result = std::find_if(
-			canonicalCodes.begin(),
-			canonicalCodes.end(),
-			[buffer](const std::pair<std::vector<bool>, T>& entry) {
-				return entry.first == buffer;
-			});
-		if (result != canonicalCodes.end()) {
-			decompressed.push_back(result->second);
-			buffer.clear();
-			if (decompressed.size() == numToDecode) {
-				break;
-			}
-		}
-	}
-	// Consume the bits read up to the next byte boundary
-	size_t remainder = bitsRead % 8;
-	bitsRead = remainder == 0 ? bitsRead : bitsRead + 8 - remainder;
-	input.erase(input.begin(), input.begin() + bitsRead);
-	return decompressed;
-}
-
 template<typename T, typename W>
 inline Codec::Block<W> Codec::dctOnBlock(const Block<T>& block) {
-	Block<W> output;
-	for (UINT8 v = 0; v < 8; v++) {
-		for (UINT8 u = 0; u < 8; u++) {
-			DOUBLE sum = 0.0;
-			for (UINT8 j = 0; j < 8; j++) {
-				for (UINT8 i = 0; i < 8; i++) {
-					sum += cos((2 * i + 1) * u * M_PI / 16)
-						* cos((2 * j + 1) * v * M_PI / 16)
-						* block[j][i];
-				}
-			}
-			DOUBLE val = C(u) * C(v) * sum / 4.0;
-			W F = static_cast<W>(round(val));
-			output[v][u] = F;
-		}
-	}
-	return output;
+	return DCT::forward<T, W>(dctEngine, block);
 }
 
 template<typename T, typename W>
 inline Codec::Block<W> Codec::inverseDCTOnBlock(const Block<T>& block)
 {
-	Block<W> output;
-	for (UINT8 j = 0; j < 8; j++) {
-		for (UINT8 i = 0; i < 8; i++) {
-			DOUBLE sum = 0.0;
-			for (UINT8 v = 0; v < 8; v++) {
-				for (UINT8 u = 0; u < 8; u++) {
-					sum += C(u) * C(v) / 4.0
-						* cos((2 * i + 1) * u * M_PI / 16)
-						* cos((2 * j + 1) * v * M_PI / 16)
-						* block[v][u];
-				}
-			}
-			W f = static_cast<W>(round(ClampToRange<double>(sum, -128.0, 127.0)));
-			output[j][i] = f;
-		}
-	}
-	return output;
+	return DCT::inverse<T, W>(inverseDCTEngine, block);
 }
 
 template<typename T, typename W>
-inline Codec::Block<W> Codec::quantizeOnBlock(const Block<T>& block)
+inline Codec::Block<W> Codec::quantizeOnBlock(const Block<T>& block, const Quantizer& quantizer)
 {
+	static const UINT64 LIMIT = static_cast<UINT64>(std::numeric_limits<W>::max());
 	Block<W> output;
 	for (UINT8 i = 0; i < 8; i++) {
 		for (UINT8 j = 0; j < 8; j++) {
-			DOUBLE val = static_cast<DOUBLE>(block[i][j]) /
-				static_cast<DOUBLE>(Q[i][j]);
-			output[i][j] = static_cast<W>(round(val));
+			// Rounds half away from zero: (2|x| + q) / 2q, exactly
+			INT32 value = block[i][j];
+			UINT64 magnitude = static_cast<UINT64>(value < 0 ? -value : value);
+			UINT64 rounded = ((2 * magnitude + quantizer.Table[i][j]) *
+				quantizer.Reciprocals[i][j]) >> RECIPROCAL_SHIFT;
+			W quantized = static_cast<W>(std::min(rounded, LIMIT));
+			output[i][j] = static_cast<W>(value < 0 ? -quantized : quantized);
 		}
 	}
 	return output;
 }
 
 template<typename T, typename W>
-inline Codec::Block<W> Codec::dequantizeOnBlock(const Block<T>& block)
+inline Codec::Block<W> Codec::dequantizeOnBlock(const Block<T>& block, const Quantizer& quantizer)
 {
 	Block<W> output;
 	for (UINT8 i = 0; i < 8; i++) {
 		for (UINT8 j = 0; j < 8; j++) {
-			output[i][j] = static_cast<W>(block[i][j]) * Q[i][j];
+			output[i][j] = static_cast<W>(block[i][j] * quantizer.Table[i][j]);
 		}
 	}
 	return output;
 }
 
-template<typename T>
-inline Codec::FrequencyTable<T>
-Codec::freqCount(const std::vector<T>& symbols)
+inline UINT32 Codec::magnitudeSize(INT32 value)
 {
-	FrequencyTable<T> table;
-	T symbol = std::numeric_limits<T>::min();
-	for (auto it = table.begin(); it != table.end(); it++) {
-		it->Symbol = symbol;
-		it->Count = 0;
-		symbol += 1;
-	}
-	for (auto it = symbols.begin(); it != symbols.end(); it++) {
-		table[(*it) - std::numeric_limits<T>::min()].Count += 1;
+	UINT32 magnitude = static_cast<UINT32>(value < 0 ? -value : value);
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse(&index, magnitude) ? static_cast<UINT32>(index) + 1 : 0;
+#else
+	return magnitude == 0 ? 0 : 32 - __builtin_clz(magnitude);
+#endif
+}
+
+inline UINT32 Codec::magnitudeBits(INT32 value, UINT32 size)
+{
+	return static_cast<UINT32>(value - static_cast<INT32>(value < 0)) & ((1u << size) - 1);
+}
+
+inline INT32 Codec::extendMagnitude(UINT32 bits, UINT32 size)
+{
+	// A clear top bit marks a negative value, found without a branch that
+	// would mispredict on every other component
+	UINT32 range = (1u << size) - 1;
+	UINT32 negative = 0u - static_cast<UINT32>(bits <= (range >> 1));
+	return static_cast<INT32>(bits - (negative & range));
+}
+
+template<typename F>
+inline size_t Codec::blockSymbols(
+	INT16 dcDifference,
+	const std::pair<UINT8, INT16>* runLengthCodes,
+	const F& visit)
+{
+	UINT32 size = magnitudeSize(dcDifference);
+	visit(0, size, magnitudeBits(dcDifference, size), size);
+	INT32 zigZag = 1;
+	for (size_t next = 0;; next++) {
+		const std::pair<UINT8, INT16>& code = runLengthCodes[next];
+		if (code.second == 0) {
+			// The end-of-block after the last component goes without saying
+			if (zigZag < 64) {
+				visit(1, END_OF_BLOCK_SYMBOL, 0, 0);
+			}
+			return next + 1;
+		}
+		UINT32 zeroes = code.first;
+		for (; zeroes >= 16; zeroes -= 16) {
+			visit(1, ZERO_RUN_SYMBOL, 0, 0);
+		}
+		size = magnitudeSize(code.second);
+		visit(1, (zeroes << 4) | size, magnitudeBits(code.second, size), size);
+		zigZag += code.first + 1;
 	}
-	return table;
+}
+
+template<typename T>
+inline Codec::Block<T>* Codec::Plane<T>::operator[](INT32 blockY)
+{
+	return blocks.data() + static_cast<size_t>(blockY) * blocksWide;
+}
+
+template<typename T>
+inline const Codec::Block<T>* Codec::Plane<T>::operator[](INT32 blockY) const
+{
+	return blocks.data() + static_cast<size_t>(blockY) * blocksWide;
+}
+
+template<typename T>
+inline Codec::Block<T>& Codec::Plane<T>::block(INT32 blockIndex)
+{
+	return blocks[blockIndex];
+}
+
+template<typename T>
+inline const Codec::Block<T>& Codec::Plane<T>::block(INT32 blockIndex) const
+{
+	return blocks[blockIndex];
+}
+
+template<typename T>
+inline INT32 Codec::Plane<T>::getBlocksWide() const
+{
+	return blocksWide;
+}
+
+template<typename T>
+inline INT32 Codec::Plane<T>::getBlocksHigh() const
+{
+	return blocksHigh;
+}
+
+template<typename T>
+inline void Codec::Plane<T>::resize(INT32 blocksWide, INT32 blocksHigh)
+{
+	this->blocksWide = blocksWide;
+	this->blocksHigh = blocksHigh;
+	blocks.resize(static_cast<size_t>(blocksWide) * blocksHigh);
+}
+
+template<typename T>
+inline Codec::Plane<T>::Plane() : blocksWide(0), blocksHigh(0)
+{
 }
 
 template<typename T>
 inline INT32 Codec::YUVPlanes<T>::getWidth() const
 {
-	return static_cast<INT32>(planes[0][0].size() * 8);
+	return planes[0].getBlocksWide() * 8;
 }
 
 template<typename T>
 inline INT32 Codec::YUVPlanes<T>::getHeight() const
 {
-	return static_cast<INT32>(planes[0].size() * 8);
+	return planes[0].getBlocksHigh() * 8;
 }
 
 template<typename T>
-inline Codec::YUVPlanes<T>::YUVPlanes(const INT32 width, const INT32 height)
+inline UINT8 Codec::YUVPlanes<T>::getSampling() const
 {
+	return sampling;
+}
+
+template<typename T>
+inline void Codec::YUVPlanes<T>::resize(const INT32 width, const INT32 height, const UINT8 sampling)
+{
+	this->sampling = sampling;
 	for (UINT8 i = 0; i < 3; i++) {
-		planes[i].resize(height / 8);
-		for (INT32 j = 0; j < height / 8; j++) {
-			planes[i][j].resize(width / 8);
-		}
+		std::pair<INT32, INT32> blocks = planeBlocks(sampling, i, blocksCovering(width), blocksCovering(height));
+		planes[i].resize(blocks.first, blocks.second);
+	}
+}
+
+template<typename T>
+inline Codec::YUVPlanes<T>::YUVPlanes() : sampling(SAMPLING_444)
+{
+}
+
+template<typename T>
+inline Codec::YUVPlanes<T>::YUVPlanes(const INT32 width, const INT32 height, const UINT8 sampling)
+{
+	resize(width, height, sampling);
+}
+
+inline Codec::Block<INT16>& Codec::WindowedPlane::block(INT32 blockIndex)
+{
+	INT32 blockY = blockIndex / blocksWide;
+	INT32 blockX = blockIndex - blockY * blocksWide;
+	if (blockY < window.Top || blockY >= window.Bottom || blockX < window.Left || blockX >= window.Right) {
+		return scratch;
 	}
+	return plane[blockY - window.Top][blockX - window.Left];
+}
+
+inline Codec::WindowedPlane::WindowedPlane(Plane<INT16>& plane, INT32 blocksWide, const BlockWindow& window) :
+	plane(plane), blocksWide(blocksWide), window(window)
+{
 }
@@ -0,0 +1,520 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "ColorConvert.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IM3_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IM3_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define IM3_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+	// Fixed-point precision of the coefficients
+	const INT32 SHIFT = 14;
+
+	// RGB to YUV coefficients, scaled by 2^SHIFT
+	const INT16 Y_R = 4899, Y_G = 9617, Y_B = 1868;
+	const INT16 U_R = -2765, U_G = -5427, U_B = 8192;
+	const INT16 V_R = 8192, V_G = -6860, V_B = -1332;
+	// Level shift of Y by -128, and of U and V by 127.5 - 128
+	const INT32 Y_OFFSET = -128 * (1 << SHIFT);
+	const INT32 UV_OFFSET = -(1 << (SHIFT - 1));
+
+	// YUV to RGB coefficients, scaled by 2^SHIFT
+	const INT16 ONE = 1 << SHIFT;
+	const INT16 R_V = 22971;
+	const INT16 G_U = -5638, G_V = -11700;
+	const INT16 B_U = 29032;
+	// Centring of U and V on 127.5 rather than 128
+	const INT32 R_OFFSET = 11485;
+	const INT32 G_OFFSET = -8669;
+	const INT32 B_OFFSET = 14516;
+
+	// Shift out the fraction rounding toward zero, as casting a double does
+	inline INT32 truncateShift(INT32 x) {
+		return (x + ((x >> 31) & ((1 << SHIFT) - 1))) >> SHIFT;
+	}
+
+	inline BYTE clampToByte(INT32 x) {
+		return static_cast<BYTE>(std::max(0, std::min(x, 255)));
+	}
+
+	inline DOUBLE clampToUnit(DOUBLE x) {
+		return std::max(0.0, std::min(x, 1.0));
+	}
+
+#ifdef IM3_X86
+	// Pair of 16-bit coefficients for _mm_madd_epi16, low one first
+	inline INT32 coefficientPair(INT16 low, INT16 high) {
+		return static_cast<INT32>((static_cast<UINT32>(static_cast<UINT16>(high)) << 16) | static_cast<UINT16>(low));
+	}
+
+	inline __m128i truncateShift(__m128i x) {
+		__m128i bias = _mm_and_si128(_mm_srai_epi32(x, 31), _mm_set1_epi32((1 << SHIFT) - 1));
+		return _mm_srai_epi32(_mm_add_epi32(x, bias), SHIFT);
+	}
+
+	// One of Y, U, or V of 8 pixels from their (B, R) and (G, x) pairs
+	inline __m128i sse2Component(
+		__m128i brLow, __m128i brHigh, __m128i gLow, __m128i gHigh,
+		INT16 cR, INT16 cG, INT16 cB, INT32 offset)
+	{
+		__m128i br = _mm_set1_epi32(coefficientPair(cB, cR));
+		__m128i g = _mm_set1_epi32(coefficientPair(cG, 0));
+		__m128i o = _mm_set1_epi32(offset);
+		__m128i low = truncateShift(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(brLow, br), _mm_madd_epi16(gLow, g)), o));
+		__m128i high = truncateShift(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(brHigh, br), _mm_madd_epi16(gHigh, g)), o));
+		return _mm_packs_epi32(low, high);
+	}
+
+	// The 4 pixels at byte offsets 0, 3, 6 and 9 of a register, one per
+	// 32-bit lane as (B, G, R, x)
+	inline __m128i sse2Pixels(__m128i bytes) {
+		__m128i first = _mm_unpacklo_epi32(bytes, _mm_srli_si128(bytes, 3));
+		__m128i second = _mm_unpacklo_epi32(_mm_srli_si128(bytes, 6), _mm_srli_si128(bytes, 9));
+		return _mm_unpacklo_epi64(first, second);
+	}
+
+	// 4 pixels of (B, G, R, 0) lanes packed into the low 12 bytes
+	inline __m128i sse2PackPixels(__m128i lanes) {
+		__m128i pairs = _mm_or_si128(
+			_mm_and_si128(lanes, _mm_set_epi32(0, -1, 0, -1)),
+			_mm_slli_epi64(_mm_srli_epi64(lanes, 32), 24));
+		return _mm_or_si128(
+			_mm_and_si128(pairs, _mm_set_epi32(0, 0, -1, -1)),
+			_mm_slli_si128(_mm_srli_si128(pairs, 8), 6));
+	}
+
+	// One of R, G, or B of 8 pixels from two interleaved pairs of samples
+	inline __m128i sse2Channel(
+		__m128i pLow, __m128i pHigh, __m128i qLow, __m128i qHigh,
+		INT32 pCoefficients, INT32 qCoefficients, INT32 offset)
+	{
+		__m128i p = _mm_set1_epi32(pCoefficients);
+		__m128i q = _mm_set1_epi32(qCoefficients);
+		__m128i o = _mm_set1_epi32(offset);
+		__m128i low = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(pLow, p), _mm_madd_epi16(qLow, q)), o), SHIFT);
+		__m128i high = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(pHigh, p), _mm_madd_epi16(qHigh, q)), o), SHIFT);
+		return _mm_packs_epi32(low, high);
+	}
+
+	// 8 signed bytes widened to 16 bits
+	inline __m128i loadSamples(const INT8* samples) {
+		__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(samples));
+		return _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+	}
+
+	IM3_TARGET_AVX2 inline __m256i truncateShift(__m256i x) {
+		__m256i bias = _mm256_and_si256(_mm256_srai_epi32(x, 31), _mm256_set1_epi32((1 << SHIFT) - 1));
+		return _mm256_srai_epi32(_mm256_add_epi32(x, bias), SHIFT);
+	}
+
+	IM3_TARGET_AVX2 inline __m256i avx2Component(
+		__m256i brLow, __m256i brHigh, __m256i gLow, __m256i gHigh,
+		INT16 cR, INT16 cG, INT16 cB, INT32 offset)
+	{
+		__m256i br = _mm256_set1_epi32(coefficientPair(cB, cR));
+		__m256i g = _mm256_set1_epi32(coefficientPair(cG, 0));
+		__m256i o = _mm256_set1_epi32(offset);
+		__m256i low = truncateShift(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(brLow, br), _mm256_madd_epi16(gLow, g)), o));
+		__m256i high = truncateShift(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(brHigh, br), _mm256_madd_epi16(gHigh, g)), o));
+		// Packing within each 128-bit lane keeps the pixels in order
+		return _mm256_packs_epi32(low, high);
+	}
+
+	// 4 pixels of each 128-bit lane, from 12 of its bytes starting at
+	// first, one per 32-bit lane as (B, G, R, 0)
+	IM3_TARGET_AVX2 inline __m256i avx2Pixels(const BYTE* low, const BYTE* high, INT8 first) {
+		__m256i bytes = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(low))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(high)), 1);
+		const INT8 z = -128;
+		__m256i split = _mm256_setr_epi8(
+			first, first + 1, first + 2, z, first + 3, first + 4, first + 5, z,
+			first + 6, first + 7, first + 8, z, first + 9, first + 10, first + 11, z,
+			first, first + 1, first + 2, z, first + 3, first + 4, first + 5, z,
+			first + 6, first + 7, first + 8, z, first + 9, first + 10, first + 11, z);
+		return _mm256_shuffle_epi8(bytes, split);
+	}
+
+	IM3_TARGET_AVX2 inline __m256i avx2Channel(
+		__m256i pLow, __m256i pHigh, __m256i qLow, __m256i qHigh,
+		INT32 pCoefficients, INT32 qCoefficients, INT32 offset)
+	{
+		__m256i p = _mm256_set1_epi32(pCoefficients);
+		__m256i q = _mm256_set1_epi32(qCoefficients);
+		__m256i o = _mm256_set1_epi32(offset);
+		__m256i low = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(pLow, p), _mm256_madd_epi16(qLow, q)), o), SHIFT);
+		__m256i high = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(pHigh, p), _mm256_madd_epi16(qHigh, q)), o), SHIFT);
+		return _mm256_packs_epi32(low, high);
+	}
+
+	// Two block rows of 8 signed bytes widened to 16 bits
+	IM3_TARGET_AVX2 inline __m256i loadSamples(const INT8* first, const INT8* second) {
+		return _mm256_cvtepi8_epi16(_mm_unpacklo_epi64(
+			_mm_loadl_epi64(reinterpret_cast<const __m128i*>(first)),
+			_mm_loadl_epi64(reinterpret_cast<const __m128i*>(second))));
+	}
+
+	// Store 8 bytes of each 128-bit lane into two block rows
+	IM3_TARGET_AVX2 inline void storeSamples(__m256i bytes, INT8* first, INT8* second) {
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(first), _mm256_castsi256_si128(bytes));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(second), _mm256_extracti128_si256(bytes, 1));
+	}
+
+	void cpuid(INT32 leaf, UINT32 registers[4]) {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, leaf, 0);
+		for (UINT8 i = 0; i < 4; i++) {
+			registers[i] = static_cast<UINT32>(info[i]);
+		}
+#else
+		__cpuid_count(leaf, 0, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	}
+
+	// Register state the operating system saves on context switches
+	UINT64 enabledStates() {
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		UINT32 low, high;
+		__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return (static_cast<UINT64>(high) << 32) | low;
+#endif
+	}
+#endif
+}
+
+const char* ColorConvert::kernelName(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case SCALAR:
+		return "scalar";
+	case SSE2:
+		return "sse2";
+	case AVX2:
+		return "avx2";
+	case REFERENCE:
+	default:
+		return "reference";
+	}
+}
+
+bool ColorConvert::supported(Kernel kernel)
+{
+#ifdef IM3_X86
+	static const bool sse2 = []() {
+		UINT32 registers[4];
+		cpuid(1, registers);
+		return (registers[3] & (1 << 26)) != 0;
+	}();
+	static const bool avx2 = []() {
+		UINT32 registers[4];
+		cpuid(0, registers);
+		if (registers[0] < 7) {
+			return false;
+		}
+		// AVX2 needs the OS to save the YMM registers
+		cpuid(1, registers);
+		bool osxsave = (registers[2] & (1 << 27)) != 0;
+		bool avx = (registers[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || (enabledStates() & 6) != 6) {
+			return false;
+		}
+		cpuid(7, registers);
+		return (registers[1] & (1 << 5)) != 0;
+	}();
+#else
+	static const bool sse2 = false;
+	static const bool avx2 = false;
+#endif
+	switch (kernel)
+	{
+	case SSE2:
+		return sse2;
+	case AVX2:
+		return avx2;
+	case REFERENCE:
+	case SCALAR:
+	default:
+		return true;
+	}
+}
+
+ColorConvert::Kernel ColorConvert::bestKernel()
+{
+	// Wider kernels measure faster both ways, im3cli bench comparing them
+	if (supported(AVX2)) {
+		return AVX2;
+	}
+	if (supported(SSE2)) {
+		return SSE2;
+	}
+	return SCALAR;
+}
+
+void ColorConvert::rgbToYUV(
+	Kernel kernel,
+	const BitmapFile::Pixel* pixels,
+	INT32 count,
+	INT8* y,
+	INT8* u,
+	INT8* v)
+{
+	if (kernel == REFERENCE) {
+		referenceRGBToYUV(pixels, 0, count, y, u, v);
+		return;
+	}
+	// Vector kernels leave the pixels past their last full vector
+	INT32 done = 0;
+	if (kernel == AVX2 && supported(AVX2)) {
+		done = avx2RGBToYUV(pixels, count, y, u, v);
+	}
+	else if (kernel >= SSE2 && supported(SSE2)) {
+		done = sse2RGBToYUV(pixels, count, y, u, v);
+	}
+	scalarRGBToYUV(pixels, done, count, y, u, v);
+}
+
+void ColorConvert::yuvToRGB(
+	Kernel kernel,
+	const INT8* y,
+	const INT8* u,
+	const INT8* v,
+	INT32 count,
+	BitmapFile::Pixel* pixels)
+{
+	if (kernel == REFERENCE) {
+		referenceYUVToRGB(y, u, v, 0, count, pixels);
+		return;
+	}
+	INT32 done = 0;
+	if (kernel == AVX2 && supported(AVX2)) {
+		done = avx2YUVToRGB(y, u, v, count, pixels);
+	}
+	else if (kernel >= SSE2 && supported(SSE2)) {
+		done = sse2YUVToRGB(y, u, v, count, pixels);
+	}
+	scalarYUVToRGB(y, u, v, done, count, pixels);
+}
+
+void ColorConvert::referenceRGBToYUV(const BitmapFile::Pixel* pixels, INT32 first, INT32 count, INT8* y, INT8* u, INT8* v)
+{
+	for (INT32 i = first; i < count; i++) {
+		DOUBLE R = pixels[i].Red / 255.0;
+		DOUBLE G = pixels[i].Green / 255.0;
+		DOUBLE B = pixels[i].Blue / 255.0;
+		DOUBLE Y = 0 + (0.299*R) + (0.587*G) + (0.114*B);
+		DOUBLE U = 0.5 - (0.168736*R) - (0.331264*G) + (0.5*B);
+		DOUBLE V = 0.5 + (0.5*R) - (0.418688*G) - (0.081312*B);
+		INT32 offset = sampleOffset(i);
+		y[offset] = static_cast<INT8>((Y * 255) - 128);
+		u[offset] = static_cast<INT8>((U * 255) - 128);
+		v[offset] = static_cast<INT8>((V * 255) - 128);
+	}
+}
+
+void ColorConvert::scalarRGBToYUV(const BitmapFile::Pixel* pixels, INT32 first, INT32 count, INT8* y, INT8* u, INT8* v)
+{
+	for (INT32 i = first; i < count; i++) {
+		INT32 R = pixels[i].Red;
+		INT32 G = pixels[i].Green;
+		INT32 B = pixels[i].Blue;
+		INT32 offset = sampleOffset(i);
+		y[offset] = static_cast<INT8>(truncateShift(Y_R * R + Y_G * G + Y_B * B + Y_OFFSET));
+		u[offset] = static_cast<INT8>(truncateShift(U_R * R + U_G * G + U_B * B + UV_OFFSET));
+		v[offset] = static_cast<INT8>(truncateShift(V_R * R + V_G * G + V_B * B + UV_OFFSET));
+	}
+}
+
+void ColorConvert::referenceYUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 first, INT32 count, BitmapFile::Pixel* pixels)
+{
+	for (INT32 i = first; i < count; i++) {
+		INT32 offset = sampleOffset(i);
+		DOUBLE Y = (y[offset] + 128) / 255.0;
+		DOUBLE U = (u[offset] + 128) / 255.0;
+		DOUBLE V = (v[offset] + 128) / 255.0;
+		DOUBLE R = Y + 1.402 * (V - 0.5);
+		DOUBLE G = Y - 0.344136 * (U - 0.5) - 0.714136 * (V - 0.5);
+		DOUBLE B = Y + 1.772 * (U - 0.5);
+		pixels[i].Red = static_cast<BYTE>(clampToUnit(R) * 255);
+		pixels[i].Green = static_cast<BYTE>(clampToUnit(G) * 255);
+		pixels[i].Blue = static_cast<BYTE>(clampToUnit(B) * 255);
+	}
+}
+
+void ColorConvert::scalarYUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 first, INT32 count, BitmapFile::Pixel* pixels)
+{
+	for (INT32 i = first; i < count; i++) {
+		INT32 offset = sampleOffset(i);
+		INT32 Y = (y[offset] + 128) * ONE;
+		INT32 U = u[offset];
+		INT32 V = v[offset];
+		pixels[i].Red = clampToByte((Y + R_V * V + R_OFFSET) >> SHIFT);
+		pixels[i].Green = clampToByte((Y + G_U * U + G_V * V + G_OFFSET) >> SHIFT);
+		pixels[i].Blue = clampToByte((Y + B_U * U + B_OFFSET) >> SHIFT);
+	}
+}
+
+#ifdef IM3_X86
+
+INT32 ColorConvert::sse2RGBToYUV(const BitmapFile::Pixel* pixels, INT32 count, INT8* y, INT8* u, INT8* v)
+{
+	const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+	INT32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		// Split the 24 bytes of the pixels into lanes of (B, G, R, x),
+		// pixels 4 to 7 starting 4 bytes into the second load
+		const BYTE* bytes = reinterpret_cast<const BYTE*>(pixels + i);
+		__m128i low = sse2Pixels(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes)));
+		__m128i high = sse2Pixels(_mm_srli_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 8)), 4));
+		// (B, R) and (G, x) pairs for _mm_madd_epi16
+		__m128i brLow = _mm_and_si128(low, lowBytes);
+		__m128i brHigh = _mm_and_si128(high, lowBytes);
+		__m128i gLow = _mm_srli_epi16(low, 8);
+		__m128i gHigh = _mm_srli_epi16(high, 8);
+		__m128i Y = sse2Component(brLow, brHigh, gLow, gHigh, Y_R, Y_G, Y_B, Y_OFFSET);
+		__m128i U = sse2Component(brLow, brHigh, gLow, gHigh, U_R, U_G, U_B, UV_OFFSET);
+		__m128i V = sse2Component(brLow, brHigh, gLow, gHigh, V_R, V_G, V_B, UV_OFFSET);
+		INT32 offset = sampleOffset(i);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(y + offset), _mm_packs_epi16(Y, Y));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(u + offset), _mm_packs_epi16(U, U));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(v + offset), _mm_packs_epi16(V, V));
+	}
+	return i;
+}
+
+IM3_TARGET_AVX2 INT32 ColorConvert::avx2RGBToYUV(const BitmapFile::Pixel* pixels, INT32 count, INT8* y, INT8* u, INT8* v)
+{
+	const __m256i lowBytes = _mm256_set1_epi32(0x00FF00FF);
+	INT32 i = 0;
+	for (; i + 16 <= count; i += 16) {
+		// Pixels 0 to 3 and 8 to 11 in the low lanes, 4 to 7 and 12 to 15
+		// in the high ones, as the 16-bit unpacks would leave them. The
+		// loads stay within the 48 bytes of the pixels.
+		const BYTE* bytes = reinterpret_cast<const BYTE*>(pixels + i);
+		__m256i low = avx2Pixels(bytes, bytes + 24, 0);
+		__m256i high = avx2Pixels(bytes + 8, bytes + 32, 4);
+		__m256i brLow = _mm256_and_si256(low, lowBytes);
+		__m256i brHigh = _mm256_and_si256(high, lowBytes);
+		__m256i gLow = _mm256_srli_epi16(low, 8);
+		__m256i gHigh = _mm256_srli_epi16(high, 8);
+		__m256i Y = avx2Component(brLow, brHigh, gLow, gHigh, Y_R, Y_G, Y_B, Y_OFFSET);
+		__m256i U = avx2Component(brLow, brHigh, gLow, gHigh, U_R, U_G, U_B, UV_OFFSET);
+		__m256i V = avx2Component(brLow, brHigh, gLow, gHigh, V_R, V_G, V_B, UV_OFFSET);
+		INT32 first = sampleOffset(i);
+		INT32 second = sampleOffset(i + 8);
+		storeSamples(_mm256_packs_epi16(Y, Y), y + first, y + second);
+		storeSamples(_mm256_packs_epi16(U, U), u + first, u + second);
+		storeSamples(_mm256_packs_epi16(V, V), v + first, v + second);
+	}
+	return i;
+}
+
+INT32 ColorConvert::sse2YUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 count, BitmapFile::Pixel* pixels)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i levelShift = _mm_set1_epi16(128);
+	INT32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		INT32 offset = sampleOffset(i);
+		__m128i Y = _mm_add_epi16(loadSamples(y + offset), levelShift);
+		__m128i U = loadSamples(u + offset);
+		__m128i V = loadSamples(v + offset);
+		__m128i yvLow = _mm_unpacklo_epi16(Y, V);
+		__m128i yvHigh = _mm_unpackhi_epi16(Y, V);
+		__m128i yuLow = _mm_unpacklo_epi16(Y, U);
+		__m128i yuHigh = _mm_unpackhi_epi16(Y, U);
+		__m128i vLow = _mm_unpacklo_epi16(V, zero);
+		__m128i vHigh = _mm_unpackhi_epi16(V, zero);
+		__m128i R = sse2Channel(yvLow, yvHigh, zero, zero, coefficientPair(ONE, R_V), 0, R_OFFSET);
+		__m128i G = sse2Channel(yuLow, yuHigh, vLow, vHigh, coefficientPair(ONE, G_U), coefficientPair(G_V, 0), G_OFFSET);
+		__m128i B = sse2Channel(yuLow, yuHigh, zero, zero, coefficientPair(ONE, B_U), 0, B_OFFSET);
+		// Saturate to [0, 255] and interleave into lanes of (B, G, R, 0)
+		__m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(B, B), _mm_packus_epi16(G, G));
+		__m128i r = _mm_unpacklo_epi8(_mm_packus_epi16(R, R), zero);
+		__m128i low = sse2PackPixels(_mm_unpacklo_epi16(bg, r));
+		__m128i high = sse2PackPixels(_mm_unpackhi_epi16(bg, r));
+		// The 24 bytes of the pixels, exactly
+		BYTE* bytes = reinterpret_cast<BYTE*>(pixels + i);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), _mm_or_si128(low, _mm_slli_si128(high, 12)));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(bytes + 16), _mm_srli_si128(high, 4));
+	}
+	return i;
+}
+
+IM3_TARGET_AVX2 INT32 ColorConvert::avx2YUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 count, BitmapFile::Pixel* pixels)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i levelShift = _mm256_set1_epi16(128);
+	INT32 i = 0;
+	for (; i + 16 <= count; i += 16) {
+		INT32 first = sampleOffset(i);
+		INT32 second = sampleOffset(i + 8);
+		__m256i Y = _mm256_add_epi16(loadSamples(y + first, y + second), levelShift);
+		__m256i U = loadSamples(u + first, u + second);
+		__m256i V = loadSamples(v + first, v + second);
+		__m256i yvLow = _mm256_unpacklo_epi16(Y, V);
+		__m256i yvHigh = _mm256_unpackhi_epi16(Y, V);
+		__m256i yuLow = _mm256_unpacklo_epi16(Y, U);
+		__m256i yuHigh = _mm256_unpackhi_epi16(Y, U);
+		__m256i vLow = _mm256_unpacklo_epi16(V, zero);
+		__m256i vHigh = _mm256_unpackhi_epi16(V, zero);
+		__m256i R = avx2Channel(yvLow, yvHigh, zero, zero, coefficientPair(ONE, R_V), 0, R_OFFSET);
+		__m256i G = avx2Channel(yuLow, yuHigh, vLow, vHigh, coefficientPair(ONE, G_U), coefficientPair(G_V, 0), G_OFFSET);
+		__m256i B = avx2Channel(yuLow, yuHigh, zero, zero, coefficientPair(ONE, B_U), 0, B_OFFSET);
+		// Saturate to [0, 255] and interleave into lanes of (B, G, R, 0),
+		// then pack the 4 pixels of each 128-bit lane into 12 bytes
+		__m256i bg = _mm256_unpacklo_epi8(_mm256_packus_epi16(B, B), _mm256_packus_epi16(G, G));
+		__m256i r = _mm256_unpacklo_epi8(_mm256_packus_epi16(R, R), zero);
+		const INT8 z = -128;
+		__m256i pack = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, z, z, z, z,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, z, z, z, z);
+		__m256i low = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(bg, r), pack);
+		__m256i high = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(bg, r), pack);
+		// Pixels 0 to 7 from the low 128-bit lanes, 8 to 15 from the high
+		__m256i head = _mm256_or_si256(low, _mm256_slli_si256(high, 12));
+		__m256i tail = _mm256_srli_si256(high, 4);
+		BYTE* bytes = reinterpret_cast<BYTE*>(pixels + i);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), _mm256_castsi256_si128(head));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(bytes + 16), _mm256_castsi256_si128(tail));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + 24), _mm256_extracti128_si256(head, 1));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(bytes + 40), _mm256_extracti128_si256(tail, 1));
+	}
+	return i;
+}
+
+#else
+
+INT32 ColorConvert::sse2RGBToYUV(const BitmapFile::Pixel*, INT32, INT8*, INT8*, INT8*)
+{
+	return 0;
+}
+
+INT32 ColorConvert::avx2RGBToYUV(const BitmapFile::Pixel*, INT32, INT8*, INT8*, INT8*)
+{
+	return 0;
+}
+
+INT32 ColorConvert::sse2YUVToRGB(const INT8*, const INT8*, const INT8*, INT32, BitmapFile::Pixel*)
+{
+	return 0;
+}
+
+INT32 ColorConvert::avx2YUVToRGB(const INT8*, const INT8*, const INT8*, INT32, BitmapFile::Pixel*)
+{
+	return 0;
+}
+
+#endif
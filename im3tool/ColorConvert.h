@@ -0,0 +1,71 @@
+#pragma once
+#include "commontypes.h"
+#include "BitmapFile.h"
+
+// RGB <---> YUV colour conversion kernels working on rows of pixels.
+// YUV samples are level-shifted to [-128, 127] and laid out as rows of
+// 8-by-8 blocks: every 8 samples the next block's row follows
+// BLOCK_STRIDE bytes on.
+class ColorConvert
+{
+public:
+	// Available kernels
+	enum Kernel {
+		REFERENCE = 0, // Double precision, as BitmapUtility converts
+		SCALAR = 1, // 14-bit fixed-point
+		SSE2 = 2, // 14-bit fixed-point, 8 pixels at a time
+		AVX2 = 3 // 14-bit fixed-point, 16 pixels at a time
+	};
+
+	// Number of available kernels
+	static const UINT8 NUM_KERNELS = 4;
+
+	// Distance between the rows of consecutive blocks
+	static const INT32 BLOCK_STRIDE = 64;
+
+	// Human readable name of a kernel
+	static const char* kernelName(Kernel kernel);
+
+	// Whether the processor can run a kernel
+	static bool supported(Kernel kernel);
+
+	// Fastest kernel the processor can run
+	static Kernel bestKernel();
+
+	// Convert a row of count pixels to Y, U, and V block rows
+	static void rgbToYUV(
+		Kernel kernel,
+		const BitmapFile::Pixel* pixels,
+		INT32 count,
+		INT8* y,
+		INT8* u,
+		INT8* v);
+
+	// Convert Y, U, and V block rows to a row of count pixels
+	static void yuvToRGB(
+		Kernel kernel,
+		const INT8* y,
+		const INT8* u,
+		const INT8* v,
+		INT32 count,
+		BitmapFile::Pixel* pixels);
+
+private:
+	// Kernel implementations, starting at pixel first
+	static void referenceRGBToYUV(const BitmapFile::Pixel* pixels, INT32 first, INT32 count, INT8* y, INT8* u, INT8* v);
+	static void scalarRGBToYUV(const BitmapFile::Pixel* pixels, INT32 first, INT32 count, INT8* y, INT8* u, INT8* v);
+	static INT32 sse2RGBToYUV(const BitmapFile::Pixel* pixels, INT32 count, INT8* y, INT8* u, INT8* v);
+	static INT32 avx2RGBToYUV(const BitmapFile::Pixel* pixels, INT32 count, INT8* y, INT8* u, INT8* v);
+	static void referenceYUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 first, INT32 count, BitmapFile::Pixel* pixels);
+	static void scalarYUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 first, INT32 count, BitmapFile::Pixel* pixels);
+	static INT32 sse2YUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 count, BitmapFile::Pixel* pixels);
+	static INT32 avx2YUVToRGB(const INT8* y, const INT8* u, const INT8* v, INT32 count, BitmapFile::Pixel* pixels);
+
+	// Offset of the sample of pixel i in a block row
+	static INT32 sampleOffset(INT32 i);
+};
+
+inline INT32 ColorConvert::sampleOffset(INT32 i)
+{
+	return (i / 8) * BLOCK_STRIDE + i % 8;
+}
@@ -0,0 +1,404 @@
+#include "stdafx.h"
+#include <cmath>
+#include "DCT.h"
+
+namespace {
+	// Function C in DCT
+	inline DOUBLE C(const UINT8 x) {
+		static const DOUBLE a = M_SQRT1_2;
+		return x == 0 ? a : 1.0;
+	}
+}
+
+const char* DCT::engineName(Engine engine)
+{
+	switch (engine)
+	{
+	case SEPARABLE:
+		return "separable";
+	case FAST:
+		return "fast";
+	case REFERENCE:
+	default:
+		return "reference";
+	}
+}
+
+const char* DCT::inverseEngineName(InverseEngine engine)
+{
+	switch (engine)
+	{
+	case INVERSE_SEPARABLE:
+		return "separable";
+	case INVERSE_INTEGER:
+		return "integer";
+	case INVERSE_REFERENCE:
+	default:
+		return "reference";
+	}
+}
+
+const DCT::CosineTable& DCT::cosineTable()
+{
+	// Built once with the same expression as the reference so that the
+	// near-tie fallback reproduces the reference bit for bit
+	static const CosineTable table = []() {
+		CosineTable t;
+		for (UINT8 u = 0; u < 8; u++) {
+			for (UINT8 i = 0; i < 8; i++) {
+				t[u][i] = cos((2 * i + 1) * u * M_PI / 16);
+			}
+		}
+		return t;
+	}();
+	return table;
+}
+
+const DCT::CosineTable& DCT::scaledCosineTable()
+{
+	static const CosineTable table = []() {
+		const CosineTable& t = cosineTable();
+		CosineTable s;
+		for (UINT8 u = 0; u < 8; u++) {
+			for (UINT8 i = 0; i < 8; i++) {
+				s[u][i] = C(u) / 2.0 * t[u][i];
+			}
+		}
+		return s;
+	}();
+	return table;
+}
+
+void DCT::referenceForward(const Block<DOUBLE>& input, Block<DOUBLE>& output)
+{
+	for (UINT8 v = 0; v < 8; v++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 j = 0; j < 8; j++) {
+				for (UINT8 i = 0; i < 8; i++) {
+					sum += cos((2 * i + 1) * u * M_PI / 16)
+						* cos((2 * j + 1) * v * M_PI / 16)
+						* input[j][i];
+				}
+			}
+			output[v][u] = C(u) * C(v) * sum / 4.0;
+		}
+	}
+}
+
+DOUBLE DCT::referenceCoefficient(const Block<DOUBLE>& input, UINT8 u, UINT8 v)
+{
+	const CosineTable& t = cosineTable();
+	DOUBLE sum = 0.0;
+	for (UINT8 j = 0; j < 8; j++) {
+		for (UINT8 i = 0; i < 8; i++) {
+			sum += t[u][i]
+				* t[v][j]
+				* input[j][i];
+		}
+	}
+	return C(u) * C(v) * sum / 4.0;
+}
+
+void DCT::separableForward(const Block<DOUBLE>& input, Block<DOUBLE>& output)
+{
+	const CosineTable& scaled = scaledCosineTable();
+	// Transform the rows
+	Block<DOUBLE> rows;
+	for (UINT8 j = 0; j < 8; j++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 i = 0; i < 8; i++) {
+				sum += scaled[u][i] * input[j][i];
+			}
+			rows[j][u] = sum;
+		}
+	}
+	// Transform the columns
+	for (UINT8 v = 0; v < 8; v++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 j = 0; j < 8; j++) {
+				sum += scaled[v][j] * rows[j][u];
+			}
+			output[v][u] = sum;
+		}
+	}
+}
+
+void DCT::fastForward(const Block<DOUBLE>& input, Block<DOUBLE>& output)
+{
+	// Rotation constants of the AAN flow graph
+	static const DOUBLE C4 = cos(4 * M_PI / 16);
+	static const DOUBLE C6 = cos(6 * M_PI / 16);
+	static const DOUBLE C2_MINUS_C6 = cos(2 * M_PI / 16) - C6;
+	static const DOUBLE C2_PLUS_C6 = cos(2 * M_PI / 16) + C6;
+	// Output k of the 1D flow graph is scaled by cos(k * PI / 16) * sqrt(2)
+	// (1 for k == 0) and the 2D result by a further 8, undone at the end
+	static const CosineTable descale = []() {
+		std::array<DOUBLE, 8> factor;
+		factor[0] = 1.0;
+		for (UINT8 k = 1; k < 8; k++) {
+			factor[k] = cos(k * M_PI / 16) * M_SQRT2;
+		}
+		CosineTable d;
+		for (UINT8 v = 0; v < 8; v++) {
+			for (UINT8 u = 0; u < 8; u++) {
+				d[v][u] = 1.0 / (factor[v] * factor[u] * 8.0);
+			}
+		}
+		return d;
+	}();
+	// 1D transform of 8 values spaced by stride, in place
+	auto transform = [](DOUBLE* data, UINT8 stride) {
+		DOUBLE tmp0 = data[0 * stride] + data[7 * stride];
+		DOUBLE tmp7 = data[0 * stride] - data[7 * stride];
+		DOUBLE tmp1 = data[1 * stride] + data[6 * stride];
+		DOUBLE tmp6 = data[1 * stride] - data[6 * stride];
+		DOUBLE tmp2 = data[2 * stride] + data[5 * stride];
+		DOUBLE tmp5 = data[2 * stride] - data[5 * stride];
+		DOUBLE tmp3 = data[3 * stride] + data[4 * stride];
+		DOUBLE tmp4 = data[3 * stride] - data[4 * stride];
+		// Even part
+		DOUBLE tmp10 = tmp0 + tmp3;
+		DOUBLE tmp13 = tmp0 - tmp3;
+		DOUBLE tmp11 = tmp1 + tmp2;
+		DOUBLE tmp12 = tmp1 - tmp2;
+		data[0 * stride] = tmp10 + tmp11;
+		data[4 * stride] = tmp10 - tmp11;
+		DOUBLE z1 = (tmp12 + tmp13) * C4;
+		data[2 * stride] = tmp13 + z1;
+		data[6 * stride] = tmp13 - z1;
+		// Odd part
+		tmp10 = tmp4 + tmp5;
+		tmp11 = tmp5 + tmp6;
+		tmp12 = tmp6 + tmp7;
+		DOUBLE z5 = (tmp10 - tmp12) * C6;
+		DOUBLE z2 = C2_MINUS_C6 * tmp10 + z5;
+		DOUBLE z4 = C2_PLUS_C6 * tmp12 + z5;
+		DOUBLE z3 = tmp11 * C4;
+		DOUBLE z11 = tmp7 + z3;
+		DOUBLE z13 = tmp7 - z3;
+		data[5 * stride] = z13 + z2;
+		data[3 * stride] = z13 - z2;
+		data[1 * stride] = z11 + z4;
+		data[7 * stride] = z11 - z4;
+	};
+	output = input;
+	DOUBLE* data = &output[0][0];
+	// Transform the rows
+	for (UINT8 j = 0; j < 8; j++) {
+		transform(data + j * 8, 1);
+	}
+	// Transform the columns
+	for (UINT8 i = 0; i < 8; i++) {
+		transform(data + i, 8);
+	}
+	// Remove the flow graph scaling
+	for (UINT8 v = 0; v < 8; v++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			output[v][u] *= descale[v][u];
+		}
+	}
+}
+
+void DCT::referenceInverse(const Block<DOUBLE>& input, Block<DOUBLE>& output)
+{
+	for (UINT8 j = 0; j < 8; j++) {
+		for (UINT8 i = 0; i < 8; i++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 v = 0; v < 8; v++) {
+				for (UINT8 u = 0; u < 8; u++) {
+					sum += C(u) * C(v) / 4.0
+						* cos((2 * i + 1) * u * M_PI / 16)
+						* cos((2 * j + 1) * v * M_PI / 16)
+						* input[v][u];
+				}
+			}
+			output[j][i] = sum;
+		}
+	}
+}
+
+void DCT::separableInverse(const Block<DOUBLE>& input, Block<DOUBLE>& output)
+{
+	const CosineTable& scaled = scaledCosineTable();
+	// Transform the rows, skipping the all-zero rows common after quantization
+	Block<DOUBLE> rows;
+	for (UINT8 v = 0; v < 8; v++) {
+		bool empty = true;
+		for (UINT8 u = 0; u < 8; u++) {
+			empty &= input[v][u] == 0.0;
+		}
+		for (UINT8 i = 0; i < 8; i++) {
+			DOUBLE sum = 0.0;
+			if (!empty) {
+				for (UINT8 u = 0; u < 8; u++) {
+					sum += scaled[u][i] * input[v][u];
+				}
+			}
+			rows[v][i] = sum;
+		}
+	}
+	// Transform the columns
+	for (UINT8 j = 0; j < 8; j++) {
+		for (UINT8 i = 0; i < 8; i++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 v = 0; v < 8; v++) {
+				sum += scaled[v][j] * rows[v][i];
+			}
+			output[j][i] = sum;
+		}
+	}
+}
+
+const DCT::CosineTable& DCT::reducedCosineTable(UINT8 size)
+{
+	// One table each for sizes 1, 2 and 4
+	static const std::array<CosineTable, 3> tables = []() {
+		std::array<CosineTable, 3> t = {};
+		for (UINT8 k = 0; k < 3; k++) {
+			UINT8 n = static_cast<UINT8>(1 << k);
+			for (UINT8 u = 0; u < n; u++) {
+				for (UINT8 i = 0; i < n; i++) {
+					t[k][u][i] = C(u) / 2.0 * cos((2 * i + 1) * u * M_PI / (2 * n));
+				}
+			}
+		}
+		return t;
+	}();
+	return tables[size >= 4 ? 2 : size >= 2 ? 1 : 0];
+}
+
+void DCT::reducedInverse(const Block<DOUBLE>& input, UINT8 size, Block<DOUBLE>& output)
+{
+	const CosineTable& scaled = reducedCosineTable(size);
+	// The lowest frequencies of the 8-point transform, taken as those of a
+	// size-point one, give near enough the averages of the samples
+	Block<DOUBLE> rows;
+	for (UINT8 v = 0; v < size; v++) {
+		for (UINT8 i = 0; i < size; i++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 u = 0; u < size; u++) {
+				sum += scaled[u][i] * input[v][u];
+			}
+			rows[v][i] = sum;
+		}
+	}
+	for (UINT8 j = 0; j < size; j++) {
+		for (UINT8 i = 0; i < size; i++) {
+			DOUBLE sum = 0.0;
+			for (UINT8 v = 0; v < size; v++) {
+				sum += scaled[v][j] * rows[v][i];
+			}
+			output[j][i] = sum;
+		}
+	}
+}
+
+void DCT::integerInverse(const Block<INT32>& input, Block<INT32>& output)
+{
+	// Fixed-point precision of the constants and of the intermediate pass
+	static const INT32 CONST_BITS = 13;
+	static const INT32 PASS1_BITS = 2;
+	// Coefficients are clamped to the 12-bit range covered by IEEE 1180,
+	// which every DCT of 8-bit samples falls within
+	static const INT32 COEFFICIENT_MIN = -2048;
+	static const INT32 COEFFICIENT_MAX = 2047;
+	// Constants scaled by 2^CONST_BITS
+	static const INT32 FIX_0_298631336 = 2446;
+	static const INT32 FIX_0_390180644 = 3196;
+	static const INT32 FIX_0_541196100 = 4433;
+	static const INT32 FIX_0_765366865 = 6270;
+	static const INT32 FIX_0_899976223 = 7373;
+	static const INT32 FIX_1_175875602 = 9633;
+	static const INT32 FIX_1_501321110 = 12299;
+	static const INT32 FIX_1_847759065 = 15137;
+	static const INT32 FIX_1_961570560 = 16069;
+	static const INT32 FIX_2_053119869 = 16819;
+	static const INT32 FIX_2_562915447 = 20995;
+	static const INT32 FIX_3_072711026 = 25172;
+	// Right shift with rounding
+	auto descale = [](INT32 x, INT32 n) {
+		return (x + (1 << (n - 1))) >> n;
+	};
+	// 1D transform of 8 values spaced by stride, results descaled by shift
+	auto transform = [&](const INT32* in, INT32 inStride, INT32* out, INT32 outStride, INT32 shift) {
+		// Even part
+		INT32 z2 = in[2 * inStride];
+		INT32 z3 = in[6 * inStride];
+		INT32 z1 = (z2 + z3) * FIX_0_541196100;
+		INT32 tmp2 = z1 - z3 * FIX_1_847759065;
+		INT32 tmp3 = z1 + z2 * FIX_0_765366865;
+		z2 = in[0 * inStride];
+		z3 = in[4 * inStride];
+		INT32 tmp0 = (z2 + z3) * (1 << CONST_BITS);
+		INT32 tmp1 = (z2 - z3) * (1 << CONST_BITS);
+		INT32 tmp10 = tmp0 + tmp3;
+		INT32 tmp13 = tmp0 - tmp3;
+		INT32 tmp11 = tmp1 + tmp2;
+		INT32 tmp12 = tmp1 - tmp2;
+		// Odd part
+		tmp0 = in[7 * inStride];
+		tmp1 = in[5 * inStride];
+		tmp2 = in[3 * inStride];
+		tmp3 = in[1 * inStride];
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		INT32 z4 = tmp1 + tmp3;
+		INT32 z5 = (z3 + z4) * FIX_1_175875602;
+		tmp0 *= FIX_0_298631336;
+		tmp1 *= FIX_2_053119869;
+		tmp2 *= FIX_3_072711026;
+		tmp3 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 *= -FIX_1_961570560;
+		z4 *= -FIX_0_390180644;
+		z3 += z5;
+		z4 += z5;
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+		out[0 * outStride] = descale(tmp10 + tmp3, shift);
+		out[7 * outStride] = descale(tmp10 - tmp3, shift);
+		out[1 * outStride] = descale(tmp11 + tmp2, shift);
+		out[6 * outStride] = descale(tmp11 - tmp2, shift);
+		out[2 * outStride] = descale(tmp12 + tmp1, shift);
+		out[5 * outStride] = descale(tmp12 - tmp1, shift);
+		out[3 * outStride] = descale(tmp13 + tmp0, shift);
+		out[4 * outStride] = descale(tmp13 - tmp0, shift);
+	};
+	Block<INT32> clamped;
+	for (UINT8 v = 0; v < 8; v++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			clamped[v][u] = std::max(COEFFICIENT_MIN, std::min(input[v][u], COEFFICIENT_MAX));
+		}
+	}
+	// Transform the columns into a workspace carrying PASS1_BITS extra bits
+	Block<INT32> workspace;
+	for (UINT8 u = 0; u < 8; u++) {
+		bool acEmpty = true;
+		for (UINT8 v = 1; v < 8; v++) {
+			acEmpty &= clamped[v][u] == 0;
+		}
+		if (acEmpty) {
+			// A column with only a DC term transforms to a constant
+			INT32 dc = clamped[0][u] * (1 << PASS1_BITS);
+			for (UINT8 j = 0; j < 8; j++) {
+				workspace[j][u] = dc;
+			}
+			continue;
+		}
+		transform(&clamped[0][u], 8, &workspace[0][u], 8, CONST_BITS - PASS1_BITS);
+	}
+	// Transform the rows, removing the pass scaling and the factor of 8
+	for (UINT8 j = 0; j < 8; j++) {
+		transform(&workspace[j][0], 1, &output[j][0], 1, CONST_BITS + PASS1_BITS + 3);
+		for (UINT8 i = 0; i < 8; i++) {
+			output[j][i] = std::max(-128, std::min(output[j][i], 127));
+		}
+	}
+}
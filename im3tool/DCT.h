@@ -0,0 +1,208 @@
+#pragma once
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <array>
+#include <math.h>
+#include "commontypes.h"
+
+// Forward and inverse Discrete Cosine Transform (DCT) engines on 8-by-8 blocks
+class DCT
+{
+public:
+	// Available forward DCT implementations
+	enum Engine {
+		REFERENCE = 0, // Direct evaluation of the 2D DCT sum
+		SEPARABLE = 1, // Row-column evaluation using a cosine table
+		FAST = 2 // Arai-Agui-Nakajima (AAN) factorization
+	};
+
+	// Number of available engines
+	static const UINT8 NUM_ENGINES = 3;
+
+	// Available inverse DCT implementations
+	enum InverseEngine {
+		INVERSE_REFERENCE = 0, // Direct evaluation of the 2D inverse DCT sum
+		INVERSE_SEPARABLE = 1, // Row-column evaluation using a cosine table
+		INVERSE_INTEGER = 2 // Loeffler-Ligtenberg-Moschytz factorization in fixed-point
+	};
+
+	// Number of available inverse engines
+	static const UINT8 NUM_INVERSE_ENGINES = 3;
+
+	// Alias templates
+	template <typename T>
+	using Block = std::array<std::array<T, 8>, 8>;
+
+	// Human readable name of an engine
+	static const char* engineName(Engine engine);
+	static const char* inverseEngineName(InverseEngine engine);
+
+	// Forward DCT on a 8-by-8 block rounded to the nearest integer
+	template <typename T, typename W>
+	static Block<W> forward(Engine engine, const Block<T>& block);
+
+	// Inverse DCT on a 8-by-8 block rounded and clamped to [-128, 127]
+	template <typename T, typename W>
+	static Block<W> inverse(InverseEngine engine, const Block<T>& block);
+
+	// Inverse DCT of the size-by-size lowest frequencies of a block, giving
+	// the block scaled down to its top-left size-by-size samples for a size
+	// of 1, 2 or 4, rounded and clamped to [-128, 127]. Size 1 is the DC
+	// alone.
+	template <typename T, typename W>
+	static Block<W> inverseReduced(const Block<T>& block, UINT8 size);
+
+private:
+	// Cosine table: cos((2 * i + 1) * u * PI / 16) indexed [u][i]
+	typedef std::array<std::array<DOUBLE, 8>, 8> CosineTable;
+	static const CosineTable& cosineTable();
+
+	// Cosine table with the C(u) / 2 normalization folded in
+	static const CosineTable& scaledCosineTable();
+
+	// Engine implementations producing unrounded coefficients
+	static void referenceForward(const Block<DOUBLE>& input, Block<DOUBLE>& output);
+	static void separableForward(const Block<DOUBLE>& input, Block<DOUBLE>& output);
+	static void fastForward(const Block<DOUBLE>& input, Block<DOUBLE>& output);
+
+	// Inverse engine implementations producing unrounded samples
+	static void referenceInverse(const Block<DOUBLE>& input, Block<DOUBLE>& output);
+	static void separableInverse(const Block<DOUBLE>& input, Block<DOUBLE>& output);
+
+	// Cosine table of a size-point inverse with the C(u) / 2 normalization
+	// folded in: C(u) / 2 * cos((2 * i + 1) * u * PI / (2 * size))
+	static const CosineTable& reducedCosineTable(UINT8 size);
+
+	// Reduced inverse producing unrounded samples
+	static void reducedInverse(const Block<DOUBLE>& input, UINT8 size, Block<DOUBLE>& output);
+
+	// Fixed-point inverse producing rounded and clamped samples
+	static void integerInverse(const Block<INT32>& input, Block<INT32>& output);
+
+	// Single coefficient evaluated in exactly the same order as the reference
+	static DOUBLE referenceCoefficient(const Block<DOUBLE>& input, UINT8 u, UINT8 v);
+
+	// Nearest integer to a value, halves away from zero as round() gives
+	// them but with a single truncating conversion rather than a call.
+	// Values within an ulp of a half may round either way.
+	static DOUBLE roughRound(DOUBLE value);
+
+	// Whether a value is close enough to a rounding boundary, half way from
+	// its rough rounding, that the rounding errors of a factored engine
+	// could change the rounded result
+	static bool nearRoundingBoundary(DOUBLE value, DOUBLE rounded);
+};
+
+inline DOUBLE DCT::roughRound(DOUBLE value)
+{
+	return static_cast<DOUBLE>(static_cast<INT32>(value + (value < 0.0 ? -0.5 : 0.5)));
+}
+
+inline bool DCT::nearRoundingBoundary(DOUBLE value, DOUBLE rounded)
+{
+	// Far wider than the accumulated error of the factored engines
+	static const DOUBLE EPSILON = 1e-6;
+	return fabs(fabs(value - rounded) - 0.5) < EPSILON;
+}
+
+template<typename T, typename W>
+inline DCT::Block<W> DCT::forward(Engine engine, const Block<T>& block)
+{
+	Block<DOUBLE> input;
+	for (UINT8 j = 0; j < 8; j++) {
+		for (UINT8 i = 0; i < 8; i++) {
+			input[j][i] = block[j][i];
+		}
+	}
+	Block<DOUBLE> coefficients;
+	switch (engine)
+	{
+	case SEPARABLE:
+		separableForward(input, coefficients);
+		break;
+	case FAST:
+		fastForward(input, coefficients);
+		break;
+	case REFERENCE:
+	default:
+		referenceForward(input, coefficients);
+		break;
+	}
+	Block<W> output;
+	for (UINT8 v = 0; v < 8; v++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			DOUBLE val = coefficients[v][u];
+			DOUBLE rounded = roughRound(val);
+			// Resolve near-ties exactly as the reference would so that every
+			// engine rounds to the same integer coefficients
+			if (nearRoundingBoundary(val, rounded)) {
+				rounded = round(engine != REFERENCE ? referenceCoefficient(input, u, v) : val);
+			}
+			output[v][u] = static_cast<W>(rounded);
+		}
+	}
+	return output;
+}
+
+template<typename T, typename W>
+inline DCT::Block<W> DCT::inverse(InverseEngine engine, const Block<T>& block)
+{
+	Block<W> output;
+	if (engine == INVERSE_INTEGER) {
+		Block<INT32> input;
+		for (UINT8 v = 0; v < 8; v++) {
+			for (UINT8 u = 0; u < 8; u++) {
+				input[v][u] = block[v][u];
+			}
+		}
+		Block<INT32> samples;
+		integerInverse(input, samples);
+		for (UINT8 j = 0; j < 8; j++) {
+			for (UINT8 i = 0; i < 8; i++) {
+				output[j][i] = static_cast<W>(samples[j][i]);
+			}
+		}
+		return output;
+	}
+	Block<DOUBLE> input;
+	for (UINT8 v = 0; v < 8; v++) {
+		for (UINT8 u = 0; u < 8; u++) {
+			input[v][u] = block[v][u];
+		}
+	}
+	Block<DOUBLE> samples;
+	if (engine == INVERSE_SEPARABLE) {
+		separableInverse(input, samples);
+	}
+	else {
+		referenceInverse(input, samples);
+	}
+	for (UINT8 j = 0; j < 8; j++) {
+		for (UINT8 i = 0; i < 8; i++) {
+			DOUBLE clamped = std::max(-128.0, std::min(samples[j][i], 127.0));
+			output[j][i] = static_cast<W>(round(clamped));
+		}
+	}
+	return output;
+}
+
+template<typename T, typename W>
+inline DCT::Block<W> DCT::inverseReduced(const Block<T>& block, UINT8 size)
+{
+	Block<DOUBLE> input;
+	for (UINT8 v = 0; v < size; v++) {
+		for (UINT8 u = 0; u < size; u++) {
+			input[v][u] = block[v][u];
+		}
+	}
+	Block<DOUBLE> samples;
+	reducedInverse(input, size, samples);
+	Block<W> output = {};
+	for (UINT8 j = 0; j < size; j++) {
+		for (UINT8 i = 0; i < size; i++) {
+			DOUBLE clamped = std::max(-128.0, std::min(samples[j][i], 127.0));
+			output[j][i] = static_cast<W>(round(clamped));
+		}
+	}
+	return output;
+}
@@ -3,6 +3,7 @@
 #include "BitmapFile.h"
 #include "FileOpenDialog.h"
 #include "Codec.h"
+#include "Stream.h"
 
 // Forward declaration of class dependencies
 
@@ -45,12 +46,13 @@ BitmapFile * FileOpenDialog::OpenBitmapFile(HWND hWnd) {
 	// Else it is a BMP file, read it in
 	if (fileName.find(L".im3") != std::wstring::npos ||
 		fileName.find(L".IM3") != std::wstring::npos) {
-		IM3File im3File(fileHandle);
+		IM3File im3File(std::unique_ptr<Stream>(new FileStream(fileHandle)));
 		bitmapFile = codec.decompress(&im3File);
 	}
 	else {
 		// Read the file into memory
-		bitmapFile = new BitmapFile(fileHandle, &result);
+		FileStream stream(fileHandle);
+		bitmapFile = new BitmapFile(stream, &result);
 		// If there was an error while reading the file show a message
 		switch (result) {
 		case BitmapFile::ERROR_NOT_BMP:
@@ -0,0 +1,266 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "Huffman.h"
+
+namespace {
+	// Reverse the order of the low length bits of code
+	inline UINT64 reverseBits(UINT64 code, UINT32 length) {
+		UINT64 reversed = 0;
+		for (UINT32 i = 0; i < length; i++) {
+			reversed = (reversed << 1) | (code & 1);
+			code >>= 1;
+		}
+		return reversed;
+	}
+}
+
+LengthTable<UINT8> huffmanCodeLengths(
+	const std::array<UINT32, HUFFMAN_SYMBOLS>& counts,
+	UINT8 maxLength)
+{
+	LengthTable<UINT8> lengths = {};
+	// Used symbols sorted by increasing count
+	std::vector<UINT16> symbols;
+	for (UINT16 symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+		if (counts[symbol] != 0) {
+			symbols.push_back(symbol);
+		}
+	}
+	std::stable_sort(symbols.begin(), symbols.end(), [&counts](UINT16 a, UINT16 b) {
+		return counts[a] < counts[b];
+	});
+	INT32 n = static_cast<INT32>(symbols.size());
+	if (n == 0) {
+		return lengths;
+	}
+	if (n == 1) {
+		// A lone symbol still needs a one bit code
+		lengths[symbols[0]] = 1;
+		return lengths;
+	}
+	// The array holds counts, then parent indices, then depths in turn
+	std::vector<UINT64> a(n);
+	for (INT32 i = 0; i < n; i++) {
+		a[i] = counts[symbols[i]];
+	}
+	// First pass, left to right, combining the two lightest leaves or
+	// internal nodes and recording parent pointers
+	a[0] += a[1];
+	INT32 root = 0;
+	INT32 leaf = 2;
+	for (INT32 next = 1; next < n - 1; next++) {
+		if (leaf >= n || a[root] < a[leaf]) {
+			a[next] = a[root];
+			a[root++] = next;
+		}
+		else {
+			a[next] = a[leaf++];
+		}
+		if (leaf >= n || (root < next && a[root] < a[leaf])) {
+			a[next] += a[root];
+			a[root++] = next;
+		}
+		else {
+			a[next] += a[leaf++];
+		}
+	}
+	// Second pass, right to left, converting parent pointers to depths
+	a[n - 2] = 0;
+	for (INT32 next = n - 3; next >= 0; next--) {
+		a[next] = a[static_cast<size_t>(a[next])] + 1;
+	}
+	// Third pass, right to left, converting internal depths to leaf depths
+	INT32 available = 1;
+	INT32 used = 0;
+	UINT64 depth = 0;
+	root = n - 2;
+	INT32 next = n - 1;
+	while (available > 0) {
+		while (root >= 0 && a[root] == depth) {
+			used++;
+			root--;
+		}
+		while (available > used) {
+			a[next--] = depth;
+			available--;
+		}
+		available = 2 * used;
+		depth++;
+		used = 0;
+	}
+	// Count the codes of each length
+	UINT64 longest = a[0];
+	std::vector<UINT32> lengthCounts(static_cast<size_t>(std::max<UINT64>(longest, maxLength)) + 1, 0);
+	for (INT32 i = 0; i < n; i++) {
+		lengthCounts[static_cast<size_t>(a[i])] += 1;
+	}
+	// Limit the lengths: move pairs of the longest codes up a level and
+	// split a shorter code to take their place (JPEG Annex K.3)
+	for (size_t i = static_cast<size_t>(longest); i > maxLength; i--) {
+		while (lengthCounts[i] > 0) {
+			size_t j = i - 2;
+			while (lengthCounts[j] == 0) {
+				j--;
+			}
+			lengthCounts[i] -= 2;
+			lengthCounts[i - 1] += 1;
+			lengthCounts[j + 1] += 2;
+			lengthCounts[j] -= 1;
+		}
+	}
+	// Hand out the lengths, shortest to the most frequent symbols
+	INT32 index = n - 1;
+	for (UINT8 length = 1; length <= maxLength; length++) {
+		for (UINT32 k = 0; k < lengthCounts[length]; k++) {
+			lengths[symbols[index--]] = length;
+		}
+	}
+	return lengths;
+}
+
+std::array<HuffmanCode, HUFFMAN_SYMBOLS> canonicalCodes(const LengthTable<UINT8>& lengths)
+{
+	static const UINT8 MAX_CODE_LENGTH = 64;
+	// Sort the symbols by code length, then by symbol
+	std::array<UINT16, HUFFMAN_SYMBOLS> order;
+	for (UINT16 i = 0; i < HUFFMAN_SYMBOLS; i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&lengths](UINT16 a, UINT16 b) {
+		return lengths[a] < lengths[b];
+	});
+	// Assign consecutive codes, appending zeroes whenever the length grows
+	std::array<HuffmanCode, HUFFMAN_SYMBOLS> codes = {};
+	UINT64 code = 0;
+	UINT8 lastLength = 0;
+	for (UINT16 symbol : order) {
+		UINT8 length = lengths[symbol];
+		if (length == 0) {
+			continue;
+		}
+		if (length > MAX_CODE_LENGTH) {
+			break;
+		}
+		if (lastLength != 0) {
+			code = (code + 1) << (length - lastLength);
+		}
+		lastLength = length;
+		codes[symbol] = { code, length };
+	}
+	return codes;
+}
+
+std::array<HuffmanCode, HUFFMAN_SYMBOLS> reversedCanonicalCodes(const LengthTable<UINT8>& lengths)
+{
+	std::array<HuffmanCode, HUFFMAN_SYMBOLS> codes = canonicalCodes(lengths);
+	for (HuffmanCode& code : codes) {
+		code.Bits = reverseBits(code.Bits, code.Length);
+	}
+	return codes;
+}
+
+UINT16 HuffmanDecoder::decodeLong(BitReader& reader, const Entry& entry) const
+{
+	if (entry.SubBits != 0) {
+		UINT64 index = reader.peek(PRIMARY_BITS + entry.SubBits) >> PRIMARY_BITS;
+		const Entry& subEntry = table[entry.Value + static_cast<size_t>(index)];
+		if (subEntry.Length != 0) {
+			reader.consume(subEntry.Length);
+			return static_cast<UINT16>(subEntry.Value);
+		}
+	}
+	return decodeCanonical(reader);
+}
+
+UINT16 HuffmanDecoder::decodeCanonical(BitReader& reader) const
+{
+	UINT64 code = 0;
+	for (UINT32 length = 1; length <= MAX_LENGTH; length++) {
+		reader.refill();
+		code = (code << 1) | reader.peek(1);
+		reader.consume(1);
+		if (code - firstCode[length] < countOfLength[length]) {
+			return sortedSymbols[firstIndex[length] + static_cast<size_t>(code - firstCode[length])];
+		}
+	}
+	// Not a valid code
+	reader.invalidate();
+	return 0;
+}
+
+HuffmanDecoder::HuffmanDecoder(const LengthTable<UINT8>& lengths)
+{
+	std::array<HuffmanCode, HUFFMAN_SYMBOLS> codes = canonicalCodes(lengths);
+	// Canonical decoding state
+	countOfLength.fill(0);
+	firstCode.fill(0);
+	firstIndex.fill(0);
+	for (UINT16 symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+		if (codes[symbol].Length != 0 && codes[symbol].Length <= MAX_LENGTH) {
+			countOfLength[codes[symbol].Length] += 1;
+		}
+	}
+	UINT16 offset = 0;
+	for (UINT32 length = 1; length <= MAX_LENGTH; length++) {
+		firstIndex[length] = offset;
+		offset += countOfLength[length];
+	}
+	sortedSymbols.resize(offset);
+	std::array<UINT16, MAX_LENGTH + 1> filled = {};
+	std::array<bool, MAX_LENGTH + 1> seen = {};
+	for (UINT32 length = 1; length <= MAX_LENGTH; length++) {
+		for (UINT16 symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+			if (codes[symbol].Length != length) {
+				continue;
+			}
+			if (!seen[length]) {
+				firstCode[length] = codes[symbol].Bits;
+				seen[length] = true;
+			}
+			sortedSymbols[firstIndex[length] + filled[length]] = symbol;
+			filled[length] += 1;
+		}
+	}
+	// Size the sub-table behind every primary entry by its longest code
+	static const UINT32 PRIMARY_SIZE = 1 << PRIMARY_BITS;
+	std::array<UINT8, PRIMARY_SIZE> subBits = {};
+	for (UINT16 symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+		UINT32 length = codes[symbol].Length;
+		if (length > PRIMARY_BITS && length <= PRIMARY_BITS + MAX_SUB_BITS) {
+			UINT64 prefix = reverseBits(codes[symbol].Bits >> (length - PRIMARY_BITS), PRIMARY_BITS);
+			subBits[prefix] = std::max(subBits[prefix], static_cast<UINT8>(length - PRIMARY_BITS));
+		}
+	}
+	size_t tableSize = PRIMARY_SIZE;
+	table.assign(PRIMARY_SIZE, Entry{ 0, 0, 0 });
+	for (UINT32 prefix = 0; prefix < PRIMARY_SIZE; prefix++) {
+		if (subBits[prefix] != 0) {
+			table[prefix] = Entry{ static_cast<UINT32>(tableSize), 0, subBits[prefix] };
+			tableSize += static_cast<size_t>(1) << subBits[prefix];
+		}
+	}
+	table.resize(tableSize, Entry{ 0, 0, 0 });
+	// Fill every entry whose index starts with a code
+	for (UINT16 symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+		UINT32 length = codes[symbol].Length;
+		if (length == 0 || length > PRIMARY_BITS + MAX_SUB_BITS) {
+			continue;
+		}
+		// Bits arrive least significant first, so tables are indexed by
+		// the bit-reversed code
+		UINT64 reversed = reverseBits(codes[symbol].Bits, length);
+		if (length <= PRIMARY_BITS) {
+			for (UINT64 index = reversed; index < PRIMARY_SIZE; index += static_cast<UINT64>(1) << length) {
+				table[static_cast<size_t>(index)] = Entry{ symbol, static_cast<UINT8>(length), 0 };
+			}
+		}
+		else {
+			const Entry& link = table[static_cast<size_t>(reversed & (PRIMARY_SIZE - 1))];
+			UINT32 subLength = length - PRIMARY_BITS;
+			UINT64 subSize = static_cast<UINT64>(1) << link.SubBits;
+			for (UINT64 index = reversed >> PRIMARY_BITS; index < subSize; index += static_cast<UINT64>(1) << subLength) {
+				table[link.Value + static_cast<size_t>(index)] = Entry{ symbol, static_cast<UINT8>(length), 0 };
+			}
+		}
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <limits>
+#include <vector>
+#include "commontypes.h"
+#include "BitReader.h"
+
+// Number of symbols in every Huffman alphabet
+static const UINT16 HUFFMAN_SYMBOLS = 256;
+
+// Longest code length the encoder produces, so codes fit the fast decode tables
+static const UINT8 MAX_HUFFMAN_CODE_LENGTH = 16;
+
+// Canonical Huffman code of a symbol, most significant bit sent first
+struct HuffmanCode {
+	UINT64 Bits; // Code value
+	UINT8 Length; // Code length in bits, 0 if the symbol has no code
+};
+
+// Build Huffman code lengths from symbol counts with the in-place
+// Moffat-Katajainen method, then limit them to maxLength bits. Symbols with
+// a count of 0 get a length of 0 and no code.
+LengthTable<UINT8> huffmanCodeLengths(
+	const std::array<UINT32, HUFFMAN_SYMBOLS>& counts,
+	UINT8 maxLength = MAX_HUFFMAN_CODE_LENGTH);
+
+// Assign canonical codes from code lengths: symbols sorted by length, then
+// by symbol index, take consecutive code values. Lengths of 0 mark unused
+// symbols and lengths over 64 bits are left without a code.
+std::array<HuffmanCode, HUFFMAN_SYMBOLS> canonicalCodes(const LengthTable<UINT8>& lengths);
+
+// Canonical codes with their bits reversed, so that writing them least
+// significant bit first sends the most significant code bit first
+std::array<HuffmanCode, HUFFMAN_SYMBOLS> reversedCanonicalCodes(const LengthTable<UINT8>& lengths);
+
+// Table-driven canonical Huffman decoder
+class HuffmanDecoder
+{
+private:
+	// Bits indexing the primary table
+	static const UINT32 PRIMARY_BITS = 10;
+	// Maximum bits indexing a sub-table
+	static const UINT32 MAX_SUB_BITS = 10;
+	// Longest code the canonical fallback can decode
+	static const UINT32 MAX_LENGTH = BitReader::REFILL_BITS;
+
+	// Lookup table entry
+	struct Entry {
+		UINT32 Value; // Symbol index, or offset of the linked sub-table
+		UINT8 Length; // Bits consumed by the symbol, 0 if not resolved here
+		UINT8 SubBits; // Index bits of the linked sub-table, 0 if none
+	};
+	// Primary table followed by all sub-tables
+	std::vector<Entry> table;
+
+	// Canonical decoding state for codes longer than the tables cover
+	std::array<UINT64, MAX_LENGTH + 1> firstCode; // First code of each length
+	std::array<UINT16, MAX_LENGTH + 1> countOfLength; // Codes of each length
+	std::array<UINT16, MAX_LENGTH + 1> firstIndex; // Offset into sortedSymbols
+	std::vector<UINT16> sortedSymbols; // Symbols in canonical order
+
+	// Decode a symbol index not resolved by the primary table
+	UINT16 decodeLong(BitReader& reader, const Entry& entry) const;
+	// Decode a symbol index one bit at a time
+	UINT16 decodeCanonical(BitReader& reader) const;
+public:
+	// Decode the next symbol index in [0, HUFFMAN_SYMBOLS)
+	UINT16 decodeIndex(BitReader& reader) const;
+	// Decode the next symbol as a value of type T
+	template <typename T>
+	T decode(BitReader& reader) const;
+	HuffmanDecoder(const LengthTable<UINT8>& lengths);
+};
+
+inline UINT16 HuffmanDecoder::decodeIndex(BitReader& reader) const
+{
+	reader.refill();
+	const Entry& entry = table[static_cast<size_t>(reader.peek(PRIMARY_BITS))];
+	if (entry.Length != 0) {
+		reader.consume(entry.Length);
+		return static_cast<UINT16>(entry.Value);
+	}
+	return decodeLong(reader, entry);
+}
+
+template<typename T>
+inline T HuffmanDecoder::decode(BitReader& reader) const
+{
+	return static_cast<T>(decodeIndex(reader) + std::numeric_limits<T>::min());
+}
@@ -1,18 +1,34 @@
 #include "stdafx.h"
+#include <algorithm>
 #include <cstring>
 #include "commontypes.h"
 #include "IM3File.h"
 
-void IM3File::Save(HANDLE fileHandle)
+UINT64 IM3File::SaveHeader(Stream& stream)
 {
-	static const DWORD fileHeaderWithTablesSize = sizeof(fileHeaderWithTables);
-	DWORD bytesWritten;
-	WriteFile(
-		fileHandle,
-		&fileHeaderWithTables,
-		fileHeaderWithTablesSize,
-		&bytesWritten,
-		NULL);
+	// A compact file leaves the plane headers out
+	UINT8 magicByteM = fileHeaderWithTables.FileHeader.MagicByteM;
+	UINT64 headerSize = magicByteM == 'C' ? sizeof(FileHeader) : sizeof(fileHeaderWithTables);
+	BOOL written = stream.write(&fileHeaderWithTables, static_cast<size_t>(headerSize));
+	if (magicByteM == 'X' || magicByteM == 'C') {
+		size_t indexSize = restartSegments.size() * sizeof(RestartSegment);
+		written &= stream.write(&extensionHeader, sizeof(extensionHeader));
+		written &= stream.write(restartSegments.data(), indexSize);
+		headerSize += sizeof(extensionHeader) + indexSize;
+	}
+	return written ? headerSize : 0;
+}
+
+void IM3File::setACBytes(UINT8 plane, UINT64 acZeroesBytes, UINT64 acValuesBytes)
+{
+	extensionHeader.ACZeroesBytes[plane] = acZeroesBytes;
+	extensionHeader.ACValuesBytes[plane] = acValuesBytes;
+}
+
+BOOL IM3File::Save(Stream& stream)
+{
+	BOOL written = SaveHeader(stream) != 0;
+	size_t firstSegment = 0;
 	for (UINT8 i = 0; i < 3; i++) {
 		Plane* plane = NULL;
 		switch (i)
@@ -27,92 +43,289 @@ void IM3File::Save(HANDLE fileHandle)
 			plane = &(Planes.V);
 			break;
 		}
-		for (UINT8 j = 0; j < 3; j++) {
-			std::vector<bool>* data = NULL;
-			switch (j) {
-			case 0:
-				data = &(plane->DC);
-				break;
-			case 1:
-				data = &(plane->AC0);
-				break;
-			case 2:
-				data = &(plane->AC1);
-				break;
+		if (extensionHeader.RestartInterval == 0) {
+			for (UINT8 j = 0; j < 3; j++) {
+				std::vector<BYTE>* data = NULL;
+				switch (j) {
+				case 0:
+					data = &(plane->DC);
+					break;
+				case 1:
+					data = &(plane->AC0);
+					break;
+				case 2:
+					data = &(plane->AC1);
+					break;
+				}
+				written &= stream.write(data->data(), data->size());
 			}
-			size_t numBits = data->size();
-			DWORD bufSize = static_cast<DWORD>(ceil(numBits / 8.0));
-			BYTE* outputBuffer = new BYTE[bufSize];
-			BYTE b;
-			for (size_t bit = 0; bit < numBits; bit++) {
-				BYTE x = !!(data->at(bit));
-				b ^= (-x ^ b) & (1 << (bit % 8));
-				if ((bit + 1) % 8 == 0) {
-					outputBuffer[bit / 8] = b;
+			continue;
+		}
+		// Interleave the streams segment by segment
+		std::array<size_t, 3> offsets = {};
+		size_t numSegments = planeSegments(i);
+		for (size_t k = 0; k < numSegments; k++) {
+			const RestartSegment& segment = restartSegments[firstSegment + k];
+			for (UINT8 j = 0; j < 3; j++) {
+				std::vector<BYTE>* data = NULL;
+				UINT32 segmentBytes = 0;
+				switch (j) {
+				case 0:
+					data = &(plane->DC);
+					segmentBytes = segment.DCBytes;
+					break;
+				case 1:
+					data = &(plane->AC0);
+					segmentBytes = segment.ACZeroesBytes;
+					break;
+				case 2:
+					data = &(plane->AC1);
+					segmentBytes = segment.ACValuesBytes;
+					break;
 				}
+				written &= stream.write(data->data() + offsets[j], segmentBytes);
+				offsets[j] += segmentBytes;
 			}
-			outputBuffer[bufSize - 1] = b;
-			WriteFile(
-				fileHandle,
-				outputBuffer,
-				bufSize,
-				&bytesWritten,
-				NULL);
-			delete[] outputBuffer;
 		}
+		firstSegment += numSegments;
 	}
-	CloseHandle(fileHandle);
+	return written;
 }
 
-FileHeaderWithTables IM3File::getFileHeaderWithTables()
+FileHeaderWithTables IM3File::getFileHeaderWithTables() const
 {
 	return fileHeaderWithTables;
 }
 
-std::vector<bool> IM3File::getBitsReadFromFile()
+UINT32 IM3File::getWidth() const
+{
+	return extensionHeader.Width;
+}
+
+UINT32 IM3File::getHeight() const
+{
+	return extensionHeader.Height;
+}
+
+INT32 IM3File::getBlocksWide() const
+{
+	return blocksCovering(extensionHeader.Width);
+}
+
+INT32 IM3File::getBlocksHigh() const
+{
+	return blocksCovering(extensionHeader.Height);
+}
+
+UINT64 IM3File::getACZeroesBytes(UINT8 plane) const
+{
+	return extensionHeader.ACZeroesBytes[plane];
+}
+
+UINT64 IM3File::getACValuesBytes(UINT8 plane) const
+{
+	return extensionHeader.ACValuesBytes[plane];
+}
+
+const BYTE* IM3File::getPayload() const
+{
+	return payload;
+}
+
+size_t IM3File::getPayloadSize() const
+{
+	return payloadSize;
+}
+
+UINT16 IM3File::getRestartInterval() const
+{
+	return extensionHeader.RestartInterval;
+}
+
+UINT8 IM3File::getVersion() const
 {
-	return bitsReadFromFile;
+	return extensionHeader.Version;
 }
 
-IM3File::IM3File(HANDLE fileHandle)
+UINT8 IM3File::getSampling() const
 {
+	return extensionHeader.Sampling;
+}
+
+UINT8 IM3File::getHuffmanTables() const
+{
+	return extensionHeader.HuffmanTables;
+}
+
+UINT8 IM3File::getEntropyCoding() const
+{
+	return extensionHeader.EntropyCoding;
+}
+
+const UINT8* IM3File::getQuantizationTable(UINT8 table) const
+{
+	// No table has a zero entry
+	if (extensionHeader.QuantizationTables[table][0] == 0) {
+		return NULL;
+	}
+	return extensionHeader.QuantizationTables[table];
+}
+
+size_t IM3File::planeSegments(UINT8 plane) const
+{
+	if (extensionHeader.RestartInterval == 0) {
+		return 0;
+	}
+	std::pair<INT32, INT32> blocks = planeBlocks(
+		extensionHeader.Sampling,
+		plane,
+		getBlocksWide(),
+		getBlocksHigh());
+	size_t numBlocks = static_cast<size_t>(blocks.first) * blocks.second;
+	return (numBlocks + extensionHeader.RestartInterval - 1) / extensionHeader.RestartInterval;
+}
+
+const std::vector<RestartSegment>& IM3File::getRestartSegments() const
+{
+	return restartSegments;
+}
+
+IM3File::IM3File(std::unique_ptr<Stream> stream, bool memoryMap)
+	: payload(NULL), payloadSize(0)
+{
+	std::memset(&extensionHeader, 0, sizeof(extensionHeader));
 	static const UINT64 fileHeaderWithTablesSize = sizeof(fileHeaderWithTables);
-	LARGE_INTEGER fileSizeStruct;
-	GetFileSizeEx(fileHandle, &fileSizeStruct);
-	UINT64 fileSize = fileSizeStruct.QuadPart;
-	BYTE* readBytes = new BYTE[fileSize];
-	DWORD bytesRead;
-	ReadFile(
-		fileHandle,
-		readBytes,
-		static_cast<DWORD>(fileSize),
-		&bytesRead,
-		NULL);
-	CloseHandle(fileHandle);
-	std::memcpy(
-		&fileHeaderWithTables,
-		readBytes,
-		fileHeaderWithTablesSize);
-	for (UINT64 i = fileHeaderWithTablesSize; i < fileSize; i++) {
-		BYTE readByte = readBytes[i];
-		BYTE mask = 0x01;
-		for (UINT8 bitIndex = 0; bitIndex < 8; bitIndex++) {
-			bitsReadFromFile.push_back(!!(readByte & mask));
-			mask <<= 1;
+	UINT64 fileSize = stream->size();
+	const BYTE* fileBytes = NULL;
+	// Map the file into memory when asked to, else read it in
+	if (memoryMap) {
+		fileBytes = stream->map();
+	}
+	if (fileBytes) {
+		// The mapping lasts as long as its stream
+		mappedStream = std::move(stream);
+	}
+	else {
+		readBytes.resize(static_cast<size_t>(fileSize));
+		fileSize = stream->read(readBytes.data(), readBytes.size());
+		readBytes.resize(static_cast<size_t>(fileSize));
+		fileBytes = readBytes.data();
+	}
+	std::memset(static_cast<void*>(&fileHeaderWithTables), 0, fileHeaderWithTablesSize);
+	if (fileSize >= sizeof(FileHeader)) {
+		std::memcpy(&fileHeaderWithTables.FileHeader, fileBytes, sizeof(FileHeader));
+	}
+	// A compact file has no plane headers, its tables left zero
+	UINT64 headerSize = fileHeaderWithTables.FileHeader.MagicByteM == 'C' ?
+		sizeof(FileHeader) : fileHeaderWithTablesSize;
+	if (fileSize >= headerSize) {
+		std::memcpy(
+			&fileHeaderWithTables,
+			fileBytes,
+			static_cast<size_t>(headerSize));
+		payload = fileBytes + headerSize;
+		payloadSize = static_cast<size_t>(fileSize - headerSize);
+	}
+	// The extension or restart header and the restart index sit between
+	// the tables and the payload
+	size_t extensionSize = 0;
+	UINT8 magicByteM = fileHeaderWithTables.FileHeader.MagicByteM;
+	bool valid = fileHeaderWithTables.FileHeader.MagicByteI == 'I' &&
+		(magicByteM == 'M' || magicByteM == 'R' || magicByteM == 'X' || magicByteM == 'C');
+	if (payload && fileHeaderWithTables.FileHeader.MagicByteM == 'R') {
+		RestartHeader header = {};
+		extensionSize = sizeof(header);
+		valid = payloadSize >= extensionSize;
+		if (valid) {
+			std::memcpy(&header, payload, sizeof(header));
+		}
+		extensionHeader.HeaderBytes = sizeof(header);
+		extensionHeader.RestartInterval = header.RestartInterval;
+		valid = valid && header.RestartInterval != 0;
+	}
+	else if (payload && (magicByteM == 'X' || magicByteM == 'C')) {
+		UINT16 headerBytes = 0;
+		valid = payloadSize >= sizeof(headerBytes);
+		if (valid) {
+			std::memcpy(&headerBytes, payload, sizeof(headerBytes));
+			extensionSize = headerBytes;
+			valid = headerBytes >= sizeof(headerBytes) && payloadSize >= extensionSize;
 		}
+		if (valid) {
+			// Newer writers may append fields this reader does not know
+			std::memcpy(&extensionHeader, payload, std::min(extensionSize, sizeof(extensionHeader)));
+			// Arithmetic coding and the default tables came with the 16-bit
+			// components of version 3. Only files needing no tables of their
+			// own leave the plane headers out.
+			bool tablesNeeded = extensionHeader.EntropyCoding == ENTROPY_HUFFMAN &&
+				extensionHeader.HuffmanTables == TABLES_OPTIMIZED;
+			valid = extensionHeader.Sampling <= SAMPLING_420 &&
+				extensionHeader.EntropyCoding <= ENTROPY_ARITHMETIC &&
+				extensionHeader.HuffmanTables <= TABLES_DEFAULT_HIGH &&
+				(tablesNeeded || extensionHeader.Version >= 3) &&
+				(magicByteM == 'X' || !tablesNeeded) &&
+				(magicByteM == 'C' || extensionHeader.HuffmanTables == TABLES_OPTIMIZED);
+		}
+	}
+	if (valid && extensionHeader.Version < 2) {
+		// Version 1 sizes are in the File Header
+		const FileHeader& fileHeader = fileHeaderWithTables.FileHeader;
+		extensionHeader.Version = 1;
+		extensionHeader.Width = fileHeader.BlocksWide * 8;
+		extensionHeader.Height = fileHeader.BlocksHigh * 8;
+		extensionHeader.ACZeroesBytes[0] = fileHeader.YACZeroesBytes;
+		extensionHeader.ACValuesBytes[0] = fileHeader.YACValuesBytes;
+		extensionHeader.ACZeroesBytes[1] = fileHeader.UACZeroesBytes;
+		extensionHeader.ACValuesBytes[1] = fileHeader.UACValuesBytes;
+		extensionHeader.ACZeroesBytes[2] = fileHeader.VACZeroesBytes;
+		extensionHeader.ACValuesBytes[2] = fileHeader.VACValuesBytes;
+	}
+	// Pixel counts must fit INT32
+	static const UINT64 MAX_PIXELS = 0x7fffffff;
+	valid = valid && getWidth() <= MAX_PIXELS && getHeight() <= MAX_PIXELS &&
+		static_cast<UINT64>(getWidth()) * getHeight() <= MAX_PIXELS;
+	size_t numSegments = 0;
+	for (UINT8 i = 0; i < 3 && valid; i++) {
+		numSegments += planeSegments(i);
+	}
+	size_t indexSize = extensionSize + numSegments * sizeof(RestartSegment);
+	if (valid && payloadSize >= indexSize) {
+		restartSegments.resize(numSegments);
+		// Without segments the vector holds no storage to copy to
+		if (numSegments != 0) {
+			std::memcpy(
+				restartSegments.data(),
+				payload + extensionSize,
+				numSegments * sizeof(RestartSegment));
+		}
+		payload += indexSize;
+		payloadSize -= indexSize;
+	}
+	else {
+		// Not a valid extension
+		std::memset(&extensionHeader, 0, sizeof(extensionHeader));
+		payload = NULL;
+		payloadSize = 0;
 	}
-	delete[] readBytes;
 }
 
 IM3File::IM3File(
-	UINT8 blocksWide,
-	UINT8 blocksHigh,
 	std::array<
 	std::pair<EntropiedDC, EntropiedAC>, 3
-	> entropyCoded)
+	> entropyCoded,
+	const ExtensionHeader& extensionHeader,
+	const std::vector<RestartSegment>& restartSegments)
+	: extensionHeader(extensionHeader), restartSegments(restartSegments),
+	payload(NULL), payloadSize(0)
 {
-	fileHeaderWithTables.FileHeader.BlocksWide = blocksWide;
-	fileHeaderWithTables.FileHeader.BlocksHigh = blocksHigh;
+	std::memset(static_cast<void*>(&fileHeaderWithTables.FileHeader), 0, sizeof(FileHeader));
+	fileHeaderWithTables.FileHeader.MagicByteI = 'I';
+	// Tables are written only when the streams are coded with them
+	bool tablesNeeded = extensionHeader.EntropyCoding == ENTROPY_HUFFMAN &&
+		extensionHeader.HuffmanTables == TABLES_OPTIMIZED;
+	fileHeaderWithTables.FileHeader.MagicByteM = tablesNeeded ? 'X' : 'C';
+	this->extensionHeader.HeaderBytes = sizeof(ExtensionHeader);
+	this->extensionHeader.Version = 3;
 	for (UINT8 i = 0; i < 3; i++) {
 		EntropiedDC entropiedDC = entropyCoded[i].first;
 		EntropiedACFirst entropiedACFirst = entropyCoded[i].second.first;
@@ -124,33 +337,23 @@ IM3File::IM3File(
 
 		PlaneHeader* dest = NULL;
 		Plane* plane = NULL;
-		UINT16* acZeroesBytes = NULL;
-		UINT16* acValuesBytes = NULL;
 		switch (i)
 		{
 		case 0:
 			dest = &(fileHeaderWithTables.YPlaneHeader);
 			plane = &(Planes.Y);
-			acZeroesBytes = &(fileHeaderWithTables.FileHeader.YACZeroesBytes);
-			acValuesBytes = &(fileHeaderWithTables.FileHeader.YACValuesBytes);
 			break;
 		case 1:
 			dest = &(fileHeaderWithTables.UPlaneHeader);
 			plane = &(Planes.U);
-			acZeroesBytes = &(fileHeaderWithTables.FileHeader.UACZeroesBytes);
-			acValuesBytes = &(fileHeaderWithTables.FileHeader.UACValuesBytes);
 			break;
 		case 2:
 			dest = &(fileHeaderWithTables.VPlaneHeader);
 			plane = &(Planes.V);
-			acZeroesBytes = &(fileHeaderWithTables.FileHeader.VACZeroesBytes);
-			acValuesBytes = &(fileHeaderWithTables.FileHeader.VACValuesBytes);
 			break;
 		}
-		*acZeroesBytes =
-			static_cast<UINT16>(ceil(entropiedACFirst.second.size() / 8.0));
-		*acValuesBytes =
-			static_cast<UINT16>(ceil(entropiedACSecond.second.size() / 8.0));
+		this->extensionHeader.ACZeroesBytes[i] = entropiedACFirst.second.size();
+		this->extensionHeader.ACValuesBytes[i] = entropiedACSecond.second.size();
 
 		PlaneHeader temp;
 		for (UINT16 i = 0; i < 256; i++) {
@@ -165,8 +368,3 @@ IM3File::IM3File(
 		plane->AC1 = entropiedACSecond.second;
 	}
 }
-
-IM3File::~IM3File()
-{
-	// TODO: Implement
-}
@@ -1,7 +1,9 @@
 #pragma once
+#include <memory>
 #include <vector>
 #include "commontypes.h"
 #include "Codec.h"
+#include "Stream.h"
 
 // Forward declaration of class dependencies
 class Codec;
@@ -11,27 +13,77 @@ class IM3File
 private:
 	FileHeaderWithTables fileHeaderWithTables;
 	struct Plane {
-		std::vector<bool> DC;
-		std::vector<bool> AC0;
-		std::vector<bool> AC1;
+		std::vector<BYTE> DC;
+		std::vector<BYTE> AC0;
+		std::vector<BYTE> AC1;
 	};
 	struct Planes {
 		Plane Y;
 		Plane U;
 		Plane V;
 	} Planes;
-	std::vector<bool> bitsReadFromFile;
+	// Extension header, filled in from the File Header for version 1 files
+	ExtensionHeader extensionHeader;
+	// Restart index, empty when the file has no restart segments
+	std::vector<RestartSegment> restartSegments;
+	// Entropy-coded data following the header of a loaded file
+	const BYTE* payload;
+	size_t payloadSize;
+	// Storage of a loaded file, either read into memory or mapped from the
+	// stream kept open for it
+	std::vector<BYTE> readBytes;
+	std::unique_ptr<Stream> mappedStream;
+	// Number of restart segments of a plane
+	size_t planeSegments(UINT8 plane) const;
 public:
-	void Save(HANDLE fileHandle);
-	FileHeaderWithTables getFileHeaderWithTables();
-	std::vector<bool> getBitsReadFromFile();
-	IM3File(HANDLE fileHandle);
+	// Write the file, returning whether every byte was written
+	BOOL Save(Stream& stream);
+	// Write the headers and restart index, leaving the stream for a
+	// payload written separately, and return their size, 0 when they could
+	// not be written
+	UINT64 SaveHeader(Stream& stream);
+	// Sizes of the AC streams of a plane whose payload is written separately
+	void setACBytes(UINT8 plane, UINT64 acZeroesBytes, UINT64 acValuesBytes);
+	FileHeaderWithTables getFileHeaderWithTables() const;
+	// Image size in pixels
+	UINT32 getWidth() const;
+	UINT32 getHeight() const;
+	// Image size in blocks, partial edge blocks included
+	INT32 getBlocksWide() const;
+	INT32 getBlocksHigh() const;
+	// Sizes of the AC streams of a plane without restart segments
+	UINT64 getACZeroesBytes(UINT8 plane) const;
+	UINT64 getACValuesBytes(UINT8 plane) const;
+	// Entropy-coded data of a loaded file
+	const BYTE* getPayload() const;
+	size_t getPayloadSize() const;
+	// Blocks per restart segment, 0 without restart segments
+	UINT16 getRestartInterval() const;
+	// Segment sizes of the Y, then U, then V plane
+	const std::vector<RestartSegment>& getRestartSegments() const;
+	// Format version, 1 for files without sizes in an extension header
+	UINT8 getVersion() const;
+	// Chroma sampling, a Sampling value
+	UINT8 getSampling() const;
+	// Huffman tables of the streams, a HuffmanTables value
+	UINT8 getHuffmanTables() const;
+	// Entropy coding of the streams, an EntropyCoding value
+	UINT8 getEntropyCoding() const;
+	// Luma (0) or chroma (1) quantization table in raster order, NULL when
+	// the file has none
+	const UINT8* getQuantizationTable(UINT8 table) const;
+	// Load a file, mapping the stream into memory when it can be and asked
+	// to, else reading it in
+	IM3File(std::unique_ptr<Stream> stream, bool memoryMap = true);
+	// Version 3 file of the image size in the extension header, its plane
+	// headers left out when its streams are coded without them
 	IM3File(
-		UINT8 blocksWide,
-		UINT8 blocksHigh,
 		std::array<
 		std::pair<EntropiedDC, EntropiedAC>, 3
-		> entropyCoded);
-	~IM3File();
+		> entropyCoded,
+		const ExtensionHeader& extensionHeader,
+		const std::vector<RestartSegment>& restartSegments);
+	IM3File(const IM3File&) = delete;
+	IM3File& operator=(const IM3File&) = delete;
 };
 
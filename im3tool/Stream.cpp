@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "Stream.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+const BYTE* Stream::map()
+{
+	return NULL;
+}
+
+Stream::~Stream()
+{
+}
+
+MemoryStream::MemoryStream()
+	: position(0)
+{
+}
+
+size_t MemoryStream::read(void* buffer, size_t size)
+{
+	size_t available = position < bytes.size() ? std::min(size, bytes.size() - position) : 0;
+	if (available > 0) {
+		memcpy(buffer, bytes.data() + position, available);
+	}
+	position += available;
+	return available;
+}
+
+BOOL MemoryStream::write(const void* buffer, size_t size)
+{
+	// Writing past the end fills the gap with zeroes, as files do
+	if (position + size > bytes.size()) {
+		bytes.resize(position + size);
+	}
+	if (size > 0) {
+		memcpy(bytes.data() + position, buffer, size);
+	}
+	position += size;
+	return TRUE;
+}
+
+BOOL MemoryStream::seek(UINT64 position)
+{
+	this->position = static_cast<size_t>(position);
+	return TRUE;
+}
+
+UINT64 MemoryStream::size()
+{
+	return bytes.size();
+}
+
+const BYTE* MemoryStream::map()
+{
+	return bytes.empty() ? NULL : bytes.data();
+}
+
+#ifdef _WIN32
+
+FileStream::FileStream(HANDLE fileHandle)
+	: fileHandle(fileHandle), fileMapping(NULL), mappedView(NULL)
+{
+	if (this->fileHandle == INVALID_HANDLE_VALUE) {
+		this->fileHandle = NULL;
+	}
+}
+
+FileStream::FileStream(const char* fileName, bool forWriting)
+	: FileStream(CreateFileA(
+		fileName,
+		forWriting ? GENERIC_WRITE : GENERIC_READ,
+		0,
+		NULL,
+		forWriting ? CREATE_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL))
+{
+}
+
+FileStream::~FileStream()
+{
+	if (mappedView) {
+		UnmapViewOfFile(mappedView);
+	}
+	if (fileMapping) {
+		CloseHandle(fileMapping);
+	}
+	if (fileHandle) {
+		CloseHandle(fileHandle);
+	}
+}
+
+size_t FileStream::read(void* buffer, size_t size)
+{
+	// ReadFile takes at most a DWORD of bytes at a time
+	size_t done = 0;
+	while (fileHandle && done < size) {
+		DWORD bytesToRead = static_cast<DWORD>(std::min(size - done, static_cast<size_t>(1) << 30));
+		DWORD bytesRead = 0;
+		if (ReadFile(fileHandle, static_cast<BYTE*>(buffer) + done, bytesToRead, &bytesRead, NULL) != TRUE ||
+			bytesRead == 0) {
+			break;
+		}
+		done += bytesRead;
+	}
+	return done;
+}
+
+BOOL FileStream::write(const void* buffer, size_t size)
+{
+	size_t done = 0;
+	while (fileHandle && done < size) {
+		DWORD bytesToWrite = static_cast<DWORD>(std::min(size - done, static_cast<size_t>(1) << 30));
+		DWORD bytesWritten = 0;
+		if (WriteFile(fileHandle, static_cast<const BYTE*>(buffer) + done, bytesToWrite, &bytesWritten, NULL) != TRUE ||
+			bytesWritten == 0) {
+			break;
+		}
+		done += bytesWritten;
+	}
+	return fileHandle && done == size;
+}
+
+BOOL FileStream::seek(UINT64 position)
+{
+	LARGE_INTEGER distance;
+	distance.QuadPart = static_cast<LONGLONG>(position);
+	return fileHandle && SetFilePointerEx(fileHandle, distance, NULL, FILE_BEGIN) == TRUE;
+}
+
+UINT64 FileStream::size()
+{
+	LARGE_INTEGER fileSize;
+	if (!fileHandle || GetFileSizeEx(fileHandle, &fileSize) != TRUE) {
+		return 0;
+	}
+	return static_cast<UINT64>(fileSize.QuadPart);
+}
+
+const BYTE* FileStream::map()
+{
+	if (!mappedView && fileHandle && size() > 0) {
+		fileMapping = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (fileMapping) {
+			mappedView = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+			if (!mappedView) {
+				CloseHandle(fileMapping);
+				fileMapping = NULL;
+			}
+		}
+	}
+	return static_cast<const BYTE*>(mappedView);
+}
+
+BOOL FileStream::isOpen() const
+{
+	return fileHandle != NULL;
+}
+
+#else
+
+FileStream::FileStream(const char* fileName, bool forWriting)
+	: file(fopen(fileName, forWriting ? "wb" : "rb")), mappedSize(0), mappedView(NULL)
+{
+}
+
+FileStream::~FileStream()
+{
+	if (mappedView) {
+		munmap(mappedView, mappedSize);
+	}
+	if (file) {
+		fclose(file);
+	}
+}
+
+size_t FileStream::read(void* buffer, size_t size)
+{
+	return file ? fread(buffer, 1, size, file) : 0;
+}
+
+BOOL FileStream::write(const void* buffer, size_t size)
+{
+	// Empty buffers may be NULL, which fwrite is not to be passed
+	if (size == 0) {
+		return file != NULL;
+	}
+	return file && fwrite(buffer, 1, size, file) == size;
+}
+
+BOOL FileStream::seek(UINT64 position)
+{
+	return file && fseeko(file, static_cast<off_t>(position), SEEK_SET) == 0;
+}
+
+UINT64 FileStream::size()
+{
+	// Bytes still buffered count too
+	struct stat status;
+	if (!file || fflush(file) != 0 || fstat(fileno(file), &status) != 0) {
+		return 0;
+	}
+	return static_cast<UINT64>(status.st_size);
+}
+
+const BYTE* FileStream::map()
+{
+	UINT64 fileSize = size();
+	if (!mappedView && fileSize > 0) {
+		void* view = mmap(NULL, static_cast<size_t>(fileSize), PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (view != MAP_FAILED) {
+			mappedView = view;
+			mappedSize = static_cast<size_t>(fileSize);
+		}
+	}
+	return static_cast<const BYTE*>(mappedView);
+}
+
+BOOL FileStream::isOpen() const
+{
+	return file != NULL;
+}
+
+#endif
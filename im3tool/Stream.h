@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+#include "commontypes.h"
+
+// Byte stream the bitmap and IM3 files are read from and written to, so
+// that neither depends on the file API of the platform
+class Stream
+{
+public:
+	// Read up to size bytes, returning the number read
+	virtual size_t read(void* buffer, size_t size) = 0;
+	// Write size bytes, returning whether all were written
+	virtual BOOL write(const void* buffer, size_t size) = 0;
+	// Move to a byte offset from the start
+	virtual BOOL seek(UINT64 position) = 0;
+	// Size in bytes
+	virtual UINT64 size() = 0;
+	// The whole stream mapped read-only into memory for as long as the
+	// stream lives, NULL when it cannot be mapped
+	virtual const BYTE* map();
+	virtual ~Stream();
+};
+
+// Stream over a file, closed with the stream
+class FileStream : public Stream
+{
+private:
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE fileMapping;
+#else
+	FILE* file;
+	size_t mappedSize;
+#endif
+	void* mappedView;
+public:
+#ifdef _WIN32
+	// Stream over an open file handle, taking it over
+	explicit FileStream(HANDLE fileHandle);
+#endif
+	// Open a file by name for reading, or create it over any old one for
+	// writing
+	FileStream(const char* fileName, bool forWriting);
+	FileStream(const FileStream&) = delete;
+	FileStream& operator=(const FileStream&) = delete;
+	~FileStream();
+	// Whether the file could be opened
+	BOOL isOpen() const;
+	size_t read(void* buffer, size_t size);
+	BOOL write(const void* buffer, size_t size);
+	BOOL seek(UINT64 position);
+	UINT64 size();
+	const BYTE* map();
+};
+
+// Stream over bytes held in memory, growing as it is written
+class MemoryStream : public Stream
+{
+private:
+	std::vector<BYTE> bytes;
+	size_t position;
+public:
+	MemoryStream();
+	size_t read(void* buffer, size_t size);
+	BOOL write(const void* buffer, size_t size);
+	BOOL seek(UINT64 position);
+	UINT64 size();
+	const BYTE* map();
+};
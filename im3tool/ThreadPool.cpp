@@ -0,0 +1,109 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "ThreadPool.h"
+
+bool ThreadPool::runOne(size_t self)
+{
+	std::function<void()> task;
+	// Newest task of the own queue first, then the oldest of the others
+	for (size_t k = 0; k < queues.size() && !task; k++) {
+		Queue& queue = *queues[(self + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+		if (k == 0) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+	}
+	if (!task) {
+		return false;
+	}
+	queued -= 1;
+	task();
+	return true;
+}
+
+void ThreadPool::work(size_t self)
+{
+	for (;;) {
+		if (runOne(self)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this]() {
+			return stopping || queued > 0;
+		});
+		if (stopping) {
+			return;
+		}
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	if (workers.empty() || count <= 1) {
+		for (size_t i = 0; i < count; i++) {
+			task(i);
+		}
+		return;
+	}
+	std::atomic<size_t> remaining(count);
+	// Deal the tasks out over all queues
+	size_t first = nextQueue.fetch_add(count);
+	for (size_t i = 0; i < count; i++) {
+		Queue& queue = *queues[(first + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back([&task, &remaining, i]() {
+			task(i);
+			remaining -= 1;
+		});
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued += count;
+	}
+	wake.notify_all();
+	// Help until every task has finished
+	while (remaining > 0) {
+		if (!runOne(0)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+UINT32 ThreadPool::getThreadCount() const
+{
+	return static_cast<UINT32>(queues.size());
+}
+
+ThreadPool::ThreadPool(UINT32 numThreads)
+	: queued(0), stopping(false), nextQueue(0)
+{
+	if (numThreads == 0) {
+		numThreads = std::max(1U, std::thread::hardware_concurrency());
+	}
+	for (UINT32 i = 0; i < numThreads; i++) {
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+	for (UINT32 i = 1; i < numThreads; i++) {
+		workers.push_back(std::thread(&ThreadPool::work, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
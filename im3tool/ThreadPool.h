@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "commontypes.h"
+
+// Fixed set of worker threads with one task queue each. Workers take
+// tasks from the back of their own queue and steal from the front of the
+// others' when it runs dry.
+class ThreadPool
+{
+private:
+	// Task queue owned by one thread
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+	// Queue 0 belongs to threads calling parallelFor, the rest to workers
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	// Sleeping workers wait for queued tasks or shutdown
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<size_t> queued;
+	bool stopping;
+	// Next queue to hand a task to
+	std::atomic<size_t> nextQueue;
+	// Run one task from the own queue or a stolen one, false if none
+	bool runOne(size_t self);
+	// Worker thread body
+	void work(size_t self);
+public:
+	// Run task(i) for every i in [0, count) and wait for all of them,
+	// the calling thread helping with the work
+	void parallelFor(size_t count, const std::function<void(size_t)>& task);
+	// Number of threads working on tasks, including the caller
+	UINT32 getThreadCount() const;
+	// Create a pool for numThreads threads in total, 0 for one per core
+	ThreadPool(UINT32 numThreads);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+};
@@ -10,12 +10,56 @@
 template <typename T>
 using LengthTable = std::array<UINT8, std::numeric_limits<T>::max() - std::numeric_limits<T>::min() + 1>;
 
+// Chroma sampling of the U and V planes
+enum Sampling : UINT8 {
+	SAMPLING_444 = 0, // Chroma at full resolution
+	SAMPLING_422 = 1, // Chroma halved horizontally
+	SAMPLING_420 = 2 // Chroma halved horizontally and vertically
+};
+
+// Entropy coding of the streams of a compressed file
+enum EntropyCoding : UINT8 {
+	ENTROPY_HUFFMAN = 0, // Canonical Huffman codes from the tables of the plane headers
+	ENTROPY_ARITHMETIC = 1 // Adaptive binary arithmetic coding, the tables left empty
+};
+
+// Huffman tables of the streams of a compressed file
+enum HuffmanTables : UINT8 {
+	TABLES_OPTIMIZED = 0, // Tables built for the file from its symbol counts, in its plane headers
+	TABLES_DEFAULT = 1, // Built-in luma tables on the Y plane and chroma ones on U and V
+	TABLES_DEFAULT_HIGH = 2 // Built-in tables likewise, for the higher qualities
+};
+
+// Number of luma samples across and down per chroma sample
+inline INT32 horizontalFactor(UINT8 sampling) {
+	return sampling == SAMPLING_444 ? 1 : 2;
+}
+inline INT32 verticalFactor(UINT8 sampling) {
+	return sampling == SAMPLING_420 ? 2 : 1;
+}
+
+// Blocks covering a number of pixels, a partial block counting as whole
+inline INT32 blocksCovering(INT64 pixels) {
+	return static_cast<INT32>((pixels + 7) / 8);
+}
+
+// Blocks across and down a plane of an image blocksWide by blocksHigh
+// luma blocks in size
+inline std::pair<INT32, INT32> planeBlocks(UINT8 sampling, UINT8 plane, INT32 blocksWide, INT32 blocksHigh) {
+	if (plane == 0) {
+		return std::pair<INT32, INT32>(blocksWide, blocksHigh);
+	}
+	INT32 h = horizontalFactor(sampling);
+	INT32 v = verticalFactor(sampling);
+	return std::pair<INT32, INT32>((blocksWide + h - 1) / h, (blocksHigh + v - 1) / v);
+}
+
 // Common typedefs
-typedef std::array<std::vector<INT8>, 3> CodedDC;
-typedef std::array<std::vector<std::pair<UINT8, INT8>>, 3> CodedAC;
-typedef std::pair<LengthTable<INT8>, std::vector<bool>> EntropiedDC;
-typedef std::pair<LengthTable<UINT8>, std::vector<bool>> EntropiedACFirst;
-typedef std::pair<LengthTable<INT8>, std::vector<bool>> EntropiedACSecond;
+typedef std::array<std::vector<INT16>, 3> CodedDC;
+typedef std::array<std::vector<std::pair<UINT8, INT16>>, 3> CodedAC;
+typedef std::pair<LengthTable<INT8>, std::vector<BYTE>> EntropiedDC;
+typedef std::pair<LengthTable<UINT8>, std::vector<BYTE>> EntropiedACFirst;
+typedef std::pair<LengthTable<INT8>, std::vector<BYTE>> EntropiedACSecond;
 typedef std::pair<EntropiedACFirst, EntropiedACSecond> EntropiedAC;
 
 // Structures
@@ -25,7 +69,9 @@ typedef std::pair<EntropiedACFirst, EntropiedACSecond> EntropiedAC;
 // File Header
 struct FileHeader {
 	UINT8 MagicByteI = 73; // 'I' == 73
-	UINT8 MagicByteM = 77; // 'M' == 77
+	UINT8 MagicByteM = 77; // 'M' == 77, 'R' == 82 with a restart header,
+	                       // 'X' == 88 with an extension header, or 'C' == 67
+	                       // with an extension header and no plane headers
 	UINT8 BlocksWide; // Width of image in blocks
 	UINT8 BlocksHigh; // Height of image in blocks
 	UINT16 YACZeroesBytes; // Number of bytes of Y plane Run-Length Zeroes
@@ -35,7 +81,13 @@ struct FileHeader {
 	UINT16 VACZeroesBytes; // Number of bytes of V plane Run-Length Zeroes
 	UINT16 VACValuesBytes; // Number of bytes of V plane Run-Length Values
 };
-// Plane Header
+// Plane Header. From version 3 the DC table codes the size in bits of each
+// DC difference, the bits themselves following the code in the DC stream,
+// and the AC zeroes table codes the run of zeroes before each AC component
+// in the high four bits and its size in the low four, the bits themselves
+// making up the AC values stream. Runs of 16 zeroes are coded on their own
+// as 0xF0, and the end-of-block as 0x00 unless the last component is
+// nonzero. The AC values table is unused.
 struct PlaneHeader {
 	UINT8 DCLengths[256]; // Difference-Coded DC Canonical Huffman Table
 	UINT8 ACZeroesLengths[256]; // Run-Length Zeroes AC Canonical Huffman Table
@@ -43,9 +95,44 @@ struct PlaneHeader {
 };
 // File Header With Tables
 struct FileHeaderWithTables {
-	FileHeader FileHeader;
+	::FileHeader FileHeader;
 	PlaneHeader YPlaneHeader;
 	PlaneHeader UPlaneHeader;
 	PlaneHeader VPlaneHeader;
 };
+// Restart Header, follows the tables when the second magic byte is 'R'
+struct RestartHeader {
+	UINT16 RestartInterval; // Number of blocks per restart segment
+};
+// Extension Header, follows the tables when the second magic byte is 'X'
+// and the File Header when it is 'C', the file needing no tables of its
+// own. Fields past HeaderBytes are absent from the file and read as zero.
+// Version 2 files carry the image size and stream sizes here, leaving the
+// narrower ones of the File Header zero. Version 3 files code the
+// components in 16 bits, as the plane header describes.
+struct ExtensionHeader {
+	UINT16 HeaderBytes; // Size of the extension header in the file
+	UINT16 RestartInterval; // Number of blocks per restart segment, 0 for none
+	UINT8 Sampling; // Chroma sampling of the U and V planes
+	UINT8 QuantizationTables[2][64]; // Luma and chroma quantization tables in
+	                                 // raster order, zeroes for the fixed table
+	UINT8 Version; // Format version, 2 or 3 with the fields below
+	UINT32 Width; // Width of image in pixels
+	UINT32 Height; // Height of image in pixels
+	UINT64 ACZeroesBytes[3]; // Number of bytes of each plane's Run-Length Zeroes
+	UINT64 ACValuesBytes[3]; // Number of bytes of each plane's Run-Length Values
+	UINT8 EntropyCoding; // An EntropyCoding value. Arithmetic coding puts the
+	                     // DC and AC of a plane, or of a restart segment,
+	                     // in one stream in place of the DC stream, the AC
+	                     // streams being empty.
+	UINT8 HuffmanTables; // A HuffmanTables value, the default tables only in
+	                     // version 3 files without plane headers
+};
+// Restart Segment, one per segment of each plane after the restart or
+// extension header
+struct RestartSegment {
+	UINT32 DCBytes; // Number of bytes of the segment's Difference-Coded DC
+	UINT32 ACZeroesBytes; // Number of bytes of the segment's Run-Length Zeroes
+	UINT32 ACValuesBytes; // Number of bytes of the segment's Run-Length Values
+};
 #pragma pack(pop)
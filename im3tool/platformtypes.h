@@ -0,0 +1,31 @@
+#pragma once
+// Windows integer types and macros used throughout the codec, for
+// platforms without <windows.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+typedef int8_t INT8;
+typedef uint8_t UINT8;
+typedef int16_t INT16;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+typedef uint8_t BYTE;
+typedef char CHAR;
+typedef double DOUBLE;
+typedef int BOOL;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define UNREFERENCED_PARAMETER(P) (void)(P)